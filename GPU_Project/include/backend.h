@@ -0,0 +1,90 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "convolution_cpu.h"
+
+// Stages of the float pipelines that can run on any backend. Everything after the gradients runs on the CPU, unless
+// a backend runs the whole detector (BackendDetector)
+enum BackendStage
+{
+    BACKEND_STAGE_GRAY,
+    BACKEND_STAGE_BLUR,
+    BACKEND_STAGE_SOBEL,
+    BACKEND_STAGE_COUNT
+};
+
+// Detectors a backend can run whole, from the input image to the output, keeping the intermediate images on its side
+enum BackendDetector
+{
+    BACKEND_DETECTOR_CANNY,
+    // Harris and Shi-Tomasi
+    BACKEND_DETECTOR_CORNERS,
+    BACKEND_DETECTOR_OTSU,
+    BACKEND_DETECTOR_COUNT
+};
+
+/**
+ * @brief Implementation of the pixel-parallel stages of the float pipelines. Every backend takes and returns host
+ * images, so stages can be mixed freely between backends; the detectors only see the result.
+ * A backend with its own memory (the GPU) can also run whole detectors, so that only the input and the output cross
+ * over; the others leave them to the host pipeline, which calls gray and convolve stage by stage.
+ */
+class Backend
+{
+public:
+    virtual ~Backend() {}
+    virtual const char *name() const = 0;
+    // RGB (CV_8UC3) or 8-bit grayscale (CV_8UC1) image to CV_32F grayscale. false if the backend failed, the output is
+    // then undefined
+    virtual bool gray(const cv::Mat &img, cv::Mat &gray) = 0;
+    // CV_32F convolution. The pad-wide frame is left at 0 (CONV_BORDER_NONE) whatever the backend. false if the
+    // backend failed
+    virtual bool convolve(const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel) = 0;
+
+    // true if the detector below can run whole on this backend
+    virtual bool runsDetector(BackendDetector detector) const { return false; }
+    // Canny of an RGB or grayscale image into a CV_32F map of 0 and 255. highThreshold < 0 takes the Otsu threshold of
+    // the blurred image, lowThreshold < 0 half of the high one. false if the backend failed
+    virtual bool canny(const cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobelX, const ConvolutionKernel &sobelY,
+                       float lowThreshold, float highThreshold, cv::Mat &edges) { return false; }
+    // Harris (det / trace) or Shi-Tomasi corners painted on an RGB image. false if the backend failed
+    virtual bool corners(cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobelX, const ConvolutionKernel &sobelY,
+                         bool shiTomasi) { return false; }
+    // Binarization of an RGB or grayscale image into a CV_32F map of 0 and 255. threshold < 0 takes the Otsu threshold
+    // of the grayscale image. false if the backend failed
+    virtual bool otsu(const cv::Mat &img, int threshold, cv::Mat &binary) { return false; }
+};
+
+Backend *getBackend(const std::string &name);
+std::vector<Backend *> availableBackends();
+
+/**
+ * @brief Backend of every stage and detector of a pipeline context. All stages run on the SIMD/threaded CPU backend
+ * unless set otherwise; with autoSelect, calibrate times every available backend on the first frame and keeps the
+ * fastest one for each stage, and calibrateDetector does the same for a whole detector against the host pipeline.
+ * A backend that fails is replaced by the CPU backend for its stages and by the host pipeline for its detectors,
+ * and the failed stage is redone there.
+ */
+struct BackendSelection
+{
+    Backend *stages[BACKEND_STAGE_COUNT];
+    // Backend running each detector whole, nullptr for the host pipeline
+    Backend *detectors[BACKEND_DETECTOR_COUNT];
+    bool autoSelect = false;
+    bool calibrated = false;
+
+    BackendSelection();
+    void set(Backend *backend);
+    const char *name(BackendStage stage) const { return stages[stage]->name(); }
+    void fail(Backend *failed);
+    void gray(const cv::Mat &img, cv::Mat &gray);
+    void convolve(BackendStage stage, const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel);
+    void calibrate(const cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobel, bool verbose);
+    void calibrateDetector(BackendDetector detector, const std::function<void()> &run, bool verbose);
+};
+
+#ifdef WITH_CUDA
+Backend *cudaBackend();
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+#include <vector>
+
+bool isBatchInput(const std::string &spec);
+std::vector<std::string> listBatchInputs(const std::string &spec);
+std::vector<std::string> batchOutputNames(const std::vector<std::string> &files, int &renamed);
+void printBatchSummary(const std::vector<double> &latenciesMs, int failed, double seconds, int threads, int stolen);
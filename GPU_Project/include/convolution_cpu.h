@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Border handling for the CPU convolution engine.
+ * CONV_BORDER_NONE reproduces the original trivial implementation: the pad-wide frame is left at 0.
+ */
+enum ConvBorder
+{
+    // Border pixels are not computed and left at 0 (legacy behaviour)
+    CONV_BORDER_NONE,
+    // Pixels outside the image are 0 (same as convolutionGPU)
+    CONV_BORDER_CONSTANT,
+    // aaa|abcd|ddd
+    CONV_BORDER_REPLICATE,
+    // cb|abcd|cb
+    CONV_BORDER_REFLECT_101,
+};
+
+/**
+ * @brief A kernel factored once, so that repeated convolutions (one per frame) skip the setup and do not allocate
+ */
+struct ConvolutionKernel
+{
+    int size = 0;
+    bool separable = false;
+    std::vector<float> kernel, row, col;
+
+    void set(const float *values, int kernelSize);
+};
+
+bool factorSeparableKernel(const float *kernel, int kernelSize, float *kernelRow, float *kernelCol);
+void convolveRowCPU(const float *src, float *dst, int width, const float *kernel, int kernelSize, ConvBorder border);
+void convolveColumnsCPU(const float *const *rows, float *dst, int width, const float *kernel, int kernelSize);
+void separableConvolutionBandCPU(const cv::Mat &src, cv::Mat &dst, const float *kernelRow, const float *kernelCol, int kernelSize, ConvBorder border, int rowBegin, int rowEnd, std::vector<float> &scratch);
+void separableConvolutionRectCPU(const cv::Mat &src, cv::Mat &dst, const float *kernelRow, const float *kernelCol, int kernelSize, ConvBorder border, const cv::Rect &rect, std::vector<float> &scratch);
+void separableConvolutionCPU(const cv::Mat &src, cv::Mat &dst, const float *kernelRow, const float *kernelCol, int kernelSize, ConvBorder border = CONV_BORDER_NONE);
+void convolution2DCPU(const cv::Mat &src, cv::Mat &dst, const float *kernel, int kernelSize, ConvBorder border);
+void applyConvolutionCPU(const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel, ConvBorder border = CONV_BORDER_NONE);
+cv::Mat applyConvolutionCPU(const cv::Mat &inputImage, const float *kernel, int kernelSize, ConvBorder border = CONV_BORDER_NONE);
@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_DISPATCH_X86
+#define ISA_TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+#define ISA_TARGET_AVX2 __attribute__((target("avx2,fma,bmi2,popcnt")))
+#define ISA_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,bmi2,popcnt")))
+#endif
+// Row kernel written once in plain C++ and cloned by IsaClones: inlined into every clone, so that each copy is
+// vectorized for its own target
+#define ISA_KERNEL static inline __attribute__((always_inline))
+
+// Instruction set tiers of the dispatched CPU kernels, narrowest first. ISA_BASELINE is whatever the compiler targets
+// by default (SSE2 on x86-64), with no hand-written SIMD
+enum CpuIsa
+{
+    ISA_BASELINE,
+    ISA_SSE42,
+    ISA_AVX2,
+    ISA_AVX512,
+    ISA_COUNT
+};
+
+// Tier the dispatched kernels use, the best one the CPU supports unless set with setCpuIsa
+extern std::atomic<int> cpuIsa;
+
+CpuIsa detectedCpuIsa();
+bool setCpuIsa(CpuIsa isa);
+const char *cpuIsaName(CpuIsa isa);
+bool parseCpuIsa(const std::string &name, CpuIsa &isa);
+
+/**
+ * @brief Variants of a kernel, one per tier. A missing variant (nullptr) falls back to the next narrower tier, so
+ * only the baseline one is mandatory. The tier is read on every call, so --isa takes effect without a restart.
+ */
+template <typename Fn>
+struct IsaDispatch
+{
+    Fn variants[ISA_COUNT];
+
+    Fn get() const
+    {
+        int isa = cpuIsa.load(std::memory_order_relaxed);
+        while (!variants[isa])
+            isa--;
+        return variants[isa];
+    }
+    template <typename... Args>
+    void operator()(Args... args) const { get()(args...); }
+};
+
+/**
+ * @brief SSE4.2, AVX2 and AVX-512 clones of an ISA_KERNEL, e.g. IsaClones<GrayRowFn, grayRow>::table()
+ */
+template <typename Fn, Fn Body>
+struct IsaClones;
+
+template <typename... A, void (*Body)(A...)>
+struct IsaClones<void (*)(A...), Body>
+{
+#ifdef CPU_DISPATCH_X86
+    ISA_TARGET_SSE42 static void sse42(A... a) { Body(a...); }
+    ISA_TARGET_AVX2 static void avx2(A... a) { Body(a...); }
+    ISA_TARGET_AVX512 static void avx512(A... a) { Body(a...); }
+    static constexpr IsaDispatch<void (*)(A...)> table() { return {{Body, sse42, avx2, avx512}}; }
+#else
+    static constexpr IsaDispatch<void (*)(A...)> table() { return {{Body, nullptr, nullptr, nullptr}}; }
+#endif
+};
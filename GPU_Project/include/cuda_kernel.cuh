@@ -1,18 +1,50 @@
 #pragma once
-const int FILTER_WIDTH = 5;
+#include "filters.h"
 const int FILTER_RADIUS = FILTER_WIDTH / 2;
-// const float FILTER_SIGMA = 1.75f;
-const float FILTER_SIGMA = 1.5f;
-// const float FILTER_SIGMA = 3;
-const float ALPHA = 0.05;
-const float K = 0.05;
 
-void rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int N, int M);
+/**
+ * @brief Device scratch of harrisMainKernelWrap and mapCommonKernelWrap for one frame size. Allocated by the first call
+ * and kept while the size stays the same, so that a video does not allocate on the device for every frame
+ */
+struct HarrisDeviceContext
+{
+    int pixels = 0;
+    float *Ix2_d = nullptr, *Iy2_d = nullptr, *IxIy_d = nullptr, *IxIy2_d = nullptr;
+    float *detM_d = nullptr, *traceM_d = nullptr, *output_d = nullptr, *maxValue_d = nullptr;
+    int *count_d = nullptr;
+    cudaStream_t streams[3] = {};
+
+    HarrisDeviceContext() = default;
+    HarrisDeviceContext(const HarrisDeviceContext &) = delete;
+    HarrisDeviceContext &operator=(const HarrisDeviceContext &) = delete;
+    ~HarrisDeviceContext() { release(); }
+    bool prepare(int width, int height);
+    void release();
+};
+
+/**
+ * @brief Device scratch of cannyMainKernelWrap for one frame size: gradient magnitude, direction and the suppressed
+ * magnitude. Allocated by the first call and kept while the size stays the same
+ */
+struct CannyDeviceContext
+{
+    int pixels = 0;
+    float *magnitude_d = nullptr, *direction_d = nullptr, *suppressed_d = nullptr;
+
+    CannyDeviceContext() = default;
+    CannyDeviceContext(const CannyDeviceContext &) = delete;
+    CannyDeviceContext &operator=(const CannyDeviceContext &) = delete;
+    ~CannyDeviceContext() { release(); }
+    bool prepare(int width, int height);
+    void release();
+};
+
+bool rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int N, int M);
 void harrisCornerKernelWrap(float *img_sobel_x, float *img_sobel_y, float *img_harris, int width, int height, float k);
-float harrisMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x, float *sobel_y, int width, int height, float k, float alpha, float *gaussian_kernel, int g_kernel_size, bool shi_tomasi, float *harris_map);
-void cannyMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x, float *sobel_y, int width, int height, float low_threshold, float high_threshold, float *gaussian_kernel, int g_kernel_size, bool is_video);
-void convolutionGPUWrap(float *d_Result, float *d_Data, int data_w, int data_h, float *d_kernel, int kernel_size);
+float harrisMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x, float *sobel_y, int width, int height, float k, float alpha, float *gaussian_kernel, int g_kernel_size, bool shi_tomasi, float *harris_map, HarrisDeviceContext *device = nullptr);
+bool cannyMainKernelWrap(float *edges_d, float *sobel_x, float *sobel_y, int width, int height, float low_threshold, float high_threshold, CannyDeviceContext *device = nullptr);
+bool convolutionGPUWrap(float *d_Result, float *d_Data, int data_w, int data_h, float *d_kernel, int kernel_size);
 void separableConvolutionKernelWrap(float *img_d, float *img_out_d, int width, int height, float *kernel_x, float *kernel_y, int kernel_size);
 int otsuThreshold(float *image, int width, int height);
-void binarizeImgWrapper(unsigned char *img_h, float *img_d, int width, int height, int threshold);
-int mapCommonKernelWrap(const float *harris1, const float *harris2, int width, int height, float threshold, float tollerance, int window, int *d_idx1Mapping, int *d_idx2Mapping);
+bool binarizeImgWrapper(float *output_d, float *img_d, int width, int height, int threshold);
+int mapCommonKernelWrap(const float *harris1, const float *harris2, int width, int height, float threshold, float tollerance, int window, int *d_idx1Mapping, int *d_idx2Mapping, HarrisDeviceContext *device = nullptr);
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Change detection between consecutive video frames on a grid of square tiles, for detectors that only
+ * recompute what changed. A tile is dirty when the mean absolute difference of its grayscale pixels, sampled one out
+ * of step x step, exceeds threshold. Differences are taken against the reference image the cached results come from,
+ * so slow drifts still end up refreshing a tile.
+ */
+struct DirtyTiles
+{
+    // Tile side in pixels, 0 disables the incremental mode
+    int tileSize = 0;
+    // Mean absolute gray level difference above which a tile is dirty
+    float threshold = 2.0f;
+    // Sampling step of the comparison
+    int step = 4;
+
+    int tilesX = 0, tilesY = 0;
+    // false until a reference frame has been stored
+    bool valid = false;
+    // Tiles to recompute: the dirty tiles and their neighbours
+    std::vector<cv::Rect> regions;
+    // Statistics over the frames seen: tiles recomputed and tiles in total
+    long recomputedTiles = 0;
+    long totalTiles = 0;
+
+    int update(const cv::Mat &frame, cv::Mat &reference);
+    void invalidate() { valid = false; }
+    float lastFraction() const { return tilesX * tilesY > 0 ? (float)regions.size() / (tilesX * tilesY) : 0; }
+};
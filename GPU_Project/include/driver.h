@@ -0,0 +1,6 @@
+#pragma once
+#include <string>
+
+// Command line driver of both builds: parses the options and runs the mode. defaultBackend is the backend used when
+// --backend is not given, the cpu one if it is not available
+int runDriver(int argc, const char **argv, const std::string &defaultBackend);
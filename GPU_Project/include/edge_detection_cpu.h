@@ -4,6 +4,20 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include "pipeline_context.h"
 cv::Mat harrisCornerDetectorCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH);
+cv::Mat harrisCornerDetectorCPU(cv::Mat *img, PipelineContext &ctx);
+float cornerResponseMapCPU(cv::Mat *img, PipelineContext &ctx);
+void rgbToGrayCPU(const cv::Mat &img, cv::Mat &img_gray);
+void rgbToGrayFixedCPU(const cv::Mat &img, cv::Mat &img_gray);
 cv::Mat otsuBinarization(cv::Mat *img);
-cv::Mat cannyEdgeDetectionCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH);
\ No newline at end of file
+cv::Mat otsuBinarization(cv::Mat *img, PipelineContext &ctx);
+cv::Mat otsuBinarizationFixed(cv::Mat *img, PipelineContext &ctx);
+cv::Mat otsuSourceCPU(cv::Mat *img, PipelineContext &ctx, bool blurred);
+cv::Mat cannyEdgeDetectionCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH);
+cv::Mat cannyEdgeDetectionCPU(cv::Mat *img, PipelineContext &ctx);
+cv::Mat cannyEdgeDetectionIncrementalCPU(cv::Mat *img, PipelineContext &ctx);
+cv::Mat cannyEdgeDetectionStreamCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH);
+cv::Mat cannyEdgeDetectionStreamCPU(cv::Mat *img, PipelineContext &ctx);
+cv::Mat cannyEdgeDetectionFixedCPU(cv::Mat *img, PipelineContext &ctx);
+void calibrateBackendsCPU(const cv::Mat &img, PipelineContext &ctx, BackendDetector detector);
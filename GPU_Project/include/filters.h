@@ -0,0 +1,121 @@
+#pragma once
+
+/**
+ * @brief Square Width x Width filter, row major, usable in constant expressions
+ */
+template <int Width>
+struct FilterKernel
+{
+    static_assert(Width % 2 == 1, "Filter width must be odd");
+    static constexpr int width = Width;
+    float values[Width * Width];
+};
+
+/**
+ * @brief e^x in a constant expression: x is halved until a short Taylor series is exact in double, and the result
+ * squared back
+ */
+constexpr double constexprExp(double x)
+{
+    int halvings = 0;
+    while (x < -0.5 || x > 0.5)
+    {
+        x /= 2;
+        halvings++;
+    }
+    double term = 1, sum = 1;
+    for (int n = 1; n < 20; n++)
+    {
+        term *= x / n;
+        sum += term;
+    }
+    while (halvings-- > 0)
+        sum *= sum;
+    return sum;
+}
+
+/**
+ * @brief Normalized 2D Gaussian weights. Constant-evaluated by gaussianKernel, called at run time by
+ * computeGaussianKernel for widths only known then, so both give the same weights
+ *
+ * @param values Output, width x width
+ * @param width Odd filter width
+ * @param sigma Standard deviation
+ */
+constexpr void fillGaussianKernel(float *values, int width, float sigma)
+{
+    const int r = width / 2;
+    double sum = 0;
+    for (int y = -r; y <= r; y++)
+    {
+        for (int x = -r; x <= r; x++)
+        {
+            const double value = constexprExp(-(double)(x * x + y * y) / (2.0 * sigma * sigma));
+            values[(y + r) * width + x + r] = (float)value;
+            sum += value;
+        }
+    }
+    for (int i = 0; i < width * width; i++)
+        values[i] = (float)(values[i] / sum);
+}
+
+/**
+ * @brief Gaussian filter generated at compile time, e.g. constexpr auto gaussian = gaussianKernel<5>(1.5f)
+ */
+template <int Width>
+constexpr FilterKernel<Width> gaussianKernel(float sigma)
+{
+    FilterKernel<Width> kernel = {};
+    fillGaussianKernel(kernel.values, Width, sigma);
+    return kernel;
+}
+
+/**
+ * @brief Sobel filter of any odd width: binomial smoothing across the derivative direction, times the binomial
+ * smoothing of width - 2 convolved with the central difference (1, 0, -1) along it. Width 3 gives the usual
+ * {1, 0, -1, 2, 0, -2, 1, 0, -1}
+ *
+ * @param vertical false for the x derivative, true for the y derivative (the transpose)
+ */
+template <int Width>
+constexpr FilterKernel<Width> sobelKernel(bool vertical)
+{
+    // binomial coefficients of widths Width - 2 and Width
+    double smooth[Width] = {1}, inner[Width] = {1};
+    for (int n = 1; n < Width; n++)
+    {
+        for (int k = n; k > 0; k--)
+            smooth[k] += smooth[k - 1];
+        if (n == Width - 3)
+        {
+            for (int k = 0; k <= n; k++)
+                inner[k] = smooth[k];
+        }
+    }
+    double derivative[Width] = {};
+    for (int k = 0; k < Width - 2; k++)
+    {
+        derivative[k] += inner[k];
+        derivative[k + 2] -= inner[k];
+    }
+    FilterKernel<Width> kernel = {};
+    for (int y = 0; y < Width; y++)
+    {
+        for (int x = 0; x < Width; x++)
+            kernel.values[y * Width + x] = (float)(vertical ? smooth[x] * derivative[y] : smooth[y] * derivative[x]);
+    }
+    return kernel;
+}
+
+// Blur of both builds and of every backend
+constexpr int FILTER_WIDTH = 3;
+constexpr float FILTER_SIGMA = 1.75f;
+// Harris response det - K * trace^2, and the share of the largest response corners are kept above (GPU Harris)
+constexpr float K = 0.05f;
+constexpr float ALPHA = 0.05f;
+
+// generated at compile time. The x gradient is {1, 0, -1, 2, 0, -2, 1, 0, -1}, positive where the intensity
+// decreases to the right, and the y gradient its transpose
+constexpr FilterKernel<3> sobel_x_kernel = sobelKernel<3>(false);
+constexpr FilterKernel<3> sobel_y_kernel = sobelKernel<3>(true);
+constexpr FilterKernel<FILTER_WIDTH> gaussian_kernel = gaussianKernel<FILTER_WIDTH>(FILTER_SIGMA);
@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include "raw_io.h"
+
+/**
+ * @brief Output of the headless mode: writes the processed frames to disk instead of showing them and reports
+ * the throughput when closed. Only imgcodecs/videoio are used, so highgui is never initialised.
+ *
+ * The target given to open can be
+ * - a directory: <dir>/<input name>.png for an image, <dir>/<input name>_000000.png, ... for a video
+ * - an image file (png, jpg, bmp, tif, ...): written as is for an image, numbered like above for a video
+ * - a video file (mp4, avi, mkv, mov): every frame is appended to it
+ * - a Y4M file, or "-" for a Y4M stream on stdout: raw frames, without encoding
+ */
+class FrameWriter
+{
+public:
+    bool open(const std::string &out, const std::string &input, bool video);
+    // Frame rate of the output video, 30 unless set before the first frame
+    void setFps(double fps)
+    {
+        if (fps > 0)
+            videoFps = fps;
+    }
+    bool write(const cv::Mat &frame);
+    void close();
+    int frames() const { return frameCount; }
+
+private:
+    std::string framePath(int index) const;
+
+    std::string target;
+    // path without extension, and extension of the written images
+    std::string prefix, extension;
+    bool numbered = false;
+    bool toVideo = false;
+    double videoFps = 30;
+    cv::VideoWriter videoWriter;
+    bool toY4m = false;
+    Y4MWriter y4mWriter;
+    // conversion buffers, reused from one frame to the next
+    cv::Mat frame8u, frameBgr;
+    int frameCount = 0;
+    std::chrono::high_resolution_clock::time_point start;
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+
+int histogramCPU(const cv::Mat &img, int *hist, int step = 1);
+int otsuThresholdFromHistogram(const int *hist, int total);
+
+// Largest number of classes of multiOtsuThresholds
+const int MAX_OTSU_CLASSES = 8;
+void multiOtsuThresholds(const int *hist, int classes, int *thresholds);
+void otsuLabelsCPU(const cv::Mat &img, cv::Mat &out, const int *thresholds, int classes);
+
+/**
+ * @brief Otsu threshold of a video, carried over from frame to frame.
+ * The threshold is only recomputed when the histogram drifts away from the one it was computed from, and the
+ * histograms can be taken on a sparse pixel grid, so Otsu is no longer a full extra pass over every frame.
+ * With the defaults it is plain Otsu on every pixel of every frame.
+ */
+class OtsuTracker
+{
+public:
+    // Histograms read one pixel out of sampleStep x sampleStep. 1 reads every pixel
+    int sampleStep = 1;
+    // The threshold is kept while the histogram stays within this Kolmogorov-Smirnov distance (0 to 1) of the one
+    // it was computed from. 0 recomputes it on every frame
+    float tolerance = 0;
+    // Frames seen and frames on which the threshold was recomputed
+    int frames = 0;
+    int recomputed = 0;
+
+    int threshold(const cv::Mat &img);
+    int update(const int *hist, int total);
+    // Fixes the threshold: threshold() returns value without reading the image until reset, e.g. when a global
+    // threshold is known before the image is processed in tiles
+    void pin(int threshold)
+    {
+        value = threshold;
+        valid = true;
+        pinned = true;
+    }
+    // true if the last threshold may be used before the histogram of the current frame is known
+    bool canReuse() const { return valid && (tolerance > 0 || pinned); }
+    bool isPinned() const { return pinned; }
+    int current() const { return value; }
+    void reset()
+    {
+        valid = false;
+        pinned = false;
+    }
+
+private:
+    int reference[256];
+    int referenceTotal = 0;
+    int value = 0;
+    bool valid = false;
+    bool pinned = false;
+};
+
+/**
+ * @brief Adaptive Otsu binarization: the image is split into a grid of tiles, each tile gets the Otsu threshold of its
+ * own histogram, and every pixel is compared to the bilinear interpolation of the thresholds of the four nearest tile
+ * centres, as CLAHE does with its tile mappings. Dark and bright parts of a frame are then split at their own level.
+ * Costs about as much as the global threshold: one histogram pass and one binarization pass, no per-pixel window.
+ */
+class LocalOtsu
+{
+public:
+    // Approximate side of the tiles in pixels, 0 for one global threshold. Tiles are sized to cover the image evenly
+    int tileSize = 0;
+
+    void computeThresholds(const cv::Mat &img);
+    void binarize(const cv::Mat &img, cv::Mat &out) const;
+    // Threshold of a tile, valid after computeThresholds
+    float tileThreshold(int tx, int ty) const { return thresholds[ty * tilesX + tx]; }
+    int tileCountX() const { return tilesX; }
+    int tileCountY() const { return tilesY; }
+
+private:
+    int tilesX = 0, tilesY = 0;
+    // tilesY x tilesX tile thresholds, and tilesY x cols thresholds interpolated along the rows of tile centres
+    std::vector<float> thresholds, rowThresholds;
+    // Pixel p lies between the centres of tiles first[p] and first[p] + 1, at weight from the first one
+    std::vector<int> firstX, firstY;
+    std::vector<float> weightX, weightY;
+};
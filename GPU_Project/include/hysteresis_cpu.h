@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Values of the double threshold map, same as the GPU WEAK_EDGE/STRONG_EDGE
+const int HYSTERESIS_WEAK = 128;
+const int HYSTERESIS_STRONG = 255;
+
+enum HysteresisMethod
+{
+    // Union-find when the CPU thread pool has more than one thread, worklist otherwise
+    HYSTERESIS_AUTO,
+    // Flood fill from the strong pixels with an explicit stack
+    HYSTERESIS_WORKLIST,
+    // Parallel connected components over row bands, then strong/weak resolution per component
+    HYSTERESIS_UNION_FIND,
+};
+
+template <typename T>
+void hysteresisWorklistCPU(const T *tts, T *out, int width, int height);
+template <typename T>
+void hysteresisUnionFindCPU(const T *tts, T *out, int width, int height);
+void hysteresisCPU(const cv::Mat &tts, cv::Mat &edges, HysteresisMethod method = HYSTERESIS_AUTO);
+void hysteresisRegionsCPU(const cv::Mat &tts, cv::Mat &edges, const std::vector<cv::Rect> &regions);
+void hysteresisLabelsCPU(const cv::Mat &tts, std::vector<int> &labels, std::vector<uint8_t> &strong);
@@ -0,0 +1,19 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief A corner: pixel position and detector response
+ */
+struct Keypoint
+{
+    int x;
+    int y;
+    float response;
+    // Pyramid level it was found on, 0 for full resolution
+    int level;
+};
+
+int selectKeypointsCPU(std::vector<Keypoint> &candidates, int rows, int cols, int maxKeypoints, float minDistance, std::vector<Keypoint> &keypoints);
+int detectKeypointsCPU(const cv::Mat &response, float threshold, int maxKeypoints, float minDistance, std::vector<Keypoint> &keypoints);
+void drawKeypoints(cv::Mat &img, const std::vector<Keypoint> &keypoints, const cv::Vec3b &color);
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "keypoints_cpu.h"
+
+struct PipelineContext;
+
+// Side of the square patch a descriptor is sampled from, centred on the corner
+const int BRIEF_PATCH_SIZE = 31;
+
+/**
+ * @brief 256-bit BRIEF descriptor: bit i is set when the first pixel of the i-th test pair is darker than the second
+ */
+struct BriefDescriptor
+{
+    uint64_t bits[4];
+};
+
+/**
+ * @brief A corner of the previous frame matched to a corner of the current frame
+ */
+struct MotionVector
+{
+    cv::Point from;
+    cv::Point to;
+    // Hamming distance of the two descriptors
+    int distance;
+};
+
+/**
+ * @brief Sparse motion between consecutive frames: corners of each frame get a BRIEF descriptor and are matched to the
+ * corners of the previous frame within searchRadius pixels, by Hamming distance. The previous corners are bucketed in a
+ * uniform grid of searchRadius wide cells, so a corner is only compared with the corners of the 3x3 cells around it
+ * and the cost grows with the number of corners, not with the image size.
+ */
+struct MotionTracker
+{
+    // Largest displacement between two frames, in pixels
+    int searchRadius = 32;
+    // Largest Hamming distance of a match, out of 256
+    int maxDistance = 64;
+    // A match is kept only if its distance is below ratio times the distance of the second best candidate
+    float ratio = 0.8f;
+
+    // Corners and descriptors of the current and of the previous frame. Corners too close to the border for a
+    // descriptor are dropped
+    std::vector<Keypoint> keypoints, previousKeypoints;
+    std::vector<BriefDescriptor> descriptors, previousDescriptors;
+    // Matches of the last frame
+    std::vector<MotionVector> matches;
+    // Frames seen
+    int frames = 0;
+
+    void describe(const cv::Mat &img, const std::vector<Keypoint> &corners);
+    int match();
+    void reset() { frames = 0; }
+
+private:
+    // Test pairs of the descriptor, as offsets from the corner: x1, y1, x2, y2 for each of the 256 bits
+    std::vector<int> pattern;
+    // Grid of the previous corners: first corner of every cell, and next corner of the same cell
+    int cellsX = 0, cellsY = 0;
+    std::vector<int> head, next;
+    std::vector<int> bestMatch;
+};
+
+cv::Mat motionEstimationCPU(cv::Mat *img, PipelineContext &ctx);
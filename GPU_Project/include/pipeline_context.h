@@ -0,0 +1,88 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "convolution_cpu.h"
+#include "histogram_cpu.h"
+#include "structure_tensor_cpu.h"
+#include "keypoints_cpu.h"
+#include "pyramid_cpu.h"
+#include "dirty_tiles_cpu.h"
+#include "motion_cpu.h"
+#include "backend.h"
+
+/**
+ * @brief Kernels and intermediate images of the CPU pipelines for one frame size.
+ * Create it once, pass it to every frame and the buffers are only reallocated when the resolution changes,
+ * so the steady-state per-frame path does not allocate.
+ * Images returned by the detectors point into the context and are overwritten by the next frame.
+ */
+struct PipelineContext
+{
+    ConvolutionKernel gaussian;
+    ConvolutionKernel sobelX;
+    ConvolutionKernel sobelY;
+    // Fixed-point pipeline: Gaussian row and column taps in Q8 (each pass sums to exactly 256) and integer 3x3 Sobel kernels.
+    // fixedPoint is false if the kernels cannot be represented that way
+    std::vector<int> gaussianRowQ8, gaussianColQ8, sobelXInt, sobelYInt;
+    bool fixedPoint = false;
+
+    // Detectors print their time on every call
+    bool verbose = true;
+    // Backend of the gray, blur and Sobel stages of the float pipelines. The fixed-point and streaming pipelines
+    // always run on the CPU
+    BackendSelection backends;
+    // Otsu threshold, carried over from frame to frame on videos. Canny with a fixed high threshold pins it
+    OtsuTracker otsu;
+    // Canny: low threshold on the gradient magnitude, half of the high threshold when negative
+    float cannyLow = -1;
+    // Canny: the double threshold map must be left in thresholded, which the tiled driver reads. Keeps Canny on the
+    // host pipeline, since the detector backends only return the edges
+    bool keepThresholded = false;
+    // Otsu binarization: per-tile thresholds instead of otsu when localOtsu.tileSize > 0
+    LocalOtsu localOtsu;
+    // Otsu binarization: number of classes. More than 2 gives a label image, class c of k as 255 * c / (k - 1)
+    int otsuClasses = 2;
+    // Corner detectors: window and response of the structure tensor. Defaults to a Gaussian window of the blur size,
+    // like the GPU Harris
+    StructureTensorSettings tensor;
+    // Corner detectors: at most maxKeypoints corners, at least keypointMinDistance pixels apart, are returned in
+    // keypoints and painted. With both at 0 every local maximum is painted through the dense maps
+    int maxKeypoints = 0;
+    float keypointMinDistance = 0;
+    std::vector<Keypoint> keypoints;
+    // Corner detectors: corners are kept above 3% of this response instead of 3% of the largest response of the image,
+    // 0 for the latter. Set by the tiled driver to the largest response of the whole image
+    float cornerReference = 0;
+    // Multi-scale detectors: number of pyramid levels, 1 for full resolution only
+    int pyramidLevels = 1;
+    // Pyramid of the grayscale image and one context per coarse level, created on first use
+    ImagePyramid pyramid;
+    std::vector<std::unique_ptr<PipelineContext>> levelContexts;
+    // Incremental Canny: changed tiles, CV_32F grayscale of the current frame (ctx.gray holds the reference the cached
+    // maps come from) and the high threshold of the cached double threshold map
+    DirtyTiles tiles;
+    cv::Mat frameGray;
+    float tilesHighThreshold = -1;
+    // Motion mode: corners and descriptors of the previous frame, and the matches of the last one
+    MotionTracker motion;
+
+    int rows = 0;
+    int cols = 0;
+    // CV_32F grayscale, blurred image and its gradients
+    cv::Mat gray, blurred, gradX, gradY;
+    // Canny: CV_32F squared magnitude, CV_8U NMS sector, CV_32F double threshold map and edges
+    cv::Mat magnitude, direction, thresholded, edges;
+    // Streaming Canny: CV_8U double threshold map and edges
+    cv::Mat labels, labelEdges;
+    // Harris: CV_32F response and its local maxima
+    cv::Mat response, responseNms;
+    // Fixed-point Canny: CV_8U grayscale and blurred image, CV_16U horizontal blur, CV_16S gradients, CV_32S squared magnitude.
+    // The NMS sector, labels and edges are shared with the float pipelines
+    cv::Mat gray8, blurred8, hblur16, gradX16, gradY16, magnitude32;
+
+    PipelineContext(const float *gaussian_kernel, int filter_width, const float *sobel_x_kernel, const float *sobel_y_kernel);
+    void prepare(int frameRows, int frameCols);
+    void prepareFixed();
+    PipelineContext &levelContext(int level);
+};
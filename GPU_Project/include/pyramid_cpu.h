@@ -0,0 +1,18 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+
+void pyrDownCPU(const cv::Mat &src, cv::Mat &dst);
+
+/**
+ * @brief Gaussian pyramid of a CV_32F image. Level 0 is the image itself (not copied), level l is half the size of
+ * level l - 1, rounded up. Levels are only reallocated when the base size changes.
+ */
+struct ImagePyramid
+{
+    std::vector<cv::Mat> levels;
+
+    void build(const cv::Mat &base, int numLevels);
+    int size() const { return (int)levels.size(); }
+    const cv::Mat &operator[](int level) const { return levels[level]; }
+};
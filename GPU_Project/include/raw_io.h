@@ -0,0 +1,110 @@
+#pragma once
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <opencv2/core.hpp>
+
+// Lower case extension of a path, empty if it has none
+std::string extensionOf(const std::string &path);
+
+/**
+ * @brief Next header field of a PGM/PPM image, skipping whitespace and # comments
+ *
+ * @param get Source of the header bytes, returns the next one or EOF
+ * @param value Output value
+ * @return true if a number was read, with the single whitespace that ends it
+ */
+template <typename Get>
+bool readPnmField(Get get, int &value)
+{
+    int c = get();
+    while (c != EOF && (isspace(c) || c == '#'))
+    {
+        if (c == '#')
+        {
+            while (c != EOF && c != '\n')
+                c = get();
+        }
+        c = get();
+    }
+    if (c == EOF || !isdigit(c))
+        return false;
+    value = 0;
+    while (c != EOF && isdigit(c))
+    {
+        value = value * 10 + (c - '0');
+        c = get();
+    }
+    // the single whitespace after the last field is part of the header
+    return c != EOF && isspace(c);
+}
+
+// Container of a raw stream
+enum RawFormat
+{
+    // Binary PGM (P5) or PPM (P6), 8-bit, one or more images back to back
+    RAW_PNM,
+    // YUV4MPEG2, 8-bit 4:2:0, 4:2:2, 4:4:4 or mono
+    RAW_Y4M,
+};
+
+/**
+ * @brief Reads binary PGM/PPM images and Y4M video without decoding. Regular files are memory-mapped and the frames
+ * are Mat headers on the mapping, so reading a frame copies nothing; the mapping is private, so the detectors may still
+ * write into a frame. Pipes and stdin ("-") are read straight into the caller's frame buffer, which is the only copy.
+ * Streams of back to back PGM/PPM images (e.g. ffmpeg -f image2pipe -c:v ppm) are read as videos.
+ */
+class RawFrameReader
+{
+public:
+    ~RawFrameReader() { close(); }
+    bool open(const std::string &path);
+    bool read(cv::Mat &raw);
+    cv::Mat image(const cv::Mat &raw, bool rgb, cv::Mat &buffer) const;
+    void close();
+    RawFormat format() const { return container; }
+    // Frame rate of a Y4M stream, 0 if unknown
+    double fps() const { return frameRate; }
+    // false if the input is read through a pipe
+    bool mapped() const { return map != nullptr; }
+
+private:
+    int get();
+    bool readPnmHeader(int &channels);
+    bool readY4mHeader();
+
+    RawFormat container = RAW_PNM;
+    std::string source;
+    // mapped file, and read position in it
+    uchar *map = nullptr;
+    size_t mapSize = 0;
+    size_t pos = 0;
+    // stdin or a pipe
+    FILE *pipe = nullptr;
+    // Y4M: frame size, rows of chroma stacked under the luma plane and frame rate
+    int width = 0, height = 0;
+    int chromaRows = 0;
+    bool chroma420 = false;
+    double frameRate = 0;
+};
+
+/**
+ * @brief Writes frames as a Y4M stream to a file or to stdout ("-"), e.g. for ffmpeg -i - to encode. Grayscale frames
+ * give a mono stream, BGR frames a 4:2:0 stream. When writing to stdout, whatever the program prints goes to stderr.
+ */
+class Y4MWriter
+{
+public:
+    ~Y4MWriter() { close(); }
+    bool open(const std::string &path, int rows, int cols, double fps, bool mono);
+    bool write(const cv::Mat &frame);
+    void close();
+    bool isOpened() const { return file != nullptr; }
+
+private:
+    FILE *file = nullptr;
+    int width = 0, height = 0;
+    bool monochrome = false;
+    // 4:2:0 conversion buffer
+    cv::Mat yuv;
+};
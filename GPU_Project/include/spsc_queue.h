@@ -0,0 +1,77 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Bounded queue between exactly one producer thread and one consumer thread.
+ * push blocks while the queue is full and pop while it is empty, so a slow stage throttles the one feeding it.
+ * After close, push fails and pop drains what is left, then fails: this is how the stages shut each other down.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(int capacity) : items(capacity) {}
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /**
+     * @brief Appends an item, waiting for room
+     *
+     * @param item Item
+     * @return false if the queue was closed
+     */
+    bool push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]
+                     { return closed || count < (int)items.size(); });
+        if (closed)
+            return false;
+        items[(head + count) % items.size()] = item;
+        count++;
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Takes the oldest item, waiting for one
+     *
+     * @param item Output item
+     * @return false if the queue is closed and empty
+     */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]
+                      { return closed || count > 0; });
+        if (count == 0)
+            return false;
+        item = items[head];
+        head = (head + 1) % items.size();
+        count--;
+        notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Wakes up both sides. Pending items can still be popped
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    std::vector<T> items;
+    size_t head = 0;
+    int count = 0;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
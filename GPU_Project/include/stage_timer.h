@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Pipeline stages measured by ScopedStageTimer
+enum Stage
+{
+    STAGE_DECODE,
+    STAGE_GRAY,
+    STAGE_BLUR,
+    STAGE_SOBEL,
+    // magnitude and direction (Canny) of the gradient
+    STAGE_GRADIENT,
+    // non maximum suppression, fused with the double threshold in the CPU Canny
+    STAGE_NMS,
+    // binarization, Harris corner threshold
+    STAGE_THRESHOLD,
+    STAGE_HYSTERESIS,
+    STAGE_OTSU,
+    // Harris response map
+    STAGE_RESPONSE,
+    // fused streaming Canny pass
+    STAGE_STREAM,
+    // downsampling of the multi-scale detectors
+    STAGE_PYRAMID,
+    // change detection of the incremental Canny
+    STAGE_TILES,
+    // BRIEF descriptors and matching of the motion mode
+    STAGE_DESCRIBE,
+    STAGE_MATCH,
+    // whole detector on a backend that keeps its images on the device
+    STAGE_DETECTOR,
+    // overlays drawn on the output frame, and its conversion, writing and display
+    STAGE_OUTPUT,
+    // one frame through the detector, and through the output when both run on the same thread. Decoding has its own
+    // stage and GUI waits are excluded
+    STAGE_FRAME,
+    STAGE_COUNT
+};
+
+extern std::atomic<bool> stageTimingOn;
+
+const char *stageName(Stage stage);
+void setStageTiming(bool enabled);
+void recordStageSample(Stage stage, int64_t startNs, int64_t durationNs);
+void printStageSummary();
+void stageTotals(int64_t totalNs[STAGE_COUNT]);
+void clearStageSamples();
+bool writeChromeTrace(const std::string &filename);
+
+inline int64_t stageClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Times the enclosing scope as one sample of a stage. Costs a single relaxed load when timing is off.
+ */
+class ScopedStageTimer
+{
+public:
+    explicit ScopedStageTimer(Stage stage) : stage(stage), active(stageTimingOn.load(std::memory_order_relaxed))
+    {
+        if (active)
+            start = stageClockNs();
+    }
+    ~ScopedStageTimer()
+    {
+        if (active)
+            recordStageSample(stage, start, stageClockNs() - start);
+    }
+    ScopedStageTimer(const ScopedStageTimer &) = delete;
+    ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+private:
+    Stage stage;
+    bool active;
+    int64_t start = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <opencv2/core.hpp>
+#include "convolution_cpu.h"
+
+// Window over which the gradient products are summed
+enum TensorWindow
+{
+    // Single pixel (no aggregation)
+    TENSOR_WINDOW_NONE,
+    // Uniform square window, running sums
+    TENSOR_WINDOW_BOX,
+    // Separable Gaussian window
+    TENSOR_WINDOW_GAUSSIAN,
+};
+
+// Corner response computed from the windowed structure tensor [a b; b c]
+enum CornerResponse
+{
+    // det / trace
+    RESPONSE_DET_TRACE,
+    // Harris: det - k * trace^2
+    RESPONSE_HARRIS_K,
+    // Shi-Tomasi: smallest eigenvalue
+    RESPONSE_SHI_TOMASI,
+};
+
+/**
+ * @brief How the corner detectors build their structure tensor
+ */
+struct StructureTensorSettings
+{
+    TensorWindow window = TENSOR_WINDOW_NONE;
+    // Window side, odd
+    int windowSize = 1;
+    CornerResponse response = RESPONSE_DET_TRACE;
+    // Harris k, for RESPONSE_HARRIS_K
+    float k = 0.05f;
+    // Horizontal and vertical taps of the Gaussian window
+    std::vector<float> gaussianRow, gaussianCol;
+
+    void setWindow(TensorWindow type, int size, const ConvolutionKernel *pipelineGaussian = nullptr);
+};
+
+float structureTensorResponseCPU(const cv::Mat &gradX, const cv::Mat &gradY, cv::Mat &response, const StructureTensorSettings &settings);
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed-size pool of worker threads. The calling thread takes part in every parallelFor, so a pool
+ * of size N spawns N-1 workers.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return (int)workers.size() + 1; }
+    void parallelFor(int numTasks, const std::function<void(int)> &task);
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::mutex submitMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)> *job = nullptr;
+    int jobTasks = 0;
+    std::atomic<int> nextTask{0};
+    int activeWorkers = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+};
+
+void setNumThreadsCPU(int numThreads);
+int getNumThreadsCPU();
+void parallelForRows(int rows, const std::function<void(int, int)> &band, int minBandRows = 16);
+
+/**
+ * @brief parallelForRows for any callable. The callable is wrapped by reference, so lambdas with many captures
+ * are not copied into a heap-allocated std::function on every call.
+ */
+template <typename Band>
+void parallelForRows(int rows, const Band &band, int minBandRows = 16)
+{
+    parallelForRows(rows, std::function<void(int, int)>(std::cref(band)), minBandRows);
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Bytes per pixel of a tile in flight: the float and 8-bit maps of a PipelineContext, the convolution scratch rows, the
+// RGB input and the 8-bit output of the tile, and the component labels of the tiled Canny
+const int TILE_BYTES_PER_PIXEL = 74;
+
+/**
+ * @brief Square tiles covering an image, each read with a halo of extra pixels on every side so that the detectors
+ * compute the same values on the tile interior as on the whole image. Halos are clipped at the image border, where the
+ * detectors see the real border.
+ */
+struct TileGrid
+{
+    int rows = 0, cols = 0;
+    // Interior side and halo width, in pixels
+    int tileSize = 0, halo = 0;
+    int tilesX = 0, tilesY = 0;
+
+    bool plan(int imageRows, int imageCols, int tileHalo, size_t budgetBytes, int align);
+    int count() const { return tilesX * tilesY; }
+    cv::Rect interior(int tile) const;
+    cv::Rect padded(int tile) const;
+};
+
+/**
+ * @brief Edge tracking by hysteresis over the whole image of a TileGrid, one tile at a time, so that tiled Canny keeps
+ * exactly the edges of a whole-image run however far a chain runs from its strong pixel. The candidate (weak or strong)
+ * components of each tile are labelled on their own, and only the labels of the tile border pixels are carried over,
+ * into a union-find over the whole image. Memory follows the length of the tile borders, not the image area.
+ *
+ * Call begin, then addTile with the double threshold map of every tile, then resolve, then finishTile on every tile
+ * again (with the same map) to get its edges.
+ */
+class TiledHysteresis
+{
+public:
+    void begin(const TileGrid &tileGrid);
+    void addTile(int tile, const cv::Mat &tts);
+    void resolve();
+    void finishTile(int tile, const cv::Mat &tts, cv::Mat &edges);
+
+private:
+    template <typename Visit>
+    void visitBorder(int tile, const Visit &visit);
+    int find(int node);
+    void unite(int a, int b);
+
+    TileGrid grid;
+    // component of every pixel on the first and last row of each tile row, full image width, and on the first and last
+    // column of each tile column, full image height: a node of the union-find, -1 for the pixels that are not candidates
+    std::vector<int> rowNodes, colNodes;
+    // union-find over the components reaching a tile border, and whether each contains a strong pixel (valid at roots)
+    std::vector<int> parent;
+    std::vector<uint8_t> strong;
+    // per tile scratch: continuous copy of the map, local labels, strong flags and the node of each local root
+    cv::Mat map;
+    std::vector<int> labels, nodeOf;
+    std::vector<uint8_t> labelStrong;
+};
+
+/**
+ * @brief Reads rectangles of an image without decoding all of it. Binary PPM (P6) and PGM (P5) files are read in place,
+ * one row segment at a time, so only the requested pixels are ever in memory. Other formats are decoded whole by
+ * OpenCV on open, and only the copies are tiled.
+ */
+class TiledImageReader
+{
+public:
+    ~TiledImageReader() { close(); }
+    bool open(const std::string &path);
+    bool read(const cv::Rect &rect, cv::Mat &rgb);
+    void close();
+    int rows() const { return height; }
+    int cols() const { return width; }
+    // false if the whole image had to be decoded
+    bool streamed() const { return file != nullptr; }
+
+private:
+    FILE *file = nullptr;
+    // 1 for PGM, 3 for PPM
+    int channels = 0;
+    long long dataOffset = 0;
+    int width = 0, height = 0;
+    // whole RGB image of the formats that are not read in place
+    cv::Mat decoded;
+    // one row segment of a PGM
+    std::vector<uchar> rowBuffer;
+};
+
+/**
+ * @brief Writes an image one rectangle at a time. Binary PGM/PPM targets are written in place as the rectangles come,
+ * so nothing beyond the rectangle is kept in memory. Other formats are assembled in memory and encoded by close.
+ */
+class TiledImageWriter
+{
+public:
+    ~TiledImageWriter() { close(); }
+    bool open(const std::string &path, int rows, int cols, int channels);
+    bool write(const cv::Mat &tile, cv::Point at);
+    bool close();
+    // false if the whole image is kept in memory until close
+    bool streamed() const { return file != nullptr; }
+
+private:
+    std::string target;
+    FILE *file = nullptr;
+    int channels = 0;
+    long long dataOffset = 0;
+    int width = 0, height = 0;
+    cv::Mat assembled;
+    bool failed = false;
+};
@@ -0,0 +1,14 @@
+#pragma once
+#include <functional>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+// Reads the next frame into frame, which is reused from frame to frame. Returns false at the end of the video
+typedef std::function<bool(cv::Mat &frame)> FrameSource;
+// Runs a detector on a decoded frame and leaves the image to present in result. Both Mats are reused from frame to frame
+typedef std::function<void(cv::Mat &frame, cv::Mat &result)> FrameProcessor;
+// Shows and/or writes a processed frame. Returns false to stop the video
+typedef std::function<bool(cv::Mat &result)> FramePresenter;
+
+int runVideoPipeline(const FrameSource &decode, const FrameProcessor &process, const FramePresenter &present, int depth = 2);
+int runVideoPipeline(cv::VideoCapture &cap, const FrameProcessor &process, const FramePresenter &present, int depth = 2);
@@ -0,0 +1,37 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Runs a fixed set of independent tasks on a set of threads, each with its own deque of task indices.
+ * A worker takes tasks from the front of its own deque and, once it is empty, steals from the back of the others,
+ * so uneven task costs (large and small images) do not leave threads idle and workers rarely touch the same lock.
+ */
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(int numThreads);
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    int size() const { return (int)queues.size(); }
+    void run(int numTasks, const std::function<void(int worker, int task)> &task);
+    // Tasks that were run by another worker than the one they were dealt to, during the last run
+    int stolen() const { return stolenTasks; }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    bool popLocal(int worker, int &task);
+    bool steal(int thief, int &task);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    int stolenTasks = 0;
+};
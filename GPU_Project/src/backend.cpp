@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/backend.h"
+#include "../include/convolution_cpu.h"
+#include "../include/edge_detection_cpu.h"
+using namespace std;
+
+/**
+ * @brief The original trivial implementation: one thread, plain loops and a direct 2D convolution. Kept as the
+ * reference the other backends are compared against
+ */
+class ScalarBackend : public Backend
+{
+public:
+    const char *name() const override { return "scalar"; }
+
+    bool gray(const cv::Mat &img, cv::Mat &gray) override
+    {
+        gray.create(img.rows, img.cols, CV_32F);
+        for (int i = 0; i < img.rows; i++)
+        {
+            float *out = gray.ptr<float>(i);
+            if (img.channels() == 3)
+            {
+                const cv::Vec3b *in = img.ptr<cv::Vec3b>(i);
+                for (int j = 0; j < img.cols; j++)
+                    out[j] = 0.299 * float(in[j][0]) + 0.587 * float(in[j][1]) + 0.114 * float(in[j][2]);
+            }
+            else
+            {
+                const uchar *in = img.ptr<uchar>(i);
+                for (int j = 0; j < img.cols; j++)
+                    out[j] = float(in[j]);
+            }
+        }
+        return true;
+    }
+
+    bool convolve(const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel) override
+    {
+        dst.create(src.rows, src.cols, CV_32F);
+        convolution2DCPU(src, dst, kernel.kernel.data(), kernel.size, CONV_BORDER_NONE);
+        return true;
+    }
+};
+
+/**
+ * @brief Vectorized row/column convolution engine and row bands on the CPU thread pool
+ */
+class CpuBackend : public Backend
+{
+public:
+    const char *name() const override { return "cpu"; }
+
+    bool gray(const cv::Mat &img, cv::Mat &gray) override
+    {
+        rgbToGrayCPU(img, gray);
+        return true;
+    }
+
+    bool convolve(const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel) override
+    {
+        applyConvolutionCPU(src, dst, kernel);
+        return true;
+    }
+};
+
+static ScalarBackend scalarBackend;
+static CpuBackend cpuBackend;
+
+/**
+ * @brief Backend by name
+ *
+ * @param name scalar, cpu or cuda
+ * @return Backend* nullptr if unknown, or cuda if the program was built without CUDA or no device is present
+ */
+Backend *getBackend(const std::string &name)
+{
+    if (name == "scalar")
+        return &scalarBackend;
+    if (name == "cpu")
+        return &cpuBackend;
+#ifdef WITH_CUDA
+    if (name == "cuda")
+        return cudaBackend();
+#endif
+    return nullptr;
+}
+
+/**
+ * @brief Backends that can run on this host, the CPU ones first
+ */
+std::vector<Backend *> availableBackends()
+{
+    std::vector<Backend *> backends = {&scalarBackend, &cpuBackend};
+#ifdef WITH_CUDA
+    if (Backend *cuda = cudaBackend())
+        backends.push_back(cuda);
+#endif
+    return backends;
+}
+
+BackendSelection::BackendSelection()
+{
+    set(&cpuBackend);
+}
+
+/**
+ * @brief Runs every stage on the same backend, and every detector it can run whole on it
+ */
+void BackendSelection::set(Backend *backend)
+{
+    for (Backend *&stage : stages)
+        stage = backend;
+    for (int d = 0; d < BACKEND_DETECTOR_COUNT; d++)
+        detectors[d] = backend->runsDetector((BackendDetector)d) ? backend : nullptr;
+}
+
+/**
+ * @brief Moves every stage running on a backend that failed to the CPU backend, and its detectors to the host pipeline
+ */
+void BackendSelection::fail(Backend *failed)
+{
+    std::cerr << "Error: The " << failed->name() << " backend failed, its stages run on the cpu backend from now on" << std::endl;
+    for (int s = 0; s < BACKEND_STAGE_COUNT; s++)
+    {
+        if (stages[s] == failed)
+            stages[s] = &cpuBackend;
+    }
+    for (int d = 0; d < BACKEND_DETECTOR_COUNT; d++)
+    {
+        if (detectors[d] == failed)
+            detectors[d] = nullptr;
+    }
+}
+
+/**
+ * @brief Grayscale conversion on the backend of BACKEND_STAGE_GRAY, or on the CPU backend if it fails
+ */
+void BackendSelection::gray(const cv::Mat &img, cv::Mat &gray)
+{
+    Backend *backend = stages[BACKEND_STAGE_GRAY];
+    if (backend->gray(img, gray))
+        return;
+    fail(backend);
+    cpuBackend.gray(img, gray);
+}
+
+/**
+ * @brief Convolution on the backend of a stage, or on the CPU backend if it fails
+ */
+void BackendSelection::convolve(BackendStage stage, const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel)
+{
+    Backend *backend = stages[stage];
+    if (backend->convolve(src, dst, kernel))
+        return;
+    fail(backend);
+    cpuBackend.convolve(src, dst, kernel);
+}
+
+/**
+ * @brief Best of three runs of a stage, in milliseconds. The first run also pays for the allocations and uploads
+ *
+ * @return double -1 if a run failed
+ */
+template <typename Run>
+static double bestOfThree(const Run &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < 3; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!run())
+            return -1;
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+/**
+ * @brief Times the gray, blur and Sobel stages of every available backend on a frame and keeps the fastest backend
+ * of each stage. The frame size decides, so calibrate on a frame of the size that will be processed. Backends that
+ * fail on the frame are left out
+ *
+ * @param img First frame, RGB or grayscale as the detectors take it
+ * @param gaussian Blur kernel
+ * @param sobel Sobel kernel, the x and y kernels cost the same
+ * @param verbose Prints the timings and the choice
+ */
+void BackendSelection::calibrate(const cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobel, bool verbose)
+{
+    cv::Mat gray, out;
+    double best[BACKEND_STAGE_COUNT] = {1e30, 1e30, 1e30};
+    for (Backend *backend : availableBackends())
+    {
+        double ms[BACKEND_STAGE_COUNT];
+        ms[BACKEND_STAGE_GRAY] = bestOfThree([&]()
+                                             { return backend->gray(img, gray); });
+        ms[BACKEND_STAGE_BLUR] = bestOfThree([&]()
+                                             { return backend->convolve(gray, out, gaussian); });
+        ms[BACKEND_STAGE_SOBEL] = bestOfThree([&]()
+                                              { return backend->convolve(gray, out, sobel); });
+        if (std::min({ms[BACKEND_STAGE_GRAY], ms[BACKEND_STAGE_BLUR], ms[BACKEND_STAGE_SOBEL]}) < 0)
+        {
+            // a backend that fails on the first frame is never selected
+            if (verbose)
+                cout << "Backend " << backend->name() << ": failed, skipped" << endl;
+            continue;
+        }
+        if (verbose)
+            cout << "Backend " << backend->name() << ": gray " << ms[BACKEND_STAGE_GRAY] << "ms, blur " << ms[BACKEND_STAGE_BLUR]
+                 << "ms, sobel " << ms[BACKEND_STAGE_SOBEL] << "ms" << endl;
+        for (int s = 0; s < BACKEND_STAGE_COUNT; s++)
+        {
+            if (ms[s] < best[s])
+            {
+                best[s] = ms[s];
+                stages[s] = backend;
+            }
+        }
+    }
+    calibrated = true;
+    if (verbose)
+        cout << "Selected backends: gray " << name(BACKEND_STAGE_GRAY) << ", blur " << name(BACKEND_STAGE_BLUR)
+             << ", sobel " << name(BACKEND_STAGE_SOBEL) << endl;
+}
+
+/**
+ * @brief Times a detector whole on every available backend that runs it, and stage by stage on the host pipeline
+ * with the stages selected by calibrate, and keeps the fastest. Backends that fail on the frame are left out. Does
+ * nothing when no backend runs the detector
+ *
+ * @param detector Detector
+ * @param run Runs the detector once on the first frame, through the selection of this context
+ * @param verbose Prints the timings and the choice
+ */
+void BackendSelection::calibrateDetector(BackendDetector detector, const std::function<void()> &run, bool verbose)
+{
+    static const char *detectorNames[BACKEND_DETECTOR_COUNT] = {"canny", "corners", "otsu"};
+    std::vector<Backend *> candidates = {nullptr};
+    for (Backend *backend : availableBackends())
+    {
+        if (backend->runsDetector(detector))
+            candidates.push_back(backend);
+    }
+    if (candidates.size() == 1)
+        return;
+    double best = 1e30;
+    Backend *selected = nullptr;
+    for (Backend *candidate : candidates)
+    {
+        detectors[detector] = candidate;
+        // a backend that fails drops itself from detectors
+        const double ms = bestOfThree([&]()
+                                      { run(); return detectors[detector] == candidate; });
+        const char *name = candidate ? candidate->name() : "host pipeline";
+        if (ms < 0)
+        {
+            if (verbose)
+                cout << "Detector " << detectorNames[detector] << " on " << name << ": failed, skipped" << endl;
+            continue;
+        }
+        if (verbose)
+            cout << "Detector " << detectorNames[detector] << " on " << name << ": " << ms << "ms" << endl;
+        if (ms < best)
+        {
+            best = ms;
+            selected = candidate;
+        }
+    }
+    detectors[detector] = selected;
+    if (verbose)
+        cout << "Selected " << detectorNames[detector] << ": " << (selected ? selected->name() : "host pipeline") << endl;
+}
@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <cuda_runtime.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "../include/cuda_kernel.cuh"
+#include "../include/backend.h"
+using namespace std;
+
+/**
+ * @brief The GPU kernels of the CUDA build behind the Backend interface. Single stages upload and download their
+ * images, so they pay off on large frames only; --backend=auto measures where. The whole detectors upload the frame
+ * once, keep the grayscale, blurred and gradient images and the maps of the detector on the device and only download
+ * the output. Device buffers are kept and only reallocated when they grow, and calls are serialized so batch workers
+ * can share the device. Every CUDA call is checked and a stage or detector that fails returns false, so
+ * BackendSelection reruns it on the CPU
+ */
+class CudaBackend : public Backend
+{
+public:
+    ~CudaBackend()
+    {
+        cudaFree(rgba_d);
+        cudaFree(src_d);
+        cudaFree(dst_d);
+        cudaFree(kernel_d);
+        cudaFree(gray_d);
+        cudaFree(blurred_d);
+        cudaFree(gradX_d);
+        cudaFree(gradY_d);
+        cudaFree(out_d);
+        cudaFree(gaussian_d);
+        cudaFree(sobelX_d);
+        cudaFree(sobelY_d);
+    }
+
+    const char *name() const override { return "cuda"; }
+
+    bool gray(const cv::Mat &img, cv::Mat &gray) override
+    {
+        if (img.channels() == 1)
+        {
+            // nothing to do on the device for a widening
+            img.convertTo(gray, CV_32F);
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        cv::cvtColor(img, rgba, cv::COLOR_RGB2RGBA);
+        const size_t pixels = (size_t)img.rows * img.cols;
+        if (!reserve((void **)&rgba_d, rgbaBytes, pixels * sizeof(uchar4)) || !reserve((void **)&dst_d, dstBytes, pixels * sizeof(float)))
+            return false;
+        if (!succeeded(cudaMemcpy(rgba_d, rgba.data, pixels * sizeof(uchar4), cudaMemcpyHostToDevice), "upload") ||
+            !rgbToGrayKernelWrap(rgba_d, dst_d, img.cols, img.rows))
+            return false;
+        gray.create(img.rows, img.cols, CV_32F);
+        return succeeded(cudaMemcpy2D(gray.data, gray.step, dst_d, img.cols * sizeof(float), img.cols * sizeof(float), img.rows, cudaMemcpyDeviceToHost), "download");
+    }
+
+    bool convolve(const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const size_t rowBytes = src.cols * sizeof(float);
+        const size_t kernelSize = kernel.kernel.size() * sizeof(float);
+        if (!reserve((void **)&src_d, srcBytes, rowBytes * src.rows) || !reserve((void **)&dst_d, dstBytes, rowBytes * src.rows) ||
+            !reserve((void **)&kernel_d, kernelBytes, kernelSize))
+            return false;
+        if (!succeeded(cudaMemcpy2D(src_d, rowBytes, src.data, src.step, rowBytes, src.rows, cudaMemcpyHostToDevice), "upload") ||
+            !succeeded(cudaMemcpy(kernel_d, kernel.kernel.data(), kernelSize, cudaMemcpyHostToDevice), "kernel upload") ||
+            !convolutionGPUWrap(dst_d, src_d, src.cols, src.rows, kernel_d, kernel.size))
+            return false;
+        dst.create(src.rows, src.cols, CV_32F);
+        if (!succeeded(cudaMemcpy2D(dst.data, dst.step, dst_d, rowBytes, rowBytes, src.rows, cudaMemcpyDeviceToHost), "download"))
+            return false;
+
+        // convolutionGPU reads 0 outside the image, the CPU backends leave the frame at 0
+        const int pad = std::min(kernel.size / 2, std::min(src.rows, src.cols) / 2 + 1);
+        dst.rowRange(0, pad).setTo(0);
+        dst.rowRange(src.rows - pad, src.rows).setTo(0);
+        dst.colRange(0, pad).setTo(0);
+        dst.colRange(src.cols - pad, src.cols).setTo(0);
+        return true;
+    }
+
+    bool runsDetector(BackendDetector detector) const override { return true; }
+
+    bool canny(const cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobelX, const ConvolutionKernel &sobelY,
+               float lowThreshold, float highThreshold, cv::Mat &edges) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!gradients(img, gaussian, sobelX, sobelY) || !reserve((void **)&out_d, outBytes, (size_t)img.rows * img.cols * sizeof(float)))
+            return false;
+        if (highThreshold < 0)
+        {
+            // Otsu on the blurred image, as the host pipeline does
+            const int threshold = otsuThreshold(blurred_d, img.cols, img.rows);
+            if (threshold < 0)
+                return false;
+            highThreshold = threshold;
+        }
+        if (lowThreshold < 0)
+            lowThreshold = highThreshold / 2;
+        if (!cannyMainKernelWrap(out_d, gradX_d, gradY_d, img.cols, img.rows, lowThreshold, highThreshold, &cannyDevice))
+            return false;
+        return download(out_d, img.rows, img.cols, edges);
+    }
+
+    bool corners(cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobelX, const ConvolutionKernel &sobelY,
+                 bool shiTomasi) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (img.channels() != 3 || !gradients(img, gaussian, sobelX, sobelY))
+            return false;
+        // paints the corners on the RGBA frame on the device and downloads it into rgba
+        const float threshold = harrisMainKernelWrap((uchar4 *)rgba.data, rgba_d, gradX_d, gradY_d, img.cols, img.rows, K, ALPHA,
+                                                     gaussian_d, gaussian.size, shiTomasi, nullptr, &harrisDevice);
+        if (std::isnan(threshold))
+            return false;
+        cv::cvtColor(rgba, img, cv::COLOR_RGBA2RGB);
+        return true;
+    }
+
+    bool otsu(const cv::Mat &img, int threshold, cv::Mat &binary) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!uploadGray(img))
+            return false;
+        if (threshold < 0)
+        {
+            threshold = otsuThreshold(gray_d, img.cols, img.rows);
+            if (threshold < 0)
+                return false;
+        }
+        if (!binarizeImgWrapper(gray_d, gray_d, img.cols, img.rows, threshold))
+            return false;
+        return download(gray_d, img.rows, img.cols, binary);
+    }
+
+private:
+    /**
+     * @brief Uploads a frame and converts it to grayscale into gray_d. RGB frames are also left in rgba_d
+     *
+     * @param img RGB (CV_8UC3) or 8-bit grayscale (CV_8UC1) image
+     * @return true if gray_d holds the frame
+     */
+    bool uploadGray(const cv::Mat &img)
+    {
+        const size_t pixels = (size_t)img.rows * img.cols;
+        if (!reserve((void **)&gray_d, grayBytes, pixels * sizeof(float)))
+            return false;
+        if (img.channels() == 1)
+        {
+            img.convertTo(grayHost, CV_32F);
+            return succeeded(cudaMemcpy2D(gray_d, img.cols * sizeof(float), grayHost.data, grayHost.step, img.cols * sizeof(float), img.rows, cudaMemcpyHostToDevice), "upload");
+        }
+        cv::cvtColor(img, rgba, cv::COLOR_RGB2RGBA);
+        return reserve((void **)&rgba_d, rgbaBytes, pixels * sizeof(uchar4)) &&
+               succeeded(cudaMemcpy(rgba_d, rgba.data, pixels * sizeof(uchar4), cudaMemcpyHostToDevice), "upload") &&
+               rgbToGrayKernelWrap(rgba_d, gray_d, img.cols, img.rows);
+    }
+
+    /**
+     * @brief Uploads a frame and computes its grayscale, blurred and gradient images on the device
+     *
+     * @return true if gray_d, blurred_d, gradX_d and gradY_d hold the frame
+     */
+    bool gradients(const cv::Mat &img, const ConvolutionKernel &gaussian, const ConvolutionKernel &sobelX, const ConvolutionKernel &sobelY)
+    {
+        const size_t bytes = (size_t)img.rows * img.cols * sizeof(float);
+        return uploadGray(img) && uploadKernel(&gaussian_d, gaussianBytes, gaussian) && uploadKernel(&sobelX_d, sobelXBytes, sobelX) &&
+               uploadKernel(&sobelY_d, sobelYBytes, sobelY) && reserve((void **)&blurred_d, blurredBytes, bytes) &&
+               reserve((void **)&gradX_d, gradXBytes, bytes) && reserve((void **)&gradY_d, gradYBytes, bytes) &&
+               convolutionGPUWrap(blurred_d, gray_d, img.cols, img.rows, gaussian_d, gaussian.size) &&
+               convolutionGPUWrap(gradX_d, blurred_d, img.cols, img.rows, sobelX_d, sobelX.size) &&
+               convolutionGPUWrap(gradY_d, blurred_d, img.cols, img.rows, sobelY_d, sobelY.size);
+    }
+
+    /**
+     * @brief Copies a kernel to its device buffer
+     */
+    static bool uploadKernel(float **kernel_d, size_t &capacity, const ConvolutionKernel &kernel)
+    {
+        const size_t bytes = kernel.kernel.size() * sizeof(float);
+        return reserve((void **)kernel_d, capacity, bytes) &&
+               succeeded(cudaMemcpy(*kernel_d, kernel.kernel.data(), bytes, cudaMemcpyHostToDevice), "kernel upload");
+    }
+
+    /**
+     * @brief Downloads a CV_32F device image
+     */
+    static bool download(const float *image_d, int rows, int cols, cv::Mat &out)
+    {
+        out.create(rows, cols, CV_32F);
+        return succeeded(cudaMemcpy2D(out.data, out.step, image_d, cols * sizeof(float), cols * sizeof(float), rows, cudaMemcpyDeviceToHost), "download");
+    }
+
+    /**
+     * @brief Reports a failed CUDA call
+     *
+     * @param err Result of the call
+     * @param what Operation, for the message
+     * @return true if err is cudaSuccess
+     */
+    static bool succeeded(cudaError_t err, const char *what)
+    {
+        if (err == cudaSuccess)
+            return true;
+        std::cerr << "Error: CUDA " << what << " failed: " << cudaGetErrorString(err) << std::endl;
+        return false;
+    }
+
+    /**
+     * @brief Grows a device buffer to at least bytes
+     *
+     * @return true if the buffer holds bytes, false (and the buffer released) if the allocation failed
+     */
+    static bool reserve(void **buffer_d, size_t &capacity, size_t bytes)
+    {
+        if (bytes <= capacity)
+            return true;
+        cudaFree(*buffer_d);
+        *buffer_d = nullptr;
+        capacity = 0;
+        if (!succeeded(cudaMalloc(buffer_d, bytes), "allocation"))
+        {
+            *buffer_d = nullptr;
+            return false;
+        }
+        capacity = bytes;
+        return true;
+    }
+
+    std::mutex mutex;
+    cv::Mat rgba, grayHost;
+    uchar4 *rgba_d = nullptr;
+    float *src_d = nullptr, *dst_d = nullptr, *kernel_d = nullptr;
+    size_t rgbaBytes = 0, srcBytes = 0, dstBytes = 0, kernelBytes = 0;
+    // images and kernels of the whole detectors, and the scratch of their kernels
+    float *gray_d = nullptr, *blurred_d = nullptr, *gradX_d = nullptr, *gradY_d = nullptr, *out_d = nullptr;
+    float *gaussian_d = nullptr, *sobelX_d = nullptr, *sobelY_d = nullptr;
+    size_t grayBytes = 0, blurredBytes = 0, gradXBytes = 0, gradYBytes = 0, outBytes = 0;
+    size_t gaussianBytes = 0, sobelXBytes = 0, sobelYBytes = 0;
+    HarrisDeviceContext harrisDevice;
+    CannyDeviceContext cannyDevice;
+};
+
+/**
+ * @brief The CUDA backend, created on first use
+ *
+ * @return Backend* nullptr if no CUDA device is present
+ */
+Backend *cudaBackend()
+{
+    static CudaBackend *backend = []() -> CudaBackend *
+    {
+        int devices = 0;
+        if (cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0)
+            return nullptr;
+        return new CudaBackend();
+    }();
+    return backend;
+}
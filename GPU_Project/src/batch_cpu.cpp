@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include "../include/batch_cpu.h"
+#include "../include/raw_io.h"
+using namespace std;
+
+static bool isDirectory(const std::string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static bool isImageFile(const std::string &path)
+{
+    const std::string ext = extensionOf(path);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "ppm" || ext == "pgm" || ext == "bmp";
+}
+
+/**
+ * @brief Whether an -f argument names several images: a directory, a glob pattern or a list file (.txt or .lst)
+ */
+bool isBatchInput(const std::string &spec)
+{
+    const std::string ext = extensionOf(spec);
+    return isDirectory(spec) || spec.find_first_of("*?[") != std::string::npos || ext == "txt" || ext == "lst";
+}
+
+/**
+ * @brief Expands a batch input into image paths
+ *
+ * @param spec A directory (its images, not recursive), a glob pattern quoted in the shell (e.g. "input/image?.jpg") or a
+ * list file with one path per line (empty lines and lines starting with # are skipped)
+ * @return std::vector<std::string> Paths, sorted for directories and globs, in file order for lists. Empty on error
+ */
+std::vector<std::string> listBatchInputs(const std::string &spec)
+{
+    std::vector<std::string> paths;
+    if (isDirectory(spec))
+    {
+        DIR *dir = opendir(spec.c_str());
+        if (!dir)
+        {
+            fprintf(stderr, "Cannot open directory %s\n", spec.c_str());
+            return paths;
+        }
+        const std::string prefix = spec.back() == '/' ? spec : spec + "/";
+        while (struct dirent *entry = readdir(dir))
+        {
+            std::string path = prefix + entry->d_name;
+            if (isImageFile(path) && !isDirectory(path))
+                paths.push_back(path);
+        }
+        closedir(dir);
+        std::sort(paths.begin(), paths.end());
+    }
+    else if (spec.find_first_of("*?[") != std::string::npos)
+    {
+        glob_t matches;
+        if (glob(spec.c_str(), 0, nullptr, &matches) == 0)
+        {
+            for (size_t i = 0; i < matches.gl_pathc; i++)
+                paths.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    }
+    else
+    {
+        std::ifstream list(spec);
+        if (!list)
+        {
+            fprintf(stderr, "Cannot open list file %s\n", spec.c_str());
+            return paths;
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            // tolerates Windows line endings and trailing blanks
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+                line.pop_back();
+            if (!line.empty() && line[0] != '#')
+                paths.push_back(line);
+        }
+    }
+    return paths;
+}
+
+/**
+ * @brief File name of a path without directory and extension
+ */
+static std::string stemOf(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+/**
+ * @brief Names of the images written for a batch, one per input and all different, so that no result overwrites
+ * another in the output directory. An image is named after its stem; inputs sharing a stem (x.jpg and x.png) get
+ * their extension appended (x_jpg, x_png), and those still sharing a name (a/x.jpg and b/x.jpg) are named after their
+ * whole path with / replaced by _ (a_x_jpg, b_x_jpg). A path listed twice gets a number (_2, _3, ...)
+ *
+ * @param files Batch inputs, as returned by listBatchInputs
+ * @param renamed Output, number of images not named after their stem
+ * @return std::vector<std::string> Output names with a .png extension, to be given as input name to FrameWriter::open
+ */
+std::vector<std::string> batchOutputNames(const std::vector<std::string> &files, int &renamed)
+{
+    const int count = (int)files.size();
+    std::vector<std::string> names(count);
+    for (int i = 0; i < count; i++)
+        names[i] = stemOf(files[i]);
+
+    // each pass renames the inputs whose name is still shared, with more of their path
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::map<std::string, int> uses;
+        for (const std::string &name : names)
+            uses[name]++;
+        for (int i = 0; i < count; i++)
+        {
+            if (uses[names[i]] < 2)
+                continue;
+            const std::string ext = extensionOf(files[i]);
+            std::string name = pass == 0 ? stemOf(files[i]) : files[i].substr(0, files[i].size() - (ext.empty() ? 0 : ext.size() + 1));
+            if (pass == 1)
+            {
+                while (name.compare(0, 2, "./") == 0 || name.compare(0, 1, "/") == 0)
+                    name = name.substr(name[0] == '/' ? 1 : 2);
+                std::replace(name.begin(), name.end(), '/', '_');
+            }
+            names[i] = ext.empty() ? name : name + "_" + ext;
+        }
+    }
+
+    renamed = 0;
+    std::set<std::string> used;
+    for (int i = 0; i < count; i++)
+    {
+        std::string name = names[i];
+        for (int n = 2; used.count(name) != 0; n++)
+            name = names[i] + "_" + std::to_string(n);
+        used.insert(name);
+        renamed += name != stemOf(files[i]);
+        names[i] = name + ".png";
+    }
+    return names;
+}
+
+/**
+ * @brief Prints the throughput and latency distribution of a batch run
+ *
+ * @param latenciesMs Decode + process + encode time of every image that succeeded, in ms
+ * @param failed Number of images that could not be read or written
+ * @param seconds Wall time of the whole batch
+ * @param threads Number of workers
+ * @param stolen Number of images run by a worker they were not dealt to
+ */
+void printBatchSummary(const std::vector<double> &latenciesMs, int failed, double seconds, int threads, int stolen)
+{
+    std::vector<double> sorted = latenciesMs;
+    std::sort(sorted.begin(), sorted.end());
+    const int done = (int)sorted.size();
+    printf("Batch: %d image(s) in %.3f s on %d thread(s), %.2f images/s", done, seconds, threads, seconds > 0 ? done / seconds : 0.0);
+    if (failed > 0)
+        printf(", %d failed", failed);
+    printf(", %d stolen\n", stolen);
+    if (done == 0)
+        return;
+    double sum = 0;
+    for (double v : sorted)
+        sum += v;
+    auto percentile = [&](double p)
+    { return sorted[std::min(done - 1, (int)(p * done))]; };
+    printf("Latency per image [ms]: mean %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", sum / done, percentile(0.5), percentile(0.9), percentile(0.99), sorted.back());
+}
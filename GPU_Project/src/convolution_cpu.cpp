@@ -0,0 +1,696 @@
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/cpu_dispatch.h"
+#ifdef CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+#include "../include/convolution_cpu.h"
+#include "../include/thread_pool.h"
+using namespace std;
+using namespace cv;
+
+// #define MEASURE_TIME
+
+/***********************
+ *
+ * Row/column primitives
+ *
+ **********************/
+
+typedef void (*RowKernelFn)(const float *src, float *dst, int n, const float *kernel, int kernelSize);
+typedef void (*ColumnKernelFn)(const float *const *rows, float *dst, int n, const float *kernel, int kernelSize);
+
+/**
+ * @brief Horizontal pass, scalar version. dst[x] = sum_j kernel[j] * src[x + j]
+ *
+ * @param src Input row, already shifted left by the kernel radius
+ * @param dst Output row
+ * @param n Number of output pixels
+ * @param kernel 1D kernel
+ * @param kernelSize Kernel size
+ */
+static void rowKernelScalar(const float *src, float *dst, int n, const float *kernel, int kernelSize)
+{
+    for (int x = 0; x < n; x++)
+    {
+        float sum = 0.0f;
+        for (int j = 0; j < kernelSize; j++)
+        {
+            sum += kernel[j] * src[x + j];
+        }
+        dst[x] = sum;
+    }
+}
+
+/**
+ * @brief Vertical pass over the pixels [from, to). dst[x] = sum_i kernel[i] * rows[i][x]
+ *
+ * @param rows kernelSize input rows, top to bottom
+ * @param dst Output row
+ * @param from First output pixel
+ * @param to One past the last output pixel
+ * @param kernel 1D kernel
+ * @param kernelSize Kernel size
+ */
+static inline void columnKernelRange(const float *const *rows, float *dst, int from, int to, const float *kernel, int kernelSize)
+{
+    for (int x = from; x < to; x++)
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < kernelSize; i++)
+        {
+            sum += kernel[i] * rows[i][x];
+        }
+        dst[x] = sum;
+    }
+}
+
+/**
+ * @brief Vertical pass, scalar version
+ */
+static void columnKernelScalar(const float *const *rows, float *dst, int n, const float *kernel, int kernelSize)
+{
+    columnKernelRange(rows, dst, 0, n, kernel, kernelSize);
+}
+
+#ifdef CPU_DISPATCH_X86
+/**
+ * @brief Horizontal pass, SSE version (4 pixels per iteration)
+ */
+static void rowKernelSSE(const float *src, float *dst, int n, const float *kernel, int kernelSize)
+{
+    int x = 0;
+    for (; x <= n - 4; x += 4)
+    {
+        __m128 acc = _mm_setzero_ps();
+        for (int j = 0; j < kernelSize; j++)
+        {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(kernel[j]), _mm_loadu_ps(src + x + j)));
+        }
+        _mm_storeu_ps(dst + x, acc);
+    }
+    rowKernelScalar(src + x, dst + x, n - x, kernel, kernelSize);
+}
+
+/**
+ * @brief Vertical pass, SSE version (4 pixels per iteration)
+ */
+static void columnKernelSSE(const float *const *rows, float *dst, int n, const float *kernel, int kernelSize)
+{
+    int x = 0;
+    for (; x <= n - 4; x += 4)
+    {
+        __m128 acc = _mm_setzero_ps();
+        for (int i = 0; i < kernelSize; i++)
+        {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(kernel[i]), _mm_loadu_ps(rows[i] + x)));
+        }
+        _mm_storeu_ps(dst + x, acc);
+    }
+    columnKernelRange(rows, dst, x, n, kernel, kernelSize);
+}
+
+/**
+ * @brief Horizontal pass, AVX2+FMA version (16 pixels per iteration, two independent accumulators)
+ */
+ISA_TARGET_AVX2 static void rowKernelAVX2(const float *src, float *dst, int n, const float *kernel, int kernelSize)
+{
+    int x = 0;
+    for (; x <= n - 16; x += 16)
+    {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for (int j = 0; j < kernelSize; j++)
+        {
+            __m256 k = _mm256_set1_ps(kernel[j]);
+            acc0 = _mm256_fmadd_ps(k, _mm256_loadu_ps(src + x + j), acc0);
+            acc1 = _mm256_fmadd_ps(k, _mm256_loadu_ps(src + x + j + 8), acc1);
+        }
+        _mm256_storeu_ps(dst + x, acc0);
+        _mm256_storeu_ps(dst + x + 8, acc1);
+    }
+    for (; x <= n - 8; x += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (int j = 0; j < kernelSize; j++)
+        {
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(kernel[j]), _mm256_loadu_ps(src + x + j), acc);
+        }
+        _mm256_storeu_ps(dst + x, acc);
+    }
+    rowKernelScalar(src + x, dst + x, n - x, kernel, kernelSize);
+}
+
+/**
+ * @brief Vertical pass, AVX2+FMA version (16 pixels per iteration, two independent accumulators)
+ */
+ISA_TARGET_AVX2 static void columnKernelAVX2(const float *const *rows, float *dst, int n, const float *kernel, int kernelSize)
+{
+    int x = 0;
+    for (; x <= n - 16; x += 16)
+    {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for (int i = 0; i < kernelSize; i++)
+        {
+            __m256 k = _mm256_set1_ps(kernel[i]);
+            acc0 = _mm256_fmadd_ps(k, _mm256_loadu_ps(rows[i] + x), acc0);
+            acc1 = _mm256_fmadd_ps(k, _mm256_loadu_ps(rows[i] + x + 8), acc1);
+        }
+        _mm256_storeu_ps(dst + x, acc0);
+        _mm256_storeu_ps(dst + x + 8, acc1);
+    }
+    columnKernelRange(rows, dst, x, n, kernel, kernelSize);
+}
+
+/**
+ * @brief Horizontal pass, AVX-512 version (32 pixels per iteration, two independent accumulators)
+ */
+ISA_TARGET_AVX512 static void rowKernelAVX512(const float *src, float *dst, int n, const float *kernel, int kernelSize)
+{
+    int x = 0;
+    for (; x <= n - 32; x += 32)
+    {
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        for (int j = 0; j < kernelSize; j++)
+        {
+            __m512 k = _mm512_set1_ps(kernel[j]);
+            acc0 = _mm512_fmadd_ps(k, _mm512_loadu_ps(src + x + j), acc0);
+            acc1 = _mm512_fmadd_ps(k, _mm512_loadu_ps(src + x + j + 16), acc1);
+        }
+        _mm512_storeu_ps(dst + x, acc0);
+        _mm512_storeu_ps(dst + x + 16, acc1);
+    }
+    for (; x <= n - 16; x += 16)
+    {
+        __m512 acc = _mm512_setzero_ps();
+        for (int j = 0; j < kernelSize; j++)
+        {
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(kernel[j]), _mm512_loadu_ps(src + x + j), acc);
+        }
+        _mm512_storeu_ps(dst + x, acc);
+    }
+    rowKernelScalar(src + x, dst + x, n - x, kernel, kernelSize);
+}
+
+/**
+ * @brief Vertical pass, AVX-512 version (32 pixels per iteration, two independent accumulators)
+ */
+ISA_TARGET_AVX512 static void columnKernelAVX512(const float *const *rows, float *dst, int n, const float *kernel, int kernelSize)
+{
+    int x = 0;
+    for (; x <= n - 32; x += 32)
+    {
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        for (int i = 0; i < kernelSize; i++)
+        {
+            __m512 k = _mm512_set1_ps(kernel[i]);
+            acc0 = _mm512_fmadd_ps(k, _mm512_loadu_ps(rows[i] + x), acc0);
+            acc1 = _mm512_fmadd_ps(k, _mm512_loadu_ps(rows[i] + x + 16), acc1);
+        }
+        _mm512_storeu_ps(dst + x, acc0);
+        _mm512_storeu_ps(dst + x + 16, acc1);
+    }
+    for (; x <= n - 16; x += 16)
+    {
+        __m512 acc = _mm512_setzero_ps();
+        for (int i = 0; i < kernelSize; i++)
+        {
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(kernel[i]), _mm512_loadu_ps(rows[i] + x), acc);
+        }
+        _mm512_storeu_ps(dst + x, acc);
+    }
+    columnKernelRange(rows, dst, x, n, kernel, kernelSize);
+}
+#endif
+
+// Row and column passes of every ISA tier (see cpu_dispatch.h)
+#ifdef CPU_DISPATCH_X86
+static const IsaDispatch<RowKernelFn> rowKernels = {{rowKernelScalar, rowKernelSSE, rowKernelAVX2, rowKernelAVX512}};
+static const IsaDispatch<ColumnKernelFn> columnKernels = {{columnKernelScalar, columnKernelSSE, columnKernelAVX2, columnKernelAVX512}};
+#else
+static const IsaDispatch<RowKernelFn> rowKernels = {{rowKernelScalar, nullptr, nullptr, nullptr}};
+static const IsaDispatch<ColumnKernelFn> columnKernels = {{columnKernelScalar, nullptr, nullptr, nullptr}};
+#endif
+
+/**
+ * @brief Horizontal pass for a kernel size known at compile time. The taps are fully unrolled and kept in registers,
+ * the pixel loop is left to the compiler to vectorize for each ISA clone
+ */
+template <int Size>
+ISA_KERNEL void rowKernelFixed(const float *src, float *dst, int n, const float *kernel, int)
+{
+    float k[Size];
+    for (int j = 0; j < Size; j++)
+        k[j] = kernel[j];
+    for (int x = 0; x < n; x++)
+    {
+        float sum = 0.0f;
+        for (int j = 0; j < Size; j++)
+            sum += k[j] * src[x + j];
+        dst[x] = sum;
+    }
+}
+
+/**
+ * @brief Vertical pass for a kernel size known at compile time
+ */
+template <int Size>
+ISA_KERNEL void columnKernelFixed(const float *const *rows, float *dst, int n, const float *kernel, int)
+{
+    float k[Size];
+    const float *r[Size];
+    for (int i = 0; i < Size; i++)
+    {
+        k[i] = kernel[i];
+        r[i] = rows[i];
+    }
+    for (int x = 0; x < n; x++)
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < Size; i++)
+            sum += k[i] * r[i][x];
+        dst[x] = sum;
+    }
+}
+
+/**
+ * @brief Tiers of a fixed-size pass: its baseline and SSE4.2 clones, where unrolled taps beat the generic loops, and
+ * the hand-written AVX2 and AVX-512 kernels above, whose two accumulators the compiler does not produce on its own
+ */
+template <typename Fn>
+static IsaDispatch<Fn> fixedTiers(const IsaDispatch<Fn> &fixed, const IsaDispatch<Fn> &generic)
+{
+    return {{fixed.variants[ISA_BASELINE], fixed.variants[ISA_SSE42], generic.variants[ISA_AVX2], generic.variants[ISA_AVX512]}};
+}
+
+// Specializations for the sizes the pipelines use (3x3 Sobel, 3 to 7 wide Gaussians), indexed by size / 2 - 1
+static const IsaDispatch<RowKernelFn> rowKernelsFixed[] = {
+    fixedTiers(IsaClones<RowKernelFn, rowKernelFixed<3>>::table(), rowKernels),
+    fixedTiers(IsaClones<RowKernelFn, rowKernelFixed<5>>::table(), rowKernels),
+    fixedTiers(IsaClones<RowKernelFn, rowKernelFixed<7>>::table(), rowKernels)};
+static const IsaDispatch<ColumnKernelFn> columnKernelsFixed[] = {
+    fixedTiers(IsaClones<ColumnKernelFn, columnKernelFixed<3>>::table(), columnKernels),
+    fixedTiers(IsaClones<ColumnKernelFn, columnKernelFixed<5>>::table(), columnKernels),
+    fixedTiers(IsaClones<ColumnKernelFn, columnKernelFixed<7>>::table(), columnKernels)};
+
+/**
+ * @brief Whether kernelSize has a specialization in rowKernelsFixed and columnKernelsFixed
+ */
+static inline bool hasFixedKernels(int kernelSize)
+{
+    return kernelSize % 2 == 1 && kernelSize >= 3 && kernelSize <= 7;
+}
+
+/**
+ * @brief Maps a coordinate that falls outside [0, len) back into the image according to the border mode.
+ *
+ * @return int Mapped coordinate, -1 if the pixel has to be read as 0
+ */
+static inline int borderIndex(int p, int len, ConvBorder border)
+{
+    if (p >= 0 && p < len)
+        return p;
+    switch (border)
+    {
+    case CONV_BORDER_REPLICATE:
+        return p < 0 ? 0 : len - 1;
+    case CONV_BORDER_REFLECT_101:
+        if (len == 1)
+            return 0;
+        while (p < 0 || p >= len)
+        {
+            p = p < 0 ? -p : 2 * (len - 1) - p;
+        }
+        return p;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Splits a 2D kernel into a row and a column kernel so that kernel[i][j] = kernelCol[i] * kernelRow[j].
+ * Works for the Gaussian kernel of computeGaussianKernel and for the 3x3 Sobel kernels.
+ *
+ * @param kernel 2D kernel, row major
+ * @param kernelSize Kernel size
+ * @param kernelRow Output horizontal kernel (kernelSize elements)
+ * @param kernelCol Output vertical kernel (kernelSize elements)
+ * @return true if the kernel is separable (rank 1)
+ */
+bool factorSeparableKernel(const float *kernel, int kernelSize, float *kernelRow, float *kernelCol)
+{
+    int pivotRow = 0, pivotCol = 0;
+    float maxAbs = 0.0f;
+    for (int i = 0; i < kernelSize; i++)
+    {
+        for (int j = 0; j < kernelSize; j++)
+        {
+            if (fabsf(kernel[i * kernelSize + j]) > maxAbs)
+            {
+                maxAbs = fabsf(kernel[i * kernelSize + j]);
+                pivotRow = i;
+                pivotCol = j;
+            }
+        }
+    }
+    if (maxAbs == 0.0f)
+    {
+        for (int i = 0; i < kernelSize; i++)
+        {
+            kernelRow[i] = 0.0f;
+            kernelCol[i] = 0.0f;
+        }
+        return true;
+    }
+
+    float pivot = kernel[pivotRow * kernelSize + pivotCol];
+    for (int j = 0; j < kernelSize; j++)
+    {
+        kernelRow[j] = kernel[pivotRow * kernelSize + j];
+    }
+    for (int i = 0; i < kernelSize; i++)
+    {
+        kernelCol[i] = kernel[i * kernelSize + pivotCol] / pivot;
+    }
+
+    // rank-1 check
+    for (int i = 0; i < kernelSize; i++)
+    {
+        for (int j = 0; j < kernelSize; j++)
+        {
+            if (fabsf(kernel[i * kernelSize + j] - kernelCol[i] * kernelRow[j]) > 1e-5f * maxAbs)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Convolves (correlates, as applyConvolutionCPU always did) a single row with a 1D kernel.
+ * The interior goes through the SIMD kernel, only the 2 * radius border pixels are handled one by one.
+ *
+ * @param src Input row
+ * @param dst Output row
+ * @param width Row length
+ * @param kernel 1D kernel
+ * @param kernelSize Kernel size, odd
+ * @param border Border mode
+ */
+void convolveRowCPU(const float *src, float *dst, int width, const float *kernel, int kernelSize, ConvBorder border)
+{
+    int pad = kernelSize / 2;
+    int x0 = std::min(pad, width);
+    int x1 = std::max(x0, width - pad);
+    if (x1 > x0)
+    {
+        const IsaDispatch<RowKernelFn> &kernels = hasFixedKernels(kernelSize) ? rowKernelsFixed[kernelSize / 2 - 1] : rowKernels;
+        kernels(src + x0 - pad, dst + x0, x1 - x0, kernel, kernelSize);
+    }
+
+    for (int x = 0; x < width; x++)
+    {
+        if (x == x0)
+        {
+            x = x1;
+            if (x >= width)
+                break;
+        }
+        float sum = 0.0f;
+        if (border != CONV_BORDER_NONE)
+        {
+            for (int j = 0; j < kernelSize; j++)
+            {
+                int idx = borderIndex(x + j - pad, width, border);
+                if (idx >= 0)
+                    sum += kernel[j] * src[idx];
+            }
+        }
+        dst[x] = sum;
+    }
+}
+
+/**
+ * @brief Combines kernelSize rows with a vertical 1D kernel.
+ *
+ * @param rows kernelSize input rows, top to bottom
+ * @param dst Output row
+ * @param width Row length
+ * @param kernel 1D kernel
+ * @param kernelSize Kernel size
+ */
+void convolveColumnsCPU(const float *const *rows, float *dst, int width, const float *kernel, int kernelSize)
+{
+    const IsaDispatch<ColumnKernelFn> &kernels = hasFixedKernels(kernelSize) ? columnKernelsFixed[kernelSize / 2 - 1] : columnKernels;
+    kernels(rows, dst, width, kernel, kernelSize);
+}
+
+/**
+ * @brief Separable convolution restricted to the output rows [rowBegin, rowEnd).
+ * The horizontal pass is computed for the band plus its halo rows into scratch, so independent bands can run concurrently.
+ *
+ * @param src Input image, CV_32F
+ * @param dst Output image, CV_32F, same size as src. Must not alias src when bands run concurrently
+ * @param kernelRow Horizontal kernel
+ * @param kernelCol Vertical kernel
+ * @param kernelSize Kernel size, odd
+ * @param border Border mode
+ * @param rowBegin First output row
+ * @param rowEnd One past the last output row
+ * @param scratch Intermediate buffer, grown if needed and reusable across calls
+ */
+void separableConvolutionBandCPU(const cv::Mat &src, cv::Mat &dst, const float *kernelRow, const float *kernelCol, int kernelSize, ConvBorder border, int rowBegin, int rowEnd, std::vector<float> &scratch)
+{
+    const int width = src.cols;
+    const int height = src.rows;
+    const int pad = kernelSize / 2;
+    const int lo = std::max(0, rowBegin - pad);
+    const int hi = std::min(height, rowEnd + pad);
+
+    // one extra row of zeros for CONV_BORDER_CONSTANT
+    scratch.resize((size_t)(hi - lo + 1) * width);
+    float *zeroRow = scratch.data() + (size_t)(hi - lo) * width;
+    std::fill(zeroRow, zeroRow + width, 0.0f);
+
+    for (int y = lo; y < hi; y++)
+    {
+        convolveRowCPU(src.ptr<float>(y), scratch.data() + (size_t)(y - lo) * width, width, kernelRow, kernelSize, border);
+    }
+
+    static thread_local std::vector<const float *> rows;
+    rows.resize(kernelSize);
+    for (int y = rowBegin; y < rowEnd; y++)
+    {
+        float *out = dst.ptr<float>(y);
+        if (border == CONV_BORDER_NONE && (y < pad || y >= height - pad))
+        {
+            std::fill(out, out + width, 0.0f);
+            continue;
+        }
+        for (int i = 0; i < kernelSize; i++)
+        {
+            int yy = borderIndex(y + i - pad, height, border);
+            rows[i] = yy < 0 ? zeroRow : scratch.data() + (size_t)(yy - lo) * width;
+        }
+        convolveColumnsCPU(rows.data(), out, width, kernelCol, kernelSize);
+    }
+}
+
+/**
+ * @brief Separable convolution restricted to the output pixels of rect, giving the same values as a full-image pass.
+ * The column pass only reads row-pass values of its own columns, so the row pass is computed on the rect columns
+ * plus pad on each side, for the rect rows plus their halo rows.
+ *
+ * @param src Input image, CV_32F
+ * @param dst Output image, CV_32F, same size as src. Must not alias src
+ * @param kernelRow Horizontal kernel
+ * @param kernelCol Vertical kernel
+ * @param kernelSize Kernel size, odd
+ * @param border Border mode
+ * @param rect Output pixels, inside the image
+ * @param scratch Intermediate buffer, grown if needed and reusable across calls
+ */
+void separableConvolutionRectCPU(const cv::Mat &src, cv::Mat &dst, const float *kernelRow, const float *kernelCol, int kernelSize, ConvBorder border, const cv::Rect &rect, std::vector<float> &scratch)
+{
+    const int width = src.cols;
+    const int height = src.rows;
+    const int pad = kernelSize / 2;
+    const int lo = std::max(0, rect.y - pad);
+    const int hi = std::min(height, rect.y + rect.height + pad);
+    // the row pass sees the span [xs, xe) as a whole row. Where its ends are not the image's, the pixels handled as
+    // borders are the pad columns outside rect, which are not used
+    const int xs = std::max(0, rect.x - pad);
+    const int xe = std::min(width, rect.x + rect.width + pad);
+    const int span = xe - xs;
+
+    scratch.resize((size_t)(hi - lo + 1) * span);
+    float *zeroRow = scratch.data() + (size_t)(hi - lo) * span;
+    std::fill(zeroRow, zeroRow + span, 0.0f);
+    for (int y = lo; y < hi; y++)
+    {
+        convolveRowCPU(src.ptr<float>(y) + xs, scratch.data() + (size_t)(y - lo) * span, span, kernelRow, kernelSize, border);
+    }
+
+    static thread_local std::vector<const float *> rows;
+    static thread_local std::vector<float> out;
+    rows.resize(kernelSize);
+    out.resize(span);
+    for (int y = rect.y; y < rect.y + rect.height; y++)
+    {
+        float *dstRow = dst.ptr<float>(y);
+        if (border == CONV_BORDER_NONE && (y < pad || y >= height - pad))
+        {
+            std::fill(dstRow + rect.x, dstRow + rect.x + rect.width, 0.0f);
+            continue;
+        }
+        for (int i = 0; i < kernelSize; i++)
+        {
+            int yy = borderIndex(y + i - pad, height, border);
+            rows[i] = yy < 0 ? zeroRow : scratch.data() + (size_t)(yy - lo) * span;
+        }
+        convolveColumnsCPU(rows.data(), out.data(), span, kernelCol, kernelSize);
+        std::copy(out.data() + rect.x - xs, out.data() + rect.x - xs + rect.width, dstRow + rect.x);
+    }
+}
+
+/**
+ * @brief Separable convolution of a whole image: a row pass followed by a column pass.
+ * Row bands are processed in parallel on the CPU thread pool.
+ *
+ * @param src Input image, CV_32F
+ * @param dst Output image, (re)allocated as CV_32F of the same size. Must not alias src
+ * @param kernelRow Horizontal kernel
+ * @param kernelCol Vertical kernel
+ * @param kernelSize Kernel size, odd
+ * @param border Border mode
+ */
+void separableConvolutionCPU(const cv::Mat &src, cv::Mat &dst, const float *kernelRow, const float *kernelCol, int kernelSize, ConvBorder border)
+{
+    dst.create(src.rows, src.cols, CV_32F);
+    parallelForRows(src.rows, [&](int rowBegin, int rowEnd)
+                    {
+        static thread_local std::vector<float> scratch;
+        separableConvolutionBandCPU(src, dst, kernelRow, kernelCol, kernelSize, border, rowBegin, rowEnd, scratch); }, std::max(16, 4 * kernelSize));
+}
+
+/**
+ * @brief Direct 2D convolution on one thread. Used for the kernels that are not separable and by the scalar backend
+ *
+ * @param src Input image, CV_32F
+ * @param dst Output image, CV_32F, allocated to the size of src
+ * @param kernel 2D kernel, row major
+ * @param kernelSize Kernel size, odd
+ * @param border Border mode
+ */
+void convolution2DCPU(const cv::Mat &src, cv::Mat &dst, const float *kernel, int kernelSize, ConvBorder border)
+{
+    int pad = kernelSize / 2;
+    for (int y = 0; y < src.rows; y++)
+    {
+        float *out = dst.ptr<float>(y);
+        for (int x = 0; x < src.cols; x++)
+        {
+            float pixelValue = 0.0f;
+            bool inside = y >= pad && y < src.rows - pad && x >= pad && x < src.cols - pad;
+            if (inside || border != CONV_BORDER_NONE)
+            {
+                for (int ky = 0; ky < kernelSize; ky++)
+                {
+                    int imageY = borderIndex(y + ky - pad, src.rows, border);
+                    if (imageY < 0)
+                        continue;
+                    const float *in = src.ptr<float>(imageY);
+                    for (int kx = 0; kx < kernelSize; kx++)
+                    {
+                        int imageX = borderIndex(x + kx - pad, src.cols, border);
+                        if (imageX >= 0)
+                            pixelValue += in[imageX] * kernel[ky * kernelSize + kx];
+                    }
+                }
+            }
+            out[x] = pixelValue;
+        }
+    }
+}
+
+/**
+ * @brief Stores a kernel and its separable factors
+ *
+ * @param values 2D kernel, row major
+ * @param kernelSize Kernel size
+ */
+void ConvolutionKernel::set(const float *values, int kernelSize)
+{
+    size = kernelSize;
+    kernel.assign(values, values + kernelSize * kernelSize);
+    row.resize(kernelSize);
+    col.resize(kernelSize);
+    separable = factorSeparableKernel(values, kernelSize, row.data(), col.data());
+}
+
+/**
+ * @brief CPU Convolution into an existing image. Separable kernels (Gaussian, Sobel) go through the vectorized
+ * row/column engine, anything else falls back to a direct 2D loop. dst is only reallocated if its size or type differ.
+ *
+ * @param src Input image, CV_32F
+ * @param dst Output image, CV_32F. Must not alias src
+ * @param kernel Filter kernel
+ * @param border Border mode. The default leaves the pad-wide frame at 0 like the original implementation
+ */
+void applyConvolutionCPU(const cv::Mat &src, cv::Mat &dst, const ConvolutionKernel &kernel, ConvBorder border)
+{
+    if (kernel.size % 2 == 0)
+    {
+        std::cerr << "Error: Kernel size must be odd." << std::endl;
+        return;
+    }
+
+    dst.create(src.rows, src.cols, CV_32F);
+#ifdef MEASURE_TIME
+    double start = cv::getTickCount();
+#endif
+    if (kernel.separable)
+    {
+        separableConvolutionCPU(src, dst, kernel.row.data(), kernel.col.data(), kernel.size, border);
+    }
+    else
+    {
+        convolution2DCPU(src, dst, kernel.kernel.data(), kernel.size, border);
+    }
+#ifdef MEASURE_TIME
+    double end = cv::getTickCount();
+    double time = (end - start) / cv::getTickFrequency();
+    cout << "Convolution CPU time: " << time * 1000 << "ms" << endl;
+#endif
+}
+
+/**
+ * @brief CPU Convolution
+ *
+ * @param inputImage Input image, CV_32F
+ * @param kernel Filter kernel
+ * @param kernelSize Kernel size
+ * @param border Border mode. The default leaves the pad-wide frame at 0 like the original implementation
+ * @return cv::Mat Output image
+ */
+cv::Mat applyConvolutionCPU(const cv::Mat &inputImage, const float *kernel, int kernelSize, ConvBorder border)
+{
+    if (kernelSize % 2 == 0)
+    {
+        std::cerr << "Error: Kernel size must be odd." << std::endl;
+        return cv::Mat();
+    }
+
+    ConvolutionKernel factored;
+    factored.set(kernel, kernelSize);
+    cv::Mat outputImage;
+    applyConvolutionCPU(inputImage, outputImage, factored, border);
+    return outputImage;
+}
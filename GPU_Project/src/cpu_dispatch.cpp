@@ -0,0 +1,66 @@
+#include <atomic>
+#include <string>
+#include "../include/cpu_dispatch.h"
+using namespace std;
+
+/**
+ * @brief Widest tier the running CPU (and OS, for the AVX register state) supports. Resolved once
+ */
+CpuIsa detectedCpuIsa()
+{
+    static const CpuIsa detected = []()
+    {
+#ifdef CPU_DISPATCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq") &&
+            __builtin_cpu_supports("avx512vl"))
+            return ISA_AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return ISA_AVX2;
+        if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+            return ISA_SSE42;
+#endif
+        return ISA_BASELINE;
+    }();
+    return detected;
+}
+
+std::atomic<int> cpuIsa(detectedCpuIsa());
+
+/**
+ * @brief Restricts the dispatched kernels to a tier, e.g. to compare the tiers on one machine
+ *
+ * @param isa Tier
+ * @return false if the CPU does not support it, the tier is then left unchanged
+ */
+bool setCpuIsa(CpuIsa isa)
+{
+    if (isa > detectedCpuIsa())
+        return false;
+    cpuIsa = isa;
+    return true;
+}
+
+const char *cpuIsaName(CpuIsa isa)
+{
+    static const char *names[ISA_COUNT] = {"baseline", "sse4.2", "avx2", "avx512"};
+    return names[isa];
+}
+
+/**
+ * @brief Tier by name, as printed by cpuIsaName
+ *
+ * @return false if the name is unknown
+ */
+bool parseCpuIsa(const std::string &name, CpuIsa &isa)
+{
+    for (int i = 0; i < ISA_COUNT; i++)
+    {
+        if (name == cpuIsaName((CpuIsa)i))
+        {
+            isa = (CpuIsa)i;
+            return true;
+        }
+    }
+    return false;
+}
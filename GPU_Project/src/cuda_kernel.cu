@@ -1,6 +1,7 @@
 #define DEBUG
 
 #include <cfloat>
+#include <cmath>
 #include <cuda.h>
 #include <cuda_runtime.h>
 #include <stdio.h>
@@ -1228,8 +1229,9 @@ void separableConvolutionKernelWrap(float *img_d, float *img_out_d, int width, i
  * @param gray_d Output image
  * @param N Width of the image
  * @param M Height of the image
+ * @return true if the kernel ran
  */
-void rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int width, int height)
+bool rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int width, int height)
 {
 
     // Launch kernel
@@ -1239,6 +1241,7 @@ void rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int width, int height)
     if (img_d == nullptr || gray_d == nullptr)
     {
         fprintf(stderr, "Error: NULL pointer before kernel launch!\n");
+        return false;
     }
 
     rgbToGrayKernel<<<grid, block>>>(img_d, gray_d, width, height);
@@ -1250,6 +1253,7 @@ void rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int width, int height)
     {
         fprintf(stderr, "Error in kernel RGB: %s\n", cudaGetErrorName(err));
     }
+    return err == cudaSuccess;
 }
 
 /**
@@ -1260,8 +1264,9 @@ void rgbToGrayKernelWrap(uchar4 *img_d, float *gray_d, int width, int height)
  * @param data_w Width of the image
  * @param data_h Height of the image
  * @param d_kernel Kernel
+ * @return true if the kernel ran
  */
-void convolutionGPUWrap(float *result_d, float *data_d, int data_w, int data_h, float *__restrict__ d_kernel, int kernel_size)
+bool convolutionGPUWrap(float *result_d, float *data_d, int data_w, int data_h, float *__restrict__ d_kernel, int kernel_size)
 {
     const dim3 blockSize(TILE_WIDTH, TILE_WIDTH, 1);
     dim3 dimGrid(ceil((float)data_w / TILE_WIDTH), ceil((float)data_h / TILE_WIDTH));
@@ -1287,122 +1292,177 @@ void convolutionGPUWrap(float *result_d, float *data_d, int data_w, int data_h,
     // printf("Elapsed time for convolution: %f ms\n", milliseconds);
     cudaError_t err = cudaGetLastError();
     if (err != cudaSuccess)
+    {
+        fprintf(stderr, "Error in kernel CONVGPU: %s\n", cudaGetErrorString(err));
+        return false;
+    }
+    err = cudaDeviceSynchronize();
+    if (err != cudaSuccess)
     {
         fprintf(stderr, "Error in kernel CONVGPU: %s\n", cudaGetErrorString(err));
     }
-    cudaDeviceSynchronize();
     // cudaEventDestroy(start);
     // cudaEventDestroy(stop);
+    return err == cudaSuccess;
 }
 /**
- * @brief Driver function for the Canny edge detection algorithm.
+ * @brief Allocates the scratch maps for a frame size, unless they are already there for it
  *
- * @param img_data_h Host image data
- * @param img_data_d Device image data
- * @param sobel_x Sobel kernel in the x direction
- * @param sobel_y Sobel kernel in the y direction
+ * @param width Width of the image
+ * @param height Height of the image
+ * @return true if the maps are allocated, false (and everything released) if the device is out of memory
+ */
+bool CannyDeviceContext::prepare(int width, int height)
+{
+    const int n = width * height;
+    if (n == pixels)
+    {
+        return true;
+    }
+    release();
+    float **maps[] = {&magnitude_d, &direction_d, &suppressed_d};
+    bool ok = true;
+    for (float **map : maps)
+    {
+        ok = ok && cudaMalloc(map, n * sizeof(float)) == cudaSuccess;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Unable to allocate the Canny buffers on the device\n");
+        release();
+        return false;
+    }
+    pixels = n;
+    return true;
+}
+
+/**
+ * @brief Frees the scratch maps
+ */
+void CannyDeviceContext::release()
+{
+    float **maps[] = {&magnitude_d, &direction_d, &suppressed_d};
+    for (float **map : maps)
+    {
+        cudaFree(*map);
+        *map = nullptr;
+    }
+    pixels = 0;
+}
+
+/**
+ * @brief Driver function for the Canny edge detection algorithm, from the gradients to the edges. Everything stays on
+ * the device.
+ *
+ * @param edges_d Output, 255 on the edges and 0 elsewhere
+ * @param sobel_x Gradient in the x direction
+ * @param sobel_y Gradient in the y direction
  * @param width Width of the image
  * @param height Height of the image
  * @param low_th Lower threshold for the double thresholding
  * @param high_th Higher threshold for the double thresholding
- * @param gauss_kernel Gaussian kernel
- * @param g_kernel_size Size of the Gaussian kernel
+ * @param device Scratch maps reused from one call to the next, or nullptr to allocate them for this call only
+ * @return true if every kernel ran
  */
-void cannyMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x, float *sobel_y, int width, int height, float low_th, float high_th, float *gauss_kernel, int g_kernel_size, bool is_video)
+bool cannyMainKernelWrap(float *edges_d, float *sobel_x, float *sobel_y, int width, int height, float low_th, float high_th, CannyDeviceContext *device)
 {
-    size_t img_size = width * height * sizeof(float);
-    // float milliseconds = 0;
-    // float milliseconds2 = 0;
     dim3 block(TILE_WIDTH, TILE_WIDTH);
     dim3 grid((width + block.x - 1) / block.x, (height + block.y - 1) / block.y);
-    float *img_sobel, *sobel_directions, *lbcs_img, *tts_img, *img_debug_h;
-    float *output_d;
-
-    // cudaEvent_t start, stop;
-    // cudaEvent_t start2, stop2;
-    img_debug_h = (float *)malloc(img_size);
-
-    // cudaEventCreate(&start);
-    // cudaEventCreate(&stop);
-
-    // cudamallocs
-    cudaMalloc(&img_sobel, img_size);
-    cudaMalloc(&sobel_directions, img_size);
-    cudaMalloc(&lbcs_img, img_size);
-    cudaMalloc(&tts_img, img_size);
-    cudaMalloc(&output_d, img_size);
-    // cudaMalloc(&img_data_d, width * height * 3 * sizeof(unsigned char));
+    CannyDeviceContext local;
+    CannyDeviceContext &scratch = device ? *device : local;
+    if (!scratch.prepare(width, height))
+    {
+        return false;
+    }
 
     // 1. Combining gradients to get magnitude and direction of each pixel
-    combineGradientsKernel<<<grid, block>>>(sobel_x, sobel_y, img_sobel, sobel_directions, width, height);
-    // // save image
-    // cudaMemcpy(img_debug_h, img_sobel, img_size, cudaMemcpyDeviceToHost);
-    // cv::Mat printImage(height, width, CV_32F, img_debug_h);
-    // cv::Mat displayImage1;
-    // printImage.convertTo(displayImage1, CV_8UC1, 1.0);
-    // cv::imwrite("debug/combined_gradients_cuda.jpg", displayImage1);
+    combineGradientsKernel<<<grid, block>>>(sobel_x, sobel_y, scratch.magnitude_d, scratch.direction_d, width, height);
     cudaDeviceSynchronize();
     // 2. Lower bound cutoff suppression to suppress non-maximum pixels with respect to the gradient direction
-    // cudaEventRecord(start);
-    lowerBoundCutoffSuppression_sh<<<grid, block>>>(img_sobel, sobel_directions, lbcs_img, width, height);
-    // cudaMemcpy(img_debug_h, lbcs_img, img_size, cudaMemcpyDeviceToHost);
-    // cv::Mat printImage2(height, width, CV_32F, img_debug_h);
-    // cv::Mat displayImage2;
-    // printImage2.convertTo(displayImage2, CV_8UC1, 1.0);
-    // cv::imwrite("debug/lbcs_cuda.jpg", displayImage2);
+    lowerBoundCutoffSuppression_sh<<<grid, block>>>(scratch.magnitude_d, scratch.direction_d, scratch.suppressed_d, width, height);
     cudaDeviceSynchronize();
-    // cudaEventRecord(stop);
-    // cudaEventSynchronize(stop);
-    // cudaEventElapsedTime(&milliseconds, start, stop);
-    // printf("Elapsed time for LBCS: %f ms\n", milliseconds);
 
     // 3. Double thresholding suppression to mark edge pixels as strong, weak or non-edge
-    doubleThresholdSuppression<<<grid, block>>>(lbcs_img, output_d, width, height, low_th, high_th);
-    // cudaMemcpy(img_debug_h, output_d, img_size, cudaMemcpyDeviceToHost);
-    // cv::Mat printImage3(height, width, CV_32F, img_debug_h);
-    // cv::Mat displayImage3;
-    // printImage3.convertTo(displayImage3, CV_8UC1, 1.0);
-    // cv::imwrite("debug/double_threshold_cuda.jpg", displayImage3);
+    doubleThresholdSuppression<<<grid, block>>>(scratch.suppressed_d, edges_d, width, height, low_th, high_th);
     cudaDeviceSynchronize();
-    // cudaEventCreate(&start2);
-    // cudaEventCreate(&stop2);
 
-    // 4. Hysteresis to mark weak edge pixels as strong if they are connected to strong edge pixels
-    // cudaEventRecord(start2);
-    if (!is_video)
+    // 4. Hysteresis to mark weak edge pixels as strong if they are connected to strong edge pixels. Each iterative
+    // pass grows the strong edges by one pixel, the last one drops the weak pixels left
+    for (int i = 0; i < 30; i++)
     {
-        for (int i = 0; i < 30; i++)
-        {
-            hysteresis<<<grid, block>>>(output_d, width, height, true);
-            cudaDeviceSynchronize();
-        }
+        hysteresis<<<grid, block>>>(edges_d, width, height, true);
+        cudaDeviceSynchronize();
     }
-    hysteresis<<<grid, block>>>(output_d, width, height, false);
+    hysteresis<<<grid, block>>>(edges_d, width, height, false);
     cudaDeviceSynchronize();
-    // cudaEventRecord(stop2);
-    // cudaEventSynchronize(stop2);
-    // cudaEventElapsedTime(&milliseconds2, start2, stop2);
-    // printf("Elapsed time for Hysteresis: %f ms\n", milliseconds2);
-
-    // Copying img data from cv object to device, then overwriting it with the output of the kernel and copying it back to the host
-    // cudaMemcpy(img_data_d, img_data, width * height * 3 * sizeof(unsigned char), cudaMemcpyHostToDevice);
-    copy1ChannelTo4<<<grid, block>>>(output_d, img_data_d, width, height);
-    cudaMemcpy(img_data_h, img_data_d, width * height * sizeof(uchar4), cudaMemcpyDeviceToHost);
-
-    cudaFree(output_d);
-    cudaFree(img_sobel);
-    cudaFree(sobel_directions);
-    cudaFree(lbcs_img);
-    cudaFree(tts_img);
-    // cudaFree(img_data_d);
-    free(img_debug_h);
 
     cudaError_t err = cudaGetLastError();
     if (err != cudaSuccess)
     {
         fprintf(stderr, "Error in canny kernel wrap: %s\n", cudaGetErrorString(err));
     }
+    return err == cudaSuccess;
+}
+/**
+ * @brief Allocates the scratch buffers and streams for a frame size, unless they are already there for it
+ *
+ * @param width Width of the image
+ * @param height Height of the image
+ * @return true if the buffers are allocated, false (and everything released) if the device is out of memory
+ */
+bool HarrisDeviceContext::prepare(int width, int height)
+{
+    const int n = width * height;
+    if (n == pixels)
+    {
+        return true;
+    }
+    release();
+    float **maps[] = {&Ix2_d, &Iy2_d, &IxIy_d, &IxIy2_d, &detM_d, &traceM_d, &output_d};
+    bool ok = true;
+    for (float **map : maps)
+    {
+        ok = ok && cudaMalloc(map, n * sizeof(float)) == cudaSuccess;
+    }
+    ok = ok && cudaMalloc(&maxValue_d, sizeof(float)) == cudaSuccess && cudaMalloc(&count_d, sizeof(int)) == cudaSuccess;
+    for (cudaStream_t &stream : streams)
+    {
+        ok = ok && cudaStreamCreate(&stream) == cudaSuccess;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Unable to allocate the Harris buffers on the device\n");
+        release();
+        return false;
+    }
+    pixels = n;
+    return true;
+}
+
+/**
+ * @brief Frees the scratch buffers and streams
+ */
+void HarrisDeviceContext::release()
+{
+    float **maps[] = {&Ix2_d, &Iy2_d, &IxIy_d, &IxIy2_d, &detM_d, &traceM_d, &output_d, &maxValue_d};
+    for (float **map : maps)
+    {
+        cudaFree(*map);
+        *map = nullptr;
+    }
+    cudaFree(count_d);
+    count_d = nullptr;
+    for (cudaStream_t &stream : streams)
+    {
+        if (stream)
+        {
+            cudaStreamDestroy(stream);
+        }
+        stream = nullptr;
+    }
+    pixels = 0;
 }
+
 /**
  * @brief Driver function for the Harris corner detection algorithm.
  *
@@ -1418,18 +1478,25 @@ void cannyMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x,
  * @param g_kernel_size Gaussian kernel size
  * @param shi_tomasi Flag to enable Shi-Tomasi corner detection
  * @param harris_map_d Harris map output
- * @return treshold value
+ * @param device Scratch buffers reused from one call to the next, or nullptr to allocate them for this call only
+ * @return treshold value, NaN if a CUDA call failed
  */
-float harrisMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x, float *sobel_y, int width, int height, float k, float alpha, float *gaussian_kernel, int g_kernel_size, bool shi_tomasi, float *harris_map_d)
+float harrisMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_x, float *sobel_y, int width, int height, float k, float alpha, float *gaussian_kernel, int g_kernel_size, bool shi_tomasi, float *harris_map_d, HarrisDeviceContext *device)
 {
-    int n = width * height;
     // float milliseconds = 0;
     float max_value_f = -FLT_MAX;
-    float *Ix2_d, *Iy2_d, *IxIy_d, *IxIy_d2, *detM_d, *traceM_d;
-    float *output_d;
-    float *max_value_d;
+    HarrisDeviceContext local;
+    HarrisDeviceContext &scratch = device ? *device : local;
+    if (!scratch.prepare(width, height))
+    {
+        return NAN;
+    }
+    float *Ix2_d = scratch.Ix2_d, *Iy2_d = scratch.Iy2_d, *IxIy_d = scratch.IxIy_d, *IxIy_d2 = scratch.IxIy2_d;
+    float *detM_d = scratch.detM_d, *traceM_d = scratch.traceM_d;
+    float *output_d = scratch.output_d;
+    float *max_value_d = scratch.maxValue_d;
 
-    cudaStream_t streams[3];
+    cudaStream_t *streams = scratch.streams;
     // cudaEvent_t start, stop;
     const dim3 blockSize(TILE_WIDTH, TILE_WIDTH, 1);
     const dim3 gridSize((width + blockSize.x - 1) / blockSize.x,
@@ -1439,25 +1506,8 @@ float harrisMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_
     // cudaEventCreate(&start);
     // cudaEventCreate(&stop);
 
-#pragma region Memory Allocation
-    // cuda malloc
-    cudaMalloc(&Ix2_d, n * sizeof(float));
-    cudaMalloc(&Iy2_d, n * sizeof(float));
-    cudaMalloc(&IxIy_d, n * sizeof(float));
-    cudaMalloc(&IxIy_d2, n * sizeof(float));
-    cudaMalloc(&detM_d, n * sizeof(float));
-    cudaMalloc(&traceM_d, n * sizeof(float));
-    cudaMalloc(&output_d, n * sizeof(float));
-    cudaMalloc(&max_value_d, sizeof(float));
-
     cudaMemcpy(max_value_d, &max_value_f, sizeof(float), cudaMemcpyHostToDevice);
 
-    // Create CUDA streams
-    cudaStreamCreate(&streams[0]);
-    cudaStreamCreate(&streams[1]);
-    cudaStreamCreate(&streams[2]);
-#pragma endregion
-
 #pragma region 1-2. Preparing Gradients
     // 1. Compute Ix^2, Iy^2, and Ix*Iy in parallel using streams
     vecMul<<<gridSize, blockSize, 0, streams[0]>>>(sobel_x, sobel_x, Ix2_d, width, height);  // Ix^2
@@ -1535,29 +1585,15 @@ float harrisMainKernelWrap(uchar4 *img_data_h, uchar4 *img_data_d, float *sobel_
     cudaMemcpy(img_data_h, img_data_d, width * height * sizeof(uchar4), cudaMemcpyDeviceToHost);
 #pragma endregion
 
-#pragma region Cleanup
-    cudaFree(Ix2_d);
-    cudaFree(Iy2_d);
-    cudaFree(IxIy_d);
-    cudaFree(IxIy_d2);
-    cudaFree(detM_d);
-    cudaFree(traceM_d);
-    cudaFree(output_d);
-    cudaFree(max_value_d);
-    // cudaFree(img_data_d);
-
-    cudaStreamDestroy(streams[0]);
-    cudaStreamDestroy(streams[1]);
-    cudaStreamDestroy(streams[2]);
-
+    // the scratch buffers are released with local, or kept in device for the next call
     // cudaEventDestroy(start);
     // cudaEventDestroy(stop);
-#pragma endregion
 
     cudaError_t err = cudaGetLastError();
     if (err != cudaSuccess)
     {
         fprintf(stderr, "Error in harris kernel wrap: %s\n", cudaGetErrorString(err));
+        return NAN;
     }
 
     return treshold;
@@ -1654,6 +1690,7 @@ __global__ void mapCommonCornersKernel(const float *__restrict__ harris1,
  * @param window window size to search for matching corners
  * @param idx1Mapping_d mapping of corners from first frame
  * @param idx2Mapping_d mapping of corners from second frame
+ * @param device Scratch buffers reused from one call to the next, or nullptr to allocate them for this call only
  * @return number of common corners
  */
 int mapCommonKernelWrap(const float *harris1,
@@ -1664,13 +1701,19 @@ int mapCommonKernelWrap(const float *harris1,
                         const float tollerance,
                         int window,
                         int *idx1Mapping_d,
-                        int *idx2Mapping_d)
+                        int *idx2Mapping_d,
+                        HarrisDeviceContext *device)
 {
     dim3 block(TILE_WIDTH, TILE_WIDTH);
     dim3 grid((width + block.x - 1) / block.x, (height + block.y - 1) / block.y);
 
-    int *mappingCount_d;
-    cudaMalloc(&mappingCount_d, sizeof(int));
+    HarrisDeviceContext local;
+    HarrisDeviceContext &scratch = device ? *device : local;
+    if (!scratch.prepare(width, height))
+    {
+        return 0;
+    }
+    int *mappingCount_d = scratch.count_d;
     cudaMemset(mappingCount_d, 0, sizeof(int));
 
     mapCommonCornersKernel<<<grid, block>>>(harris1, harris2, width, height, threshold, tollerance, window, idx1Mapping_d, idx2Mapping_d, mappingCount_d);
@@ -1679,8 +1722,6 @@ int mapCommonKernelWrap(const float *harris1,
     int mappingCount_h;
     cudaMemcpy(&mappingCount_h, mappingCount_d, sizeof(int), cudaMemcpyDeviceToHost);
 
-    cudaFree(mappingCount_d);
-
     cudaError_t err = cudaGetLastError();
     if (err != cudaSuccess)
     {
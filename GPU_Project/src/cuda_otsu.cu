@@ -30,8 +30,8 @@ __global__ void computeHistogram(float *image, int *histogram, int width, int he
         int x = i % width;
         int y = i / width;
         float pixel = image[y * width + x];
-        // casting pixel to bin number
-        int bin = (int)pixel;
+        // casting pixel to bin number, clamped since blurred values can leave [0, 255]
+        int bin = min(255, max(0, (int)pixel));
         atomicAdd(&shared_histogram[bin], 1);
     }
     __syncthreads();
@@ -272,118 +272,117 @@ __global__ void findMaxReductionSHFL(int *sigma2_b, int *max_threshold)
 /**
  * @brief Binarize an image using a given threshold.
  *
- * @param output_d Output image.
+ * @param output_d Output image, 255 above the threshold and 0 elsewhere.
  * @param img_d Input image.
  * @param width Width of the image.
  * @param height Height of the image.
  * @param threshold Threshold to binarize the image.
  */
-__global__ void binarizeImgKernel(unsigned char *output_d, float *img_d, int width, int height, int threshold)
+__global__ void binarizeImgKernel(float *output_d, float *img_d, int width, int height, int threshold)
 {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
     if (x < width && y < height)
     {
         int idx = y * width + x;
-        output_d[idx] = (unsigned char)(img_d[idx] > threshold ? 255 : 0);
+        output_d[idx] = img_d[idx] > threshold ? 255.0f : 0.0f;
     }
 }
 
 /**
- * @brief Binarizes an image using a given threshold.
+ * @brief Binarizes an image using a given threshold. Both images are on the device.
  *
- * @param img_gray_h Host image.
+ * @param output_d Output image, 255 above the threshold and 0 elsewhere. May be img_d.
  * @param img_d Device image.
  * @param width Width of the image.
  * @param height Height of the image.
  * @param threshold Threshold to binarize the image.
+ * @return true if the kernel ran
  */
-void binarizeImgWrapper(unsigned char *img_gray_h, float *img_d, int width, int height, int threshold)
+bool binarizeImgWrapper(float *output_d, float *img_d, int width, int height, int threshold)
 {
-    unsigned char *output_d;
-    size_t img_size = width * height;
     const dim3 blockSize(16, 16);
     const dim3 gridSize((width + blockSize.x - 1) / blockSize.x, (height + blockSize.y - 1) / blockSize.y);
 
-    cudaMalloc(&output_d, img_size * sizeof(unsigned char));
-
     binarizeImgKernel<<<gridSize, blockSize>>>(output_d, img_d, width, height, threshold);
-
-    cudaMemcpy(img_gray_h, output_d, img_size * sizeof(unsigned char), cudaMemcpyDeviceToHost);
-    cudaFree(output_d);
+    cudaError_t err = cudaDeviceSynchronize();
+    if (err == cudaSuccess)
+    {
+        err = cudaGetLastError();
+    }
+    if (err != cudaSuccess)
+    {
+        fprintf(stderr, "Error in binarize kernel: %s\n", cudaGetErrorString(err));
+    }
+    return err == cudaSuccess;
 }
 
+// Device buffers of otsuThreshold. They do not depend on the image size, so they are allocated by the first call and reused
+static int *histogram = nullptr;
+static float *probabilities = nullptr;
+static int *sigma2_b = nullptr;
+static int *max_threshold_d = nullptr;
+
 /**
  * @brief Compute the Otsu threshold of the image.
  *
  * @param image The image to compute the Otsu threshold of.
  * @param width The width of the image.
  * @param height The height of the image.
- * @return The Otsu threshold of the image.
+ * @return The Otsu threshold of the image, -1 if a CUDA call failed.
  */
 int otsuThreshold(float *image, int width, int height)
 {
-    // const dim3 blockSize(16, 16);
-    // const dim3 gridSize((width + blockSize.x - 1) / blockSize.x, (height + blockSize.y - 1) / blockSize.y);
     const dim3 blockSize(256, 1);
     const dim3 gridSize((width * height + blockSize.x - 1) / blockSize.x, 1);
     // 256x1 thread since we only work with a 256x1 histogram
     const dim3 gridSize2(1, 1);
     const dim3 blockSize2(256, 1);
-    // float milliseconds = 0;
-    int *histogram;
-    float *probabilities;
-    int *sigma2_b;
-    int *max_threshold_d;
-    int *max_threshold_h = (int *)malloc(1 * sizeof(int));
-    // cudaEvent_t start, stop;
-
-    // cudaEventCreate(&start);
-    // cudaEventCreate(&stop);
-
-    cudaMalloc(&histogram, 256 * sizeof(int));
+    int max_threshold_h = 0;
+
+    if (histogram == nullptr)
+    {
+        if (cudaMalloc(&histogram, 256 * sizeof(int)) != cudaSuccess || cudaMalloc(&probabilities, 256 * sizeof(float)) != cudaSuccess ||
+            cudaMalloc(&sigma2_b, 256 * sizeof(int)) != cudaSuccess || cudaMalloc(&max_threshold_d, 1 * sizeof(int)) != cudaSuccess)
+        {
+            fprintf(stderr, "Error: Unable to allocate the Otsu buffers on the device\n");
+            cudaFree(histogram);
+            cudaFree(probabilities);
+            cudaFree(sigma2_b);
+            cudaFree(max_threshold_d);
+            histogram = nullptr;
+            probabilities = nullptr;
+            sigma2_b = nullptr;
+            max_threshold_d = nullptr;
+            return -1;
+        }
+    }
     cudaMemset(histogram, 0, 256 * sizeof(int));
-    cudaMalloc(&probabilities, 256 * sizeof(float));
-    cudaMalloc(&sigma2_b, 256 * sizeof(int));
+    // findMaxReductionSHFL accumulates with atomicMax
+    cudaMemset(max_threshold_d, 0, 1 * sizeof(int));
 
     // histogram
-
     computeHistogram<<<gridSize, blockSize>>>(image, histogram, width, height);
 
     // probabilities
     computeProbabilitiesHistogram<<<gridSize2, blockSize2>>>(image, histogram, probabilities, width * height);
 
     // sigma2b for each threshold
-    // cudaEventRecord(start);
     otsuThresholdKernel<<<gridSize2, blockSize2>>>(image, probabilities, width, height, sigma2_b);
-    // cudaEventRecord(stop);
-
-    // cudaEventSynchronize(stop);
-    // cudaEventElapsedTime(&milliseconds, start, stop);
-    // printf("Otsu threshold elapsed time: %f ms\n", milliseconds);
 
     // Second part of otsu where we find the effective max threshold
-
-    cudaMalloc(&max_threshold_d, 1 * sizeof(int));
-
-    // cudaEventRecord(start);
     // findMaxReductionSHRD<<<gridSize2, blockSize2>>>(sigma2_b, max_threshold_d, width, height);
     findMaxReductionSHFL<<<gridSize2, blockSize2>>>(sigma2_b, max_threshold_d);
 
-    // cudaEventRecord(stop);
-    // cudaEventSynchronize(stop);
-    // cudaEventElapsedTime(&milliseconds, start, stop);
-    // printf("Find max threshold CUDA elapsed time: %f ms\n", milliseconds);
-
-    cudaMemcpy(max_threshold_h, max_threshold_d, 1 * sizeof(int), cudaMemcpyDeviceToHost);
-    // printf("Max threshold Cuda: %d\n", max_threshold_h[0]);
-    cudaDeviceSynchronize();
-
-    cudaFree(histogram);
-    cudaFree(probabilities);
-    cudaFree(sigma2_b);
-    cudaFree(max_threshold_d);
-    // cudaEventDestroy(start);
-    // cudaEventDestroy(stop);
-    return max_threshold_h[0];
+    cudaError_t err = cudaMemcpy(&max_threshold_h, max_threshold_d, 1 * sizeof(int), cudaMemcpyDeviceToHost);
+    if (err == cudaSuccess)
+    {
+        err = cudaGetLastError();
+    }
+    if (err != cudaSuccess)
+    {
+        fprintf(stderr, "Error in otsu threshold: %s\n", cudaGetErrorString(err));
+        return -1;
+    }
+    return max_threshold_h;
 }
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/thread_pool.h"
+#include "../include/dirty_tiles_cpu.h"
+using namespace std;
+
+/**
+ * @brief Compares a frame with the reference, tile by tile. Dirty tiles are copied into the reference, and the tiles
+ * to recompute are the dirty ones plus their 8 neighbours, so that stages reading a few pixels around each output
+ * (blur, Sobel, NMS) see every changed input as long as their combined radius is below the tile size.
+ * The first frame, or a frame of another size, marks every tile.
+ *
+ * @param frame Grayscale frame, CV_32F
+ * @param reference Grayscale image the cached results were computed from, CV_32F. Updated on the dirty tiles
+ * @return int Number of dirty tiles, before the neighbours are added
+ */
+int DirtyTiles::update(const cv::Mat &frame, cv::Mat &reference)
+{
+    const int rows = frame.rows;
+    const int cols = frame.cols;
+    const int nx = (cols + tileSize - 1) / tileSize;
+    const int ny = (rows + tileSize - 1) / tileSize;
+    if (!valid || nx != tilesX || ny != tilesY || reference.size() != frame.size())
+    {
+        tilesX = nx;
+        tilesY = ny;
+        frame.copyTo(reference);
+        regions.clear();
+        for (int ty = 0; ty < ny; ty++)
+            for (int tx = 0; tx < nx; tx++)
+                regions.push_back(cv::Rect(tx * tileSize, ty * tileSize, std::min(tileSize, cols - tx * tileSize), std::min(tileSize, rows - ty * tileSize)));
+        valid = true;
+        recomputedTiles += nx * ny;
+        totalTiles += nx * ny;
+        return nx * ny;
+    }
+
+    static thread_local std::vector<uchar> dirty;
+    dirty.assign(nx * ny, 0);
+    uchar *dirty_tiles = dirty.data();
+    const int sample = std::max(1, step);
+    parallelForRows(ny, [&](int tyBegin, int tyEnd)
+                    {
+        for (int ty = tyBegin; ty < tyEnd; ty++)
+        {
+            const int y0 = ty * tileSize;
+            const int y1 = std::min(rows, y0 + tileSize);
+            for (int tx = 0; tx < nx; tx++)
+            {
+                const int x0 = tx * tileSize;
+                const int x1 = std::min(cols, x0 + tileSize);
+                float sad = 0;
+                int samples = 0;
+                for (int y = y0; y < y1; y += sample)
+                {
+                    const float *a = frame.ptr<float>(y);
+                    const float *b = reference.ptr<float>(y);
+                    for (int x = x0; x < x1; x += sample)
+                        sad += std::fabs(a[x] - b[x]);
+                    samples += (x1 - x0 + sample - 1) / sample;
+                }
+                if (sad > threshold * samples)
+                {
+                    dirty_tiles[ty * nx + tx] = 1;
+                    for (int y = y0; y < y1; y++)
+                        std::copy(frame.ptr<float>(y) + x0, frame.ptr<float>(y) + x1, reference.ptr<float>(y) + x0);
+                }
+            }
+        } }, 1);
+
+    int count = 0;
+    regions.clear();
+    for (int ty = 0; ty < ny; ty++)
+    {
+        for (int tx = 0; tx < nx; tx++)
+        {
+            bool mark = false;
+            for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, ny - 1) && !mark; y++)
+                for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, nx - 1) && !mark; x++)
+                    mark = dirty[y * nx + x] != 0;
+            count += dirty[ty * nx + tx];
+            if (mark)
+                regions.push_back(cv::Rect(tx * tileSize, ty * tileSize, std::min(tileSize, cols - tx * tileSize), std::min(tileSize, rows - ty * tileSize)));
+        }
+    }
+    recomputedTiles += regions.size();
+    totalTiles += nx * ny;
+    return count;
+}
@@ -0,0 +1,1682 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include "../include/utils.h"
+#include "../include/edge_detection_cpu.h"
+#include "../include/thread_pool.h"
+#include "../include/pipeline_context.h"
+#include "../include/structure_tensor_cpu.h"
+#include "../include/frame_writer.h"
+#include "../include/stage_timer.h"
+#include "../include/video_pipeline.h"
+#include "../include/batch_cpu.h"
+#include "../include/work_stealing_pool.h"
+#include "../include/tiled_cpu.h"
+#include "../include/raw_io.h"
+#include "../include/backend.h"
+#include "../include/cpu_dispatch.h"
+#include "../include/filters.h"
+#include "../include/driver.h"
+
+using namespace cv;
+using namespace std;
+
+enum Mode
+{
+    // -H. Normal Harris Corner Detection
+    HARRIS,
+    // -C. Canny Edge Detection with Otsu Thresholding
+    CANNY,
+    // -O. Otsu thresholding method for image binarization
+    OTSU_BIN,
+    // -S. Harris corner detection with Shi-Tomasi response function
+    SHI_TOMASI,
+    // -OP. Motion between frames from matched corner descriptors
+    MOTION,
+
+};
+// Optional command line settings
+struct Options
+{
+    // -t=<n>. Number of CPU threads, 0 for all hardware threads
+    int num_threads = 1;
+    // -scaling. Thread scaling report instead of a normal run
+    bool scaling = false;
+    // -stream. Canny as a single fused line-buffer pass
+    bool streaming = false;
+    // -fixed. Canny and Otsu with 8/16/32-bit integer intermediates instead of CV_32F
+    bool fixed_point = false;
+    // -validate. Compares the fixed-point and the float pipelines instead of a normal run
+    bool validate = false;
+    // -bench[=<file>]. Stage and mode benchmark on synthetic images and on -f instead of a normal run, also written
+    // as CSV to file
+    bool bench = false;
+    std::string bench_out = "";
+    // -otsu-step=<n>. Otsu histograms read one pixel out of n x n
+    int otsu_step = 1;
+    // -otsu-tol=<d>. On videos, the Otsu threshold is kept while the histogram stays within this distance (0 to 1)
+    // of the one it was computed from. 0 recomputes it on every frame
+    float otsu_tolerance = 0;
+    // -otsu-local=<n>. Otsu binarization with one threshold per tile of about n x n pixels, interpolated between the
+    // tile centres. 0 for one global threshold
+    int otsu_local = 0;
+    // -otsu-classes=<k>. Otsu mode splits the image into k classes with multi-level thresholds, 2 for a binarization
+    int otsu_classes = 2;
+    // --serial. Video frames are decoded, processed and presented one after the other on one thread
+    bool serial = false;
+    // --headless. No window is opened, results go to --out
+    bool headless = false;
+    // --out=<dir|file>. Where results are written, empty to only show them
+    std::string out = "";
+    // --profile. Per-stage timing summary at exit
+    bool profile = false;
+    // --trace=<file>. Chrome trace JSON of the stage timings, written at exit
+    std::string trace = "";
+    // -window=<none|box|gaussian>. Window of the corner structure tensor
+    TensorWindow window = TENSOR_WINDOW_GAUSSIAN;
+    // -window-size=<n>. Side of the structure tensor window, 0 for the Gaussian blur size
+    int window_size = 0;
+    // -k=<k>. Harris mode uses the det - k * trace^2 response with this k instead of det / trace. 0 keeps det / trace
+    float harris_k = 0;
+    // -max-corners=<n>. Harris and Shi-Tomasi keep only the n strongest corners, 0 for all of them
+    int max_corners = 0;
+    // -min-distance=<d>. Minimum distance in pixels between two kept corners
+    float min_distance = 0;
+    // -levels=<n>. Harris, Shi-Tomasi and Canny also run on n - 1 downsampled copies of the image and merge the results
+    int levels = 1;
+    // -tiles=<n>. Canny on videos only recomputes the n x n tiles that changed since the previous frames, 0 disables it
+    int tile_size = 0;
+    // -tile-diff=<d>. Mean gray level difference above which a tile has changed
+    float tile_diff = 2.0f;
+    // -f2=<file>. Motion mode on images: the motion goes from -f to this image
+    std::string second_image = "";
+    // -search=<n>. Motion mode: largest displacement in pixels between two frames
+    int search_radius = 32;
+    // -max-hamming=<n>. Motion mode: largest descriptor distance (out of 256 bits) of a match
+    int max_hamming = 64;
+    // --tiled[=<MB>]. The image is read, processed and written in tiles that fit this memory budget, 0 disables it
+    size_t tiled_budget = 0;
+    // --backend=<scalar|cpu|cuda|auto>. Where the gray, blur and Sobel stages run, and the whole detector when the
+    // backend can run it (cuda). auto picks the fastest backend of each stage and detector on the first frame. The
+    // default is the one of the build: cpu for main_cpu, cuda for main
+    std::string backend = "cpu";
+    // -l=<low> -h=<high>. Canny thresholds on the gradient magnitude instead of Otsu, -1 for Otsu (high) and half of
+    // the high one (low)
+    int canny_low = -1;
+    int canny_high = -1;
+    // -g. Canny on an image with the thresholds set by two trackbars
+    bool gui = false;
+};
+
+/**
+ * @brief Applies the command line settings to a pipeline context
+ *
+ * @param ctx Pipeline context
+ * @param mode Execution mode
+ * @param opts Command line options
+ */
+void configure_context(PipelineContext &ctx, enum Mode mode, const Options &opts)
+{
+    ctx.otsu.sampleStep = opts.otsu_step;
+    ctx.otsu.tolerance = opts.otsu_tolerance;
+    ctx.localOtsu.tileSize = opts.otsu_local;
+    ctx.otsuClasses = opts.otsu_classes;
+    if (opts.canny_high >= 0)
+    {
+        ctx.otsu.pin(opts.canny_high);
+    }
+    ctx.cannyLow = opts.canny_low;
+    if (opts.backend == "auto")
+    {
+        ctx.backends.autoSelect = true;
+    }
+    else
+    {
+        ctx.backends.set(getBackend(opts.backend));
+    }
+    if (opts.window != TENSOR_WINDOW_GAUSSIAN || opts.window_size > 0)
+    {
+        ctx.tensor.setWindow(opts.window, opts.window_size > 0 ? opts.window_size : FILTER_WIDTH, &ctx.gaussian);
+    }
+    ctx.maxKeypoints = opts.max_corners;
+    ctx.keypointMinDistance = opts.min_distance;
+    ctx.pyramidLevels = opts.levels;
+    ctx.motion.searchRadius = opts.search_radius;
+    ctx.motion.maxDistance = opts.max_hamming;
+    if (opts.tile_size > 0)
+    {
+        // blur, Sobel and NMS must not reach past the neighbouring tiles
+        ctx.tiles.tileSize = std::max(opts.tile_size, FILTER_WIDTH / 2 + 3);
+        ctx.tiles.threshold = opts.tile_diff;
+    }
+    if (mode == SHI_TOMASI)
+    {
+        ctx.tensor.response = RESPONSE_SHI_TOMASI;
+    }
+    else if (opts.harris_k > 0)
+    {
+        ctx.tensor.response = RESPONSE_HARRIS_K;
+        ctx.tensor.k = opts.harris_k;
+    }
+}
+
+/**
+ * @brief With --backend=auto, times the backends on the first image given to the context and keeps the fastest one
+ * for each stage, and for the detector of the mode the fastest of the host pipeline and the backends that run it whole
+ *
+ * @param ctx Pipeline context
+ * @param mode Execution mode
+ * @param img RGB or grayscale image, as the detectors take it
+ */
+void select_backends(PipelineContext &ctx, enum Mode mode, const cv::Mat &img)
+{
+    if (ctx.backends.autoSelect && !ctx.backends.calibrated)
+    {
+        BackendDetector detector = BACKEND_DETECTOR_COUNT;
+        if (mode == CANNY)
+            detector = BACKEND_DETECTOR_CANNY;
+        else if (mode == HARRIS || mode == SHI_TOMASI)
+            detector = BACKEND_DETECTOR_CORNERS;
+        else if (mode == OTSU_BIN)
+            detector = BACKEND_DETECTOR_OTSU;
+        calibrateBackendsCPU(img, ctx, detector);
+    }
+}
+
+/**
+ * @brief Runs the selected detector on an RGB image
+ *
+ * @param mode Execution mode
+ * @param img Input RGB image. Harris paints the corners on it
+ * @param ctx Pipeline context, reused across frames
+ * @param opts Command line options
+ * @return cv::Mat Output image, valid until the next call with the same context
+ */
+cv::Mat run_detector(enum Mode mode, cv::Mat &img, PipelineContext &ctx, const Options &opts)
+{
+    select_backends(ctx, mode, img);
+    switch (mode)
+    {
+    case HARRIS:
+    case SHI_TOMASI:
+        return harrisCornerDetectorCPU(&img, ctx);
+    case CANNY:
+        if (opts.fixed_point)
+            return cannyEdgeDetectionFixedCPU(&img, ctx);
+        if (opts.streaming)
+            return cannyEdgeDetectionStreamCPU(&img, ctx);
+        if (opts.tile_size > 0)
+            return cannyEdgeDetectionIncrementalCPU(&img, ctx);
+        return cannyEdgeDetectionCPU(&img, ctx);
+    case OTSU_BIN:
+        if (opts.fixed_point)
+            return otsuBinarizationFixed(&img, ctx);
+        return otsuBinarization(&img, ctx);
+    case MOTION:
+        return motionEstimationCPU(&img, ctx);
+    }
+    return img;
+}
+
+/**
+ * @brief Runs the selected mode on a BGR image or video frame
+ *
+ * @param mode Execution mode
+ * @param img Input BGR image, converted to RGB in place
+ * @param ctx Pipeline context, reused across frames
+ * @param opts Command line options
+ * @param bgr false for the frames of RawFrameReader, already RGB (or grayscale for Canny and Otsu) and used as is
+ * @return cv::Mat Output image, valid until the next call with the same context
+ */
+cv::Mat process_frame(enum Mode mode, cv::Mat &img, PipelineContext &ctx, const Options &opts, bool bgr = true)
+{
+    if (bgr)
+    {
+        cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+    }
+
+    if (ctx.verbose)
+    {
+        switch (mode)
+        {
+        case HARRIS:
+            cout << "Harris Corner Detection" << endl;
+            break;
+        case CANNY:
+            cout << "Canny Edge Detection with Otsu Thresholding" << endl;
+            // save it to debug/2_cpu.jpg
+            // cv::imwrite("debug/2_cpu.jpg", img);
+            break;
+        case OTSU_BIN:
+            cout << "Otsu Binarization" << endl;
+            break;
+        case SHI_TOMASI:
+            cout << "Shi-Tomasi Corner Detection" << endl;
+            break;
+        case MOTION:
+            cout << "Motion Estimation" << endl;
+            break;
+        default:
+            cout << "Invalid mode" << endl;
+            break;
+        }
+    }
+    return run_detector(mode, img, ctx, opts);
+}
+
+/**
+ * @brief Shows and/or writes a processed image
+ *
+ * @param img Output of process_frame. RGB images are converted back to BGR in place
+ * @param opts Command line options
+ * @param writer Output writer, or nullptr
+ */
+void present_frame(cv::Mat &img, const Options &opts, FrameWriter *writer)
+{
+    ScopedStageTimer output_timer(STAGE_OUTPUT);
+    // Canny and Otsu return a single channel image
+    if (img.channels() == 3)
+    {
+        cv::cvtColor(img, img, cv::COLOR_RGB2BGR);
+    }
+    if (writer)
+    {
+        writer->write(img);
+    }
+    if (!opts.headless)
+    {
+        cv::imshow("Image", img);
+    }
+}
+
+/**
+ * @brief Whether a mode draws on its RGB input (corners, motion vectors) instead of returning a grayscale map
+ */
+bool draws_on_input(enum Mode mode)
+{
+    return mode == HARRIS || mode == SHI_TOMASI || mode == MOTION;
+}
+
+/**
+ * @brief Whether an input is read by RawFrameReader instead of being decoded by OpenCV: PGM/PPM images, Y4M videos
+ * and stdin ("-")
+ */
+bool is_raw_input(const std::string &filename)
+{
+    std::string ext = filename.substr(filename.find_last_of(".") + 1);
+    return filename == "-" || ext == "ppm" || ext == "pgm" || ext == "y4m";
+}
+
+/**
+ * @brief Runs the selected mode on an image, then shows and/or writes the result
+ *
+ * @param mode Execution mode
+ * @param filename Image filename
+ * @param ctx Pipeline context
+ * @param opts Command line options
+ * @param writer Output writer, or nullptr
+ */
+void handle_image(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts, FrameWriter *writer)
+{
+    // PGM/PPM images are mapped, and the detectors read the mapping
+    const bool raw = is_raw_input(filename);
+    RawFrameReader raw_reader;
+    cv::Mat img, raw_frame, rgb_buffer;
+    {
+        ScopedStageTimer timer(STAGE_DECODE);
+        if (!raw)
+            img = cv::imread(filename, cv::IMREAD_COLOR);
+        else if (raw_reader.open(filename) && raw_reader.read(raw_frame))
+            img = raw_reader.image(raw_frame, draws_on_input(mode), rgb_buffer);
+    }
+    if (img.empty())
+    {
+        std::cerr << "Error: Unable to load image." << std::endl;
+        return;
+    }
+    {
+        // one frame through the detector and the output. Decoding and key waits are not included
+        ScopedStageTimer frame_timer(STAGE_FRAME);
+        cv::Mat out = process_frame(mode, img, ctx, opts, !raw);
+        present_frame(out, opts, writer);
+    }
+    if (!opts.headless)
+    {
+        cv::waitKey(0);
+    }
+}
+
+/**
+ * @brief Canny on an image with the high and low thresholds set by two trackbars, rerun until esc is pressed
+ *
+ * @param mode Execution mode, CANNY
+ * @param filename Image filename
+ * @param ctx Pipeline context
+ * @param opts Command line options. -l and -h give the initial thresholds
+ */
+void handle_gui(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts)
+{
+    cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR);
+    if (img.empty())
+    {
+        std::cerr << "Error: Unable to load image." << std::endl;
+        return;
+    }
+    cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+    int thresh_h = opts.canny_high >= 0 ? opts.canny_high : 100;
+    int thresh_l = opts.canny_low >= 0 ? opts.canny_low : 50;
+    cv::namedWindow("Image", cv::WINDOW_NORMAL);
+    cv::createTrackbar("Threshold High", "Image", &thresh_h, 255);
+    cv::createTrackbar("Threshold Low", "Image", &thresh_l, 255);
+    ctx.verbose = false;
+    while (true)
+    {
+        ctx.otsu.pin(thresh_h);
+        ctx.cannyLow = thresh_l;
+        cv::imshow("Image", run_detector(mode, img, ctx, opts));
+        if (cv::waitKey(1) == 27) // wait to press 'esc' key
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Runs the selected mode on every frame of a video. Unless --serial is given, decoding, processing and
+ * presenting run on three threads so that their times overlap. Y4M files and streams of PGM/PPM images are read by
+ * RawFrameReader, without decoding
+ *
+ * @param mode Execution mode
+ * @param filename Video filename, or "-" for stdin
+ * @param ctx Pipeline context, reused across frames
+ * @param opts Command line options
+ * @param writer Output writer, or nullptr
+ */
+void handle_video(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts, FrameWriter *writer)
+{
+    const bool raw = is_raw_input(filename);
+    cv::VideoCapture cap;
+    RawFrameReader raw_reader;
+    if (raw ? !raw_reader.open(filename) : !cap.open(filename))
+    {
+        std::cerr << "Error: Unable to load video." << std::endl;
+        return;
+    }
+    if (writer)
+    {
+        writer->setFps(raw ? raw_reader.fps() : cap.get(cv::CAP_PROP_FPS));
+    }
+    FrameSource decode = [&](cv::Mat &frame)
+    {
+        return raw ? raw_reader.read(frame) : cap.read(frame);
+    };
+    // raw frames go to the detector as read, only the corner detectors need them expanded to RGB (into rgb_buffer,
+    // which only the processing thread uses)
+    cv::Mat rgb_buffer;
+    auto process = [&](cv::Mat &frame)
+    {
+        if (!raw)
+            return process_frame(mode, frame, ctx, opts);
+        cv::Mat img = raw_reader.image(frame, draws_on_input(mode), rgb_buffer);
+        return process_frame(mode, img, ctx, opts, false);
+    };
+    if (!opts.serial)
+    {
+        runVideoPipeline(
+            decode, [&](cv::Mat &frame, cv::Mat &result)
+            {
+                ScopedStageTimer frame_timer(STAGE_FRAME);
+                // the detector output lives in ctx, which the next frame overwrites
+                process(frame).copyTo(result); },
+            [&](cv::Mat &result)
+            {
+                present_frame(result, opts, writer);
+                return opts.headless || cv::waitKey(1) != 27; });
+        return;
+    }
+
+    cv::Mat img;
+    while (true)
+    {
+        bool ok;
+        {
+            ScopedStageTimer timer(STAGE_DECODE);
+            ok = decode(img);
+        }
+        if (!ok || img.empty())
+        {
+            break;
+        }
+        {
+            ScopedStageTimer frame_timer(STAGE_FRAME);
+            // ctx keeps its buffers from one frame to the next
+            cv::Mat out = process(img);
+            present_frame(out, opts, writer);
+        }
+
+        if (!opts.headless && cv::waitKey(1) == 27)
+        {
+            break;
+        }
+    }
+}
+/**
+ * @brief Runs the selected mode on many images in one process. Every worker of a work-stealing pool has its own
+ * pipeline context and takes one image per task through decode, detector and encode, so the workers overlap the three
+ * stages of different images. Detectors run single-threaded inside a task. Prints the throughput and the per-image
+ * latency at the end
+ *
+ * @param mode Execution mode
+ * @param files Image paths
+ * @param ctx Configured context, whose kernels and settings are copied into the workers' contexts
+ * @param opts Command line options. -t is the number of workers
+ */
+void handle_batch(enum Mode mode, const std::vector<std::string> &files, PipelineContext &ctx, const Options &opts)
+{
+    const int workers = opts.num_threads > 0 ? opts.num_threads : std::max(1u, std::thread::hardware_concurrency());
+    setNumThreadsCPU(1);
+    std::vector<std::unique_ptr<PipelineContext>> contexts;
+    for (int w = 0; w < workers; w++)
+    {
+        contexts.emplace_back(new PipelineContext(ctx.gaussian.kernel.data(), ctx.gaussian.size, ctx.sobelX.kernel.data(), ctx.sobelY.kernel.data()));
+        configure_context(*contexts.back(), mode, opts);
+        contexts.back()->verbose = false;
+    }
+    // results are only written, never shown
+    Options batch_opts = opts;
+    batch_opts.headless = true;
+
+    // the directory is created here, before the workers race to create it
+    FrameWriter probe;
+    if (opts.out != "" && !probe.open(opts.out, files[0], false))
+        return;
+    int renamed = 0;
+    const std::vector<std::string> names = batchOutputNames(files, renamed);
+    if (opts.out != "" && renamed > 0)
+        printf("%d images share a name with another input and are written under a longer one\n", renamed);
+
+    const int total = (int)files.size();
+    // -1 for the images that failed
+    std::vector<double> latencies(total, -1);
+    std::mutex error_mutex;
+    WorkStealingPool pool(workers);
+    auto start = std::chrono::high_resolution_clock::now();
+    pool.run(total, [&](int worker, int task)
+             {
+        auto image_start = std::chrono::high_resolution_clock::now();
+        cv::Mat img;
+        {
+            ScopedStageTimer timer(STAGE_DECODE);
+            img = cv::imread(files[task], cv::IMREAD_COLOR);
+        }
+        if (img.empty())
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            fprintf(stderr, "Error: Unable to load image %s.\n", files[task].c_str());
+            return;
+        }
+        {
+            ScopedStageTimer frame_timer(STAGE_FRAME);
+            cv::Mat out = process_frame(mode, img, *contexts[worker], batch_opts);
+            FrameWriter writer;
+            if (opts.out != "" && !writer.open(opts.out, names[task], false))
+                return;
+            present_frame(out, batch_opts, opts.out != "" ? &writer : nullptr);
+            if (opts.out != "" && writer.frames() == 0)
+                return;
+        }
+        latencies[task] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - image_start).count(); });
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::vector<double> done;
+    for (double latency : latencies)
+    {
+        if (latency >= 0)
+            done.push_back(latency);
+    }
+    printBatchSummary(done, total - (int)done.size(), seconds, workers, pool.stolen());
+}
+
+/**
+ * @brief Halo of the tiles of --tiled: the combined radius of the stages that read the neighbours of a pixel, so that
+ * the interior of a tile comes out as in a whole-image run
+ *
+ * @param mode Execution mode
+ * @param ctx Configured pipeline context
+ * @return int Halo width in pixels
+ */
+int tile_halo(enum Mode mode, const PipelineContext &ctx)
+{
+    const int filters = ctx.gaussian.size / 2 + ctx.sobelX.size / 2;
+    switch (mode)
+    {
+    case HARRIS:
+    case SHI_TOMASI:
+        // structure tensor window, NMS and the 3x3 square painted around a corner
+        return filters + ctx.tensor.windowSize / 2 + 2;
+    case CANNY:
+        // NMS. Edge tracking is done across tiles by TiledHysteresis
+        return filters + 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Runs the selected mode on an image of any size in bounded memory. The image is read, processed and written
+ * one tile at a time, each tile with a halo so that its interior matches a whole-image run. A first pass over the
+ * tiles collects what the detectors need from the whole image: the histogram behind the Otsu threshold of Canny and
+ * Otsu, the largest response of Harris. The last pass runs the detector on every tile with those global values.
+ * Canny makes one more pass in between, which joins the edge components of neighbouring tiles (TiledHysteresis), so
+ * that the last pass keeps the same edges as a whole-image run.
+ *
+ * @param mode Execution mode
+ * @param filename Image filename
+ * @param ctx Pipeline context, sized for one tile
+ * @param opts Command line options. --out is the output image, --tiled the memory budget
+ * @return true if the whole image was written
+ */
+bool handle_tiled(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    TiledImageReader reader;
+    {
+        ScopedStageTimer timer(STAGE_DECODE);
+        if (!reader.open(filename))
+            return false;
+    }
+    TileGrid grid;
+    // tiles start on the Otsu sampling grid, so that the tile histograms add up to the histogram of the image
+    if (!grid.plan(reader.rows(), reader.cols(), tile_halo(mode, ctx), opts.tiled_budget, ctx.otsu.sampleStep))
+    {
+        fprintf(stderr, "A budget of %zu MB is too small for tiles with a %d pixel halo.\n", opts.tiled_budget >> 20, grid.halo);
+        return false;
+    }
+    const bool corners = mode == HARRIS || mode == SHI_TOMASI;
+    TiledImageWriter writer;
+    if (!writer.open(opts.out, grid.rows, grid.cols, corners ? 3 : 1))
+        return false;
+    printf("%s (%dx%d): %d tiles of %d pixels with a %d pixel halo%s\n", filename.c_str(), grid.cols, grid.rows, grid.count(),
+           grid.tileSize, grid.halo, reader.streamed() ? "" : ", decoded whole");
+    ctx.verbose = false;
+    // the edges are tracked across tiles from the double threshold maps
+    ctx.keepThresholded = true;
+
+    cv::Mat rgb, out8;
+    cv::Rect inner;
+    // reads a tile and sets inner to its interior, relative to the padded tile
+    auto read_tile = [&](int tile)
+    {
+        ScopedStageTimer timer(STAGE_DECODE);
+        const cv::Rect in = grid.interior(tile);
+        const cv::Rect pad = grid.padded(tile);
+        inner = cv::Rect(in.x - pad.x, in.y - pad.y, in.width, in.height);
+        return reader.read(pad, rgb);
+    };
+
+    if (corners)
+    {
+        float max = 0;
+        for (int t = 0; t < grid.count(); t++)
+        {
+            if (!read_tile(t))
+                return false;
+            // both passes must run on the same backends
+            select_backends(ctx, mode, rgb);
+            cornerResponseMapCPU(&rgb, ctx);
+            double tile_max;
+            cv::minMaxLoc(ctx.response(inner), nullptr, &tile_max);
+            max = std::max(max, (float)tile_max);
+        }
+        ctx.cornerReference = max;
+    }
+    else
+    {
+        int hist[256] = {0};
+        int tile_hist[256];
+        int total = 0;
+        for (int t = 0; t < grid.count(); t++)
+        {
+            if (!read_tile(t))
+                return false;
+            select_backends(ctx, mode, rgb);
+            cv::Mat source = otsuSourceCPU(&rgb, ctx, mode == CANNY);
+            ScopedStageTimer timer(STAGE_OTSU);
+            total += histogramCPU(source(inner), tile_hist, ctx.otsu.sampleStep);
+            for (int k = 0; k < 256; k++)
+                hist[k] += tile_hist[k];
+        }
+        ctx.otsu.pin(otsuThresholdFromHistogram(hist, total));
+    }
+
+    // Canny: the double threshold map of every tile, whose components are joined across the tile borders
+    TiledHysteresis hysteresis;
+    if (mode == CANNY)
+    {
+        hysteresis.begin(grid);
+        for (int t = 0; t < grid.count(); t++)
+        {
+            if (!read_tile(t))
+                return false;
+            run_detector(mode, rgb, ctx, opts);
+            ScopedStageTimer timer(STAGE_HYSTERESIS);
+            hysteresis.addTile(t, ctx.thresholded(inner));
+        }
+        ScopedStageTimer timer(STAGE_HYSTERESIS);
+        hysteresis.resolve();
+    }
+
+    bool ok = true;
+    for (int t = 0; t < grid.count() && ok; t++)
+    {
+        ok = read_tile(t);
+        if (!ok)
+            break;
+        ScopedStageTimer frame_timer(STAGE_FRAME);
+        // Canny and Otsu return CV_32F maps of 0 and 255, Harris the painted RGB tile
+        cv::Mat out = run_detector(mode, rgb, ctx, opts);
+        if (mode == CANNY)
+        {
+            // the edges of the tile alone are replaced by the ones tracked over the whole image
+            ScopedStageTimer timer(STAGE_HYSTERESIS);
+            hysteresis.finishTile(t, ctx.thresholded(inner), out8);
+        }
+        else
+        {
+            out(inner).convertTo(out8, CV_8U);
+        }
+        ScopedStageTimer output_timer(STAGE_OUTPUT);
+        ok = writer.write(out8, grid.interior(t).tl());
+    }
+    ctx.otsu.reset();
+    ctx.cornerReference = 0;
+    ctx.keepThresholded = false;
+    {
+        ScopedStageTimer timer(STAGE_OUTPUT);
+        ok = writer.close() && ok;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (ok)
+        printf("Tiled CPU time: %ldms, written to %s\n", (long)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), opts.out.c_str());
+    return ok;
+}
+
+/**
+ * @brief Runs the selected mode on one image with 1 to max_threads threads and prints time, speedup and parallel efficiency.
+ * Nothing is displayed, so the numbers only include the detector itself.
+ *
+ * @param mode Execution mode
+ * @param filename Image filename
+ * @param ctx Pipeline context
+ * @param opts Command line options
+ * @param max_threads Highest thread count to measure
+ */
+void scaling_report(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts, int max_threads)
+{
+    const int repetitions = 5;
+    cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR);
+    if (img.empty())
+    {
+        std::cerr << "Error: Unable to load image." << std::endl;
+        return;
+    }
+    cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+
+    double base_ms = 0;
+    printf("Scaling report on %s (%dx%d), best of %d runs, %s kernels\n", filename.c_str(), img.cols, img.rows, repetitions, cpuIsaName((CpuIsa)cpuIsa.load()));
+    printf("%8s %12s %10s %12s\n", "threads", "time[ms]", "speedup", "efficiency");
+    for (int threads = 1; threads <= max_threads; threads++)
+    {
+        setNumThreadsCPU(threads);
+        double best_ms = 1e30;
+        for (int r = 0; r < repetitions; r++)
+        {
+            cv::Mat input = img.clone();
+            // every run computes its own threshold
+            ctx.otsu.reset();
+            auto start = std::chrono::high_resolution_clock::now();
+            run_detector(mode, input, ctx, opts);
+            auto end = std::chrono::high_resolution_clock::now();
+            best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        if (threads == 1)
+        {
+            base_ms = best_ms;
+        }
+        printf("%8d %12.2f %10.2f %11.0f%%\n", threads, best_ms, base_ms / best_ms, 100.0 * base_ms / best_ms / threads);
+    }
+}
+/**
+ * @brief Runs the float and the fixed-point version of the selected mode on one image and prints how many output pixels
+ * differ, the number of foreground pixels of each and their best time.
+ *
+ * @param mode Execution mode, CANNY or OTSU_BIN
+ * @param filename Image filename
+ * @param ctx Pipeline context
+ * @param opts Command line options
+ */
+void validate_report(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts)
+{
+    const int repetitions = 5;
+    cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR);
+    if (img.empty())
+    {
+        std::cerr << "Error: Unable to load image." << std::endl;
+        return;
+    }
+    cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+
+    Options float_opts = opts;
+    float_opts.fixed_point = false;
+    float_opts.streaming = false;
+    Options fixed_opts = opts;
+    fixed_opts.fixed_point = true;
+
+    cv::Mat results[2];
+    double best_ms[2] = {1e30, 1e30};
+    for (int variant = 0; variant < 2; variant++)
+    {
+        for (int r = 0; r < repetitions; r++)
+        {
+            cv::Mat input = img.clone();
+            ctx.otsu.reset();
+            auto start = std::chrono::high_resolution_clock::now();
+            cv::Mat out = run_detector(mode, input, ctx, variant == 0 ? float_opts : fixed_opts);
+            auto end = std::chrono::high_resolution_clock::now();
+            best_ms[variant] = std::min(best_ms[variant], std::chrono::duration<double, std::milli>(end - start).count());
+            // the output lives in the context
+            out.convertTo(results[variant], CV_8U);
+        }
+    }
+
+    long differ = 0;
+    long foreground[2] = {0, 0};
+    for (int i = 0; i < img.rows; i++)
+    {
+        const uchar *a = results[0].ptr<uchar>(i);
+        const uchar *b = results[1].ptr<uchar>(i);
+        for (int j = 0; j < img.cols; j++)
+        {
+            differ += a[j] != b[j];
+            foreground[0] += a[j] != 0;
+            foreground[1] += b[j] != 0;
+        }
+    }
+    const double total = (double)img.rows * img.cols;
+    printf("Validation on %s (%dx%d), best of %d runs\n", filename.c_str(), img.cols, img.rows, repetitions);
+    printf("%8s %12s %12s\n", "", "float", "fixed");
+    printf("%8s %12.2f %12.2f\n", "time[ms]", best_ms[0], best_ms[1]);
+    printf("%8s %12ld %12ld\n", "pixels", foreground[0], foreground[1]);
+    printf("Differing pixels: %ld (%.3f%%), speedup %.2f\n", differ, 100.0 * differ / total, best_ms[0] / best_ms[1]);
+}
+
+/**
+ * @brief -validate with -tiles: runs the incremental Canny on the image, then on a copy with a block brightened so that
+ * only the tiles around it are recomputed, and compares the edges of both frames with a whole-frame Canny of them.
+ * -l and -h keep the threshold from moving, so the second frame goes through the dirty-tile NMS and hysteresis
+ *
+ * @param mode Execution mode, CANNY
+ * @param filename Image filename
+ * @param ctx Pipeline context, configured with -tiles
+ * @param opts Command line options
+ * @return true if the edges are the same
+ */
+bool validate_tiles_report(enum Mode mode, std::string filename, PipelineContext &ctx, const Options &opts)
+{
+    cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR);
+    if (img.empty())
+    {
+        std::cerr << "Error: Unable to load image." << std::endl;
+        return false;
+    }
+    cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+    cv::Mat changed = img.clone();
+    changed(cv::Rect(img.cols / 4, img.rows / 4, img.cols / 4, img.rows / 4)) += cv::Scalar(40, 40, 40);
+
+    Options whole_opts = opts;
+    whole_opts.tile_size = 0;
+    PipelineContext whole(ctx.gaussian.kernel.data(), ctx.gaussian.size, ctx.sobelX.kernel.data(), ctx.sobelY.kernel.data());
+    configure_context(whole, mode, whole_opts);
+    whole.verbose = false;
+    ctx.verbose = false;
+
+    printf("Validation of -tiles on %s (%dx%d)\n", filename.c_str(), img.cols, img.rows);
+    const cv::Mat frames[2] = {img, changed};
+    bool same = true;
+    for (int f = 0; f < 2; f++)
+    {
+        cv::Mat input = frames[f].clone();
+        cv::Mat tiled, reference;
+        run_detector(mode, input, ctx, opts).convertTo(tiled, CV_8U);
+        input = frames[f].clone();
+        run_detector(mode, input, whole, whole_opts).convertTo(reference, CV_8U);
+        const int differ = cv::countNonZero(tiled != reference);
+        printf("Frame %d: %.1f%% of the tiles recomputed, %d differing pixels\n", f, 100.0f * ctx.tiles.lastFraction(), differ);
+        same = same && differ == 0;
+    }
+    return same;
+}
+/**
+ * @brief Deterministic RGB test image with edges, corners and texture at every scale: a checkerboard of 32 pixel
+ * blocks over a slow gradient, a ring pattern and some noise
+ *
+ * @param width Width
+ * @param height Height
+ * @return cv::Mat CV_8UC3 image
+ */
+cv::Mat synthetic_image(int width, int height)
+{
+    cv::Mat img(height, width, CV_8UC3);
+    uint32_t seed = 12345;
+    for (int y = 0; y < height; y++)
+    {
+        cv::Vec3b *row = img.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < width; x++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            const int dx = x - width / 2, dy = y - height / 2;
+            const int checker = ((x >> 5) ^ (y >> 5)) & 1 ? 70 : 0;
+            const int ring = ((dx * dx + dy * dy) >> 12) & 1 ? 40 : 0;
+            const int base = 40 + checker + ring + (x + y) * 60 / (width + height) + (int)(seed >> 28);
+            row[x] = cv::Vec3b((uchar)base, (uchar)(base + 20), (uchar)(base + 10));
+        }
+    }
+    return img;
+}
+
+/**
+ * @brief Bytes per pixel a stage has to read and write at least once, for the GB/s column. 0 if not meaningful
+ */
+double stage_bytes_per_pixel(int stage)
+{
+    switch (stage)
+    {
+    case STAGE_GRAY:
+        // RGB in, float out
+        return 3 + 4;
+    case STAGE_BLUR:
+        return 4 + 4;
+    case STAGE_SOBEL:
+        // one image in, both gradients out
+        return 4 + 8;
+    case STAGE_GRADIENT:
+        // both gradients in, magnitude and sector out
+        return 8 + 5;
+    case STAGE_NMS:
+        // magnitude and sector in, thresholded map out (Canny); response map in (corners)
+        return 4 + 5;
+    case STAGE_THRESHOLD:
+    case STAGE_HYSTERESIS:
+        return 4 + 4;
+    case STAGE_OTSU:
+        return 4;
+    case STAGE_RESPONSE:
+        return 8 + 4;
+    case STAGE_FRAME:
+        // RGB in, float map out
+        return 3 + 4;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Times the -C, -H and -O modes and each of their stages on the synthetic VGA, 1080p, 4K and 8K images and on
+ * the given images. For every input, mode and stage it prints the mean time, its standard deviation over the runs,
+ * ns per pixel and GB/s (see stage_bytes_per_pixel), and appends the same rows to a CSV file.
+ * Stage times come from the stage timers of the pipelines, so they are the stages as they run in the detector.
+ *
+ * @param files Images to benchmark after the synthetic ones
+ * @param ctx Configured pipeline context, whose kernels and settings are copied for each mode
+ * @param opts Command line options, -t is the thread count
+ * @return false if the CSV file cannot be written
+ */
+bool bench_report(const std::vector<std::string> &files, PipelineContext &ctx, const Options &opts)
+{
+    const int repetitions = 10;
+    const enum Mode modes[] = {CANNY, HARRIS, OTSU_BIN};
+    const char *mode_names[] = {"C", "H", "O"};
+    struct Input
+    {
+        std::string name;
+        int width, height;
+        std::string file;
+    };
+    std::vector<Input> inputs = {{"vga", 640, 480, ""}, {"1080p", 1920, 1080, ""}, {"4k", 3840, 2160, ""}, {"8k", 7680, 4320, ""}};
+    for (const std::string &file : files)
+        inputs.push_back({file, 0, 0, file});
+
+    FILE *csv = nullptr;
+    if (opts.bench_out != "")
+    {
+        csv = fopen(opts.bench_out.c_str(), "w");
+        if (!csv)
+        {
+            fprintf(stderr, "Error: Unable to write %s\n", opts.bench_out.c_str());
+            return false;
+        }
+        fprintf(csv, "input,width,height,mode,stage,threads,isa,runs,mean_ms,stddev_ms,min_ms,ns_per_pixel,gb_per_s\n");
+    }
+    const char *isa = cpuIsaName((CpuIsa)cpuIsa.load());
+    printf("Benchmark, %d runs per case after a warm-up run, %d threads, %s kernels\n", repetitions, getNumThreadsCPU(), isa);
+    printf("%-16s %5s %-11s %10s %10s %10s %8s\n", "input", "mode", "stage", "mean[ms]", "stddev", "ns/pixel", "GB/s");
+
+    setStageTiming(true);
+    for (const Input &input : inputs)
+    {
+        cv::Mat img;
+        if (input.file == "")
+        {
+            img = synthetic_image(input.width, input.height);
+        }
+        else
+        {
+            img = cv::imread(input.file, cv::IMREAD_COLOR);
+            if (img.empty())
+            {
+                fprintf(stderr, "Error: Unable to load image %s.\n", input.file.c_str());
+                continue;
+            }
+            cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+        }
+        const double pixels = (double)img.rows * img.cols;
+
+        for (int m = 0; m < 3; m++)
+        {
+            PipelineContext bench_ctx(ctx.gaussian.kernel.data(), ctx.gaussian.size, ctx.sobelX.kernel.data(), ctx.sobelY.kernel.data());
+            configure_context(bench_ctx, modes[m], opts);
+            bench_ctx.verbose = false;
+
+            // per run and per stage, STAGE_FRAME holds the whole detector
+            std::vector<std::vector<double>> ms(STAGE_COUNT);
+            for (int r = -1; r < repetitions; r++)
+            {
+                cv::Mat frame = img.clone();
+                // every run computes its own threshold
+                bench_ctx.otsu.reset();
+                clearStageSamples();
+                int64_t start = stageClockNs();
+                run_detector(modes[m], frame, bench_ctx, opts);
+                int64_t duration = stageClockNs() - start;
+                if (r < 0)
+                    continue;
+                int64_t totals[STAGE_COUNT];
+                stageTotals(totals);
+                totals[STAGE_FRAME] = duration;
+                for (int s = 0; s < STAGE_COUNT; s++)
+                {
+                    if (totals[s] > 0)
+                        ms[s].push_back(totals[s] / 1e6);
+                }
+            }
+
+            for (int s = 0; s < STAGE_COUNT; s++)
+            {
+                const std::vector<double> &v = ms[s];
+                if (v.empty())
+                    continue;
+                double sum = 0, min = v[0];
+                for (double t : v)
+                {
+                    sum += t;
+                    min = std::min(min, t);
+                }
+                const double mean = sum / v.size();
+                double variance = 0;
+                for (double t : v)
+                    variance += (t - mean) * (t - mean);
+                const double stddev = std::sqrt(variance / v.size());
+                const double ns_per_pixel = mean * 1e6 / pixels;
+                const double gb_per_s = stage_bytes_per_pixel(s) / ns_per_pixel;
+                const char *stage = s == STAGE_FRAME ? "total" : stageName((Stage)s);
+                printf("%-16.16s %5s %-11s %10.3f %10.3f %10.3f %8.2f\n", input.name.c_str(), mode_names[m], stage, mean, stddev, ns_per_pixel, gb_per_s);
+                if (csv)
+                    fprintf(csv, "%s,%d,%d,%s,%s,%d,%s,%zu,%.4f,%.4f,%.4f,%.4f,%.3f\n", input.name.c_str(), img.cols, img.rows, mode_names[m], stage,
+                            getNumThreadsCPU(), isa, v.size(), mean, stddev, min, ns_per_pixel, gb_per_s);
+            }
+        }
+    }
+    setStageTiming(false);
+    if (csv)
+    {
+        fclose(csv);
+        printf("Results written to %s\n", opts.bench_out.c_str());
+    }
+    return true;
+}
+/**
+ * @brief Command line driver of main_cpu and main. Both builds take the same options and run the same pipelines,
+ * only the default backend differs
+ *
+ * @param argc Argument count
+ * @param argv Arguments
+ * @param defaultBackend Backend when --backend is not given, cpu if it is not available
+ * @return int Exit code
+ */
+int runDriver(int argc, const char **argv, const std::string &defaultBackend)
+{
+    enum Mode mode;
+    bool is_video = false;
+    // -f= is a directory, a glob pattern or a list file
+    bool is_batch = false;
+    cv::Mat img;
+#pragma region Arguments Parsing
+    if (argc < 3)
+    {
+        fprintf(stderr, "Not enough arguments, at least 3 are required. Usage: %s [-H | -C | -O | -S | -OP] -f=filename\n", argv[0]);
+        return -1;
+    }
+    if (strcmp(argv[1], "-H") == 0)
+    {
+        mode = HARRIS;
+    }
+    else if (strcmp(argv[1], "-C") == 0)
+    {
+        mode = CANNY;
+    }
+    else if (strcmp(argv[1], "-O") == 0)
+    {
+        mode = OTSU_BIN;
+    }
+    else if (strcmp(argv[1], "-S") == 0)
+    {
+        mode = SHI_TOMASI;
+    }
+    else if (strcmp(argv[1], "-OP") == 0)
+    {
+        mode = MOTION;
+    }
+    else
+    {
+        fprintf(stderr, "No execution mode specified. Usage: %s [-H | -C | -O | -S | -OP] -f=filename\n", argv[0]);
+        return -1;
+    }
+
+    std::string filename = "";
+    std::string arg = argv[2];
+    if (arg.substr(0, 3) == "-f=")
+    {
+        filename = arg.substr(3);
+        if (filename == "")
+        {
+            fprintf(stderr, "Empty filename. Usage: %s [-H | -C | -O | -S | -OP] -f=filename\n", argv[0]);
+            return -1;
+        }
+
+        std::string ext = filename.substr(filename.find_last_of(".") + 1);
+        if (filename != "-" && isBatchInput(filename))
+        {
+            is_batch = true;
+        }
+        else if (filename != "-" && ext != "jpg" && ext != "png" && ext != "ppm" && ext != "pgm" && ext != "mp4" && ext != "y4m")
+        {
+            fprintf(stderr, "Invalid file extension. Only jpg, png, ppm, pgm, mp4 and y4m are supported, or - for a Y4M or PGM/PPM stream on stdin, or a directory, a glob pattern or a .txt list of images. Usage: %s [-H | -C | -O | -S | -OP] -f=filename\n", argv[0]);
+            return -1;
+        }
+        if (ext == "mp4" || ext == "y4m" || filename == "-")
+        {
+            is_video = true;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "No file specified. Usage: %s [-H | -C | -O | -S | -OP] -f=filename\n", argv[0]);
+        return -1;
+    }
+
+    // optional arguments
+    Options opts;
+    opts.backend = defaultBackend;
+    bool backend_given = false;
+    for (int i = 3; i < argc; i++)
+    {
+        std::string opt = argv[i];
+        if (opt.substr(0, 3) == "-t=")
+        {
+            try
+            {
+                opts.num_threads = std::stoi(opt.substr(3));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid thread count. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [-t=threads] [-scaling] [-stream] [-fixed] [-validate] [-bench[=file.csv]] [-otsu-step=n] [-otsu-tol=distance] [-otsu-local=pixels] [-otsu-classes=k] [-window=none|box|gaussian] [-window-size=n] [-k=k] [-max-corners=n] [-min-distance=pixels] [-levels=n] [-tiles=n] [-tile-diff=d] [-l=low] [-h=high] [-g] [-f2=filename] [-search=pixels] [-max-hamming=bits] [--tiled[=MB]] [--backend=scalar|cpu|cuda|auto] [--isa=baseline|sse4.2|avx2|avx512] [--serial] [--headless] [--out=dir|file] [--profile] [--trace=file]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt == "-scaling")
+        {
+            opts.scaling = true;
+        }
+        else if (opt == "-stream")
+        {
+            opts.streaming = true;
+        }
+        else if (opt == "-fixed")
+        {
+            opts.fixed_point = true;
+        }
+        else if (opt == "-validate")
+        {
+            opts.validate = true;
+        }
+        else if (opt == "-bench" || opt.substr(0, 7) == "-bench=")
+        {
+            opts.bench = true;
+            opts.bench_out = opt.size() > 7 ? opt.substr(7) : "";
+        }
+        else if (opt.substr(0, 11) == "-otsu-step=")
+        {
+            try
+            {
+                opts.otsu_step = std::max(1, std::stoi(opt.substr(11)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid Otsu sampling step. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [-otsu-step=n]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 10) == "-otsu-tol=")
+        {
+            try
+            {
+                opts.otsu_tolerance = std::stof(opt.substr(10));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid Otsu tolerance. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [-otsu-tol=distance]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 12) == "-otsu-local=")
+        {
+            try
+            {
+                opts.otsu_local = std::max(0, std::stoi(opt.substr(12)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid Otsu tile size. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [-otsu-local=pixels]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 14) == "-otsu-classes=")
+        {
+            try
+            {
+                opts.otsu_classes = std::stoi(opt.substr(14));
+            }
+            catch (const std::exception &e)
+            {
+                opts.otsu_classes = 0;
+            }
+            if (opts.otsu_classes < 2 || opts.otsu_classes > MAX_OTSU_CLASSES)
+            {
+                fprintf(stderr, "Invalid number of Otsu classes, 2 to %d. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [-otsu-classes=k]\n", MAX_OTSU_CLASSES, argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 8) == "-window=")
+        {
+            std::string window = opt.substr(8);
+            if (window == "none")
+                opts.window = TENSOR_WINDOW_NONE;
+            else if (window == "box")
+                opts.window = TENSOR_WINDOW_BOX;
+            else if (window == "gaussian")
+                opts.window = TENSOR_WINDOW_GAUSSIAN;
+            else
+            {
+                fprintf(stderr, "Invalid window. Usage: %s [-H | -S] -f=filename [-window=none|box|gaussian]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 13) == "-window-size=")
+        {
+            try
+            {
+                opts.window_size = std::max(0, std::stoi(opt.substr(13)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid window size. Usage: %s [-H | -S] -f=filename [-window-size=n]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 3) == "-k=")
+        {
+            try
+            {
+                opts.harris_k = std::stof(opt.substr(3));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid Harris k. Usage: %s -H -f=filename [-k=k]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 13) == "-max-corners=")
+        {
+            try
+            {
+                opts.max_corners = std::max(0, std::stoi(opt.substr(13)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid corner count. Usage: %s [-H | -S] -f=filename [-max-corners=n]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 14) == "-min-distance=")
+        {
+            try
+            {
+                opts.min_distance = std::max(0.0f, std::stof(opt.substr(14)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid corner distance. Usage: %s [-H | -S] -f=filename [-min-distance=pixels]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 8) == "-levels=")
+        {
+            try
+            {
+                opts.levels = std::max(1, std::stoi(opt.substr(8)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid pyramid level count. Usage: %s [-H | -C | -S] -f=filename [-levels=n]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 7) == "-tiles=")
+        {
+            try
+            {
+                opts.tile_size = std::max(0, std::stoi(opt.substr(7)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid tile size. Usage: %s -C -f=filename [-tiles=n]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 11) == "-tile-diff=")
+        {
+            try
+            {
+                opts.tile_diff = std::stof(opt.substr(11));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid tile difference. Usage: %s -C -f=filename [-tiles=n] [-tile-diff=d]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 3) == "-l=" || opt.substr(0, 3) == "-h=")
+        {
+            int &threshold = opt[1] == 'l' ? opts.canny_low : opts.canny_high;
+            try
+            {
+                threshold = std::stoi(opt.substr(3));
+            }
+            catch (const std::exception &e)
+            {
+                threshold = -1;
+            }
+            if (threshold < 0)
+            {
+                fprintf(stderr, "Invalid %s threshold. Usage: %s -C -f=filename [-l=low_threshold] [-h=high_threshold]\n", opt[1] == 'l' ? "low" : "high", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt == "-g")
+        {
+            opts.gui = true;
+        }
+        else if (opt.substr(0, 4) == "-f2=")
+        {
+            opts.second_image = opt.substr(4);
+        }
+        else if (opt.substr(0, 8) == "-search=")
+        {
+            try
+            {
+                opts.search_radius = std::max(1, std::stoi(opt.substr(8)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid search radius. Usage: %s -OP -f=filename [-search=pixels]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 13) == "-max-hamming=")
+        {
+            try
+            {
+                opts.max_hamming = std::max(0, std::stoi(opt.substr(13)));
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "Invalid descriptor distance. Usage: %s -OP -f=filename [-max-hamming=bits]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt == "--headless")
+        {
+            opts.headless = true;
+        }
+        else if (opt == "--serial")
+        {
+            opts.serial = true;
+        }
+        else if (opt.substr(0, 6) == "--out=")
+        {
+            opts.out = opt.substr(6);
+        }
+        else if (opt == "--tiled" || opt.substr(0, 8) == "--tiled=")
+        {
+            // default budget of 256 MB
+            size_t megabytes = 256;
+            if (opt.size() > 8)
+            {
+                try
+                {
+                    megabytes = std::stoul(opt.substr(8));
+                }
+                catch (const std::exception &e)
+                {
+                    fprintf(stderr, "Invalid memory budget. Usage: %s [-H | -C | -O | -S | -OP] -f=filename --tiled[=MB] --out=file\n", argv[0]);
+                    return -1;
+                }
+            }
+            opts.tiled_budget = megabytes << 20;
+        }
+        else if (opt.substr(0, 10) == "--backend=")
+        {
+            opts.backend = opt.substr(10);
+            backend_given = true;
+            if (opts.backend != "auto" && !getBackend(opts.backend))
+            {
+                if (opts.backend == "cuda")
+                    fprintf(stderr, "The CUDA backend needs a CUDA build (make, or make CPU=1 CUDA_BACKEND=1) and a CUDA device.\n");
+                else
+                    fprintf(stderr, "Invalid backend. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [--backend=scalar|cpu|cuda|auto]\n", argv[0]);
+                return -1;
+            }
+        }
+        else if (opt.substr(0, 6) == "--isa=")
+        {
+            CpuIsa isa;
+            if (!parseCpuIsa(opt.substr(6), isa))
+            {
+                fprintf(stderr, "Invalid ISA. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [--isa=baseline|sse4.2|avx2|avx512]\n", argv[0]);
+                return -1;
+            }
+            if (!setCpuIsa(isa))
+            {
+                fprintf(stderr, "This CPU does not support %s, the widest supported ISA is %s.\n", cpuIsaName(isa), cpuIsaName(detectedCpuIsa()));
+                return -1;
+            }
+        }
+        else if (opt == "--profile")
+        {
+            opts.profile = true;
+        }
+        else if (opt.substr(0, 8) == "--trace=")
+        {
+            opts.trace = opt.substr(8);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s will be ignored. Usage: %s [-H | -C | -O | -S | -OP] -f=filename [-t=threads] [-scaling] [-stream] [-fixed] [-validate] [-bench[=file.csv]] [-otsu-step=n] [-otsu-tol=distance] [-otsu-local=pixels] [-otsu-classes=k] [-window=none|box|gaussian] [-window-size=n] [-k=k] [-max-corners=n] [-min-distance=pixels] [-levels=n] [-tiles=n] [-tile-diff=d] [-l=low] [-h=high] [-g] [-f2=filename] [-search=pixels] [-max-hamming=bits] [--tiled[=MB]] [--backend=scalar|cpu|cuda|auto] [--isa=baseline|sse4.2|avx2|avx512] [--serial] [--headless] [--out=dir|file] [--profile] [--trace=file]\n", argv[i], argv[0]);
+        }
+    }
+    if (!backend_given && opts.backend != "auto" && !getBackend(opts.backend))
+    {
+        fprintf(stderr, "No %s device found, running on the cpu backend.\n", opts.backend == "cuda" ? "CUDA" : opts.backend.c_str());
+        opts.backend = "cpu";
+    }
+    if (opts.headless && opts.out == "")
+    {
+        fprintf(stderr, "--headless needs an output. Usage: %s [-H | -C | -O | -S | -OP] -f=filename --headless --out=dir|file\n", argv[0]);
+        return -1;
+    }
+    if ((opts.canny_low >= 0 || opts.canny_high >= 0 || opts.gui) && (mode != CANNY || opts.tiled_budget > 0))
+    {
+        fprintf(stderr, "-l, -h and -g only apply to -C, and cannot be combined with --tiled.\n");
+        return -1;
+    }
+    if (opts.gui && (is_video || is_batch || opts.headless || opts.scaling || opts.validate || opts.bench))
+    {
+        fprintf(stderr, "-g takes a single image and a window. Usage: %s -C -f=filename -g\n", argv[0]);
+        return -1;
+    }
+    if (opts.streaming && opts.fixed_point)
+    {
+        fprintf(stderr, "-stream and -fixed cannot be combined.\n");
+        return -1;
+    }
+    if (opts.levels > 1 && (opts.streaming || opts.fixed_point))
+    {
+        fprintf(stderr, "-levels cannot be combined with -stream or -fixed.\n");
+        return -1;
+    }
+    if (opts.tile_size > 0 && (opts.streaming || opts.fixed_point || opts.levels > 1))
+    {
+        fprintf(stderr, "-tiles cannot be combined with -stream, -fixed or -levels.\n");
+        return -1;
+    }
+    if (opts.otsu_local > 0 && (mode != OTSU_BIN || opts.fixed_point || opts.tiled_budget > 0))
+    {
+        fprintf(stderr, "-otsu-local only applies to -O, and cannot be combined with -fixed or --tiled.\n");
+        return -1;
+    }
+    if (opts.otsu_classes > 2 && (mode != OTSU_BIN || opts.fixed_point || opts.otsu_local > 0 || opts.tiled_budget > 0))
+    {
+        fprintf(stderr, "-otsu-classes only applies to -O, and cannot be combined with -fixed, -otsu-local or --tiled.\n");
+        return -1;
+    }
+    if (mode == MOTION)
+    {
+        if (is_batch || opts.tiled_budget > 0 || opts.validate)
+        {
+            fprintf(stderr, "-OP takes a video or two images.\n");
+            return -1;
+        }
+        if (!is_video && opts.second_image == "")
+        {
+            fprintf(stderr, "-OP on images needs a second image. Usage: %s -OP -f=filename -f2=filename2\n", argv[0]);
+            return -1;
+        }
+        if (opts.streaming || opts.fixed_point || opts.levels > 1 || opts.tile_size > 0)
+        {
+            fprintf(stderr, "-OP cannot be combined with -stream, -fixed, -levels or -tiles.\n");
+            return -1;
+        }
+    }
+    if (opts.tiled_budget > 0)
+    {
+        if (is_video || is_batch || opts.scaling || opts.validate)
+        {
+            fprintf(stderr, "--tiled takes a single image.\n");
+            return -1;
+        }
+        if (opts.streaming || opts.fixed_point || opts.levels > 1 || opts.tile_size > 0 || opts.max_corners > 0 || opts.min_distance > 0)
+        {
+            fprintf(stderr, "--tiled cannot be combined with -stream, -fixed, -levels, -tiles, -max-corners or -min-distance.\n");
+            return -1;
+        }
+        // tiles are written as they come, never shown
+        if (opts.out == "" || opts.out.back() == '/' || opts.out.substr(opts.out.find_last_of('/') + 1).find('.') == std::string::npos)
+        {
+            fprintf(stderr, "--tiled needs an image file as output. Usage: %s [-H | -C | -O | -S | -OP] -f=filename --tiled[=MB] --out=file\n", argv[0]);
+            return -1;
+        }
+    }
+#pragma endregion
+
+#pragma region driver code
+    // kernels are copied into the context, which then owns every buffer of the pipeline
+    PipelineContext ctx(gaussian_kernel.values, FILTER_WIDTH, sobel_x_kernel.values, sobel_y_kernel.values);
+    configure_context(ctx, mode, opts);
+    if (opts.bench)
+    {
+        if (is_video)
+        {
+            fprintf(stderr, "The benchmark takes images, a directory, a glob pattern or a list of images.\n");
+            return -1;
+        }
+        setNumThreadsCPU(opts.num_threads);
+        return bench_report(is_batch ? listBatchInputs(filename) : std::vector<std::string>{filename}, ctx, opts) ? 0 : -1;
+    }
+    if (is_batch)
+    {
+        if (opts.scaling || opts.validate)
+        {
+            fprintf(stderr, "-scaling and -validate take a single image.\n");
+            return -1;
+        }
+        // every image is written as <dir>/<input name>.png
+        if (opts.out.substr(opts.out.find_last_of('/') + 1).find('.') != std::string::npos)
+        {
+            fprintf(stderr, "With several inputs, --out must be a directory.\n");
+            return -1;
+        }
+        std::vector<std::string> files = listBatchInputs(filename);
+        if (files.empty())
+        {
+            fprintf(stderr, "No image found in %s.\n", filename.c_str());
+            return -1;
+        }
+        setStageTiming(opts.profile || opts.trace != "");
+        handle_batch(mode, files, ctx, opts);
+        if (opts.profile)
+        {
+            printStageSummary();
+        }
+        if (opts.trace != "")
+        {
+            writeChromeTrace(opts.trace);
+        }
+        return 0;
+    }
+    if (opts.tiled_budget > 0)
+    {
+        setNumThreadsCPU(opts.num_threads);
+        setStageTiming(opts.profile || opts.trace != "");
+        const bool ok = handle_tiled(mode, filename, ctx, opts);
+        if (opts.profile)
+        {
+            printStageSummary();
+        }
+        if (opts.trace != "")
+        {
+            writeChromeTrace(opts.trace);
+        }
+        return ok ? 0 : -1;
+    }
+    if (opts.scaling)
+    {
+        if (is_video)
+        {
+            fprintf(stderr, "The scaling report is only available for images.\n");
+            return -1;
+        }
+        // the report goes up to -t threads, or to all hardware threads if -t is not given
+        scaling_report(mode, filename, ctx, opts, opts.num_threads > 1 ? opts.num_threads : std::max(1u, std::thread::hardware_concurrency()));
+        return 0;
+    }
+    setNumThreadsCPU(opts.num_threads);
+    if (opts.validate)
+    {
+        if (is_video || (mode != CANNY && mode != OTSU_BIN))
+        {
+            fprintf(stderr, "Validation is only available for Canny and Otsu on images.\n");
+            return -1;
+        }
+        if (opts.tile_size > 0)
+        {
+            if (mode != CANNY)
+            {
+                fprintf(stderr, "-tiles only applies to -C.\n");
+                return -1;
+            }
+            // compares -tiles with a whole-frame run instead of the fixed-point pipeline
+            return validate_tiles_report(mode, filename, ctx, opts) ? 0 : -1;
+        }
+        if (!ctx.fixedPoint)
+        {
+            fprintf(stderr, "The kernels have no fixed-point form.\n");
+            return -1;
+        }
+        validate_report(mode, filename, ctx, opts);
+        return 0;
+    }
+    if (opts.gui)
+    {
+        handle_gui(mode, filename, ctx, opts);
+        return 0;
+    }
+    setStageTiming(opts.profile || opts.trace != "");
+    FrameWriter writer;
+    FrameWriter *output = nullptr;
+    if (opts.out != "")
+    {
+        if (!writer.open(opts.out, filename, is_video))
+        {
+            return -1;
+        }
+        output = &writer;
+    }
+    if (is_video)
+    {
+        handle_video(mode, filename, ctx, opts, output);
+        if (opts.otsu_tolerance > 0 && (mode == CANNY || mode == OTSU_BIN))
+        {
+            printf("Otsu threshold recomputed on %d of %d frames\n", ctx.otsu.recomputed, ctx.otsu.frames);
+        }
+        if (mode == CANNY && opts.tile_size > 0 && ctx.tiles.totalTiles > 0)
+        {
+            printf("Tiles recomputed: %.1f%% on average\n", 100.0 * ctx.tiles.recomputedTiles / ctx.tiles.totalTiles);
+        }
+    }
+    else if (mode == MOTION)
+    {
+        // the first image only gives the corners the second one is matched to
+        cv::Mat first = cv::imread(filename, cv::IMREAD_COLOR);
+        if (first.empty())
+        {
+            std::cerr << "Error: Unable to load image." << std::endl;
+            return -1;
+        }
+        process_frame(mode, first, ctx, opts);
+        handle_image(mode, opts.second_image, ctx, opts, output);
+    }
+    else
+    {
+        // measure time
+        handle_image(mode, filename, ctx, opts, output);
+    }
+    if (output)
+    {
+        // prints the throughput
+        output->close();
+    }
+    if (opts.profile)
+    {
+        printStageSummary();
+    }
+    if (opts.trace != "")
+    {
+        writeChromeTrace(opts.trace);
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -1,17 +1,30 @@
+#include <cmath>
 #include <string>
 #include <iostream>
+#include <mutex>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
-#include <cuda_runtime.h>
-#include "../include/cuda_kernel.cuh"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "../include/utils.h"
+#include "../include/cpu_dispatch.h"
+#include "../include/convolution_cpu.h"
+#include "../include/thread_pool.h"
+#include "../include/hysteresis_cpu.h"
+#include "../include/histogram_cpu.h"
+#include "../include/structure_tensor_cpu.h"
+#include "../include/keypoints_cpu.h"
+#include "../include/dirty_tiles_cpu.h"
+#include "../include/pipeline_context.h"
+#include "../include/edge_detection_cpu.h"
+#include "../include/stage_timer.h"
 using namespace std;
 using namespace cv;
 
-// #define MEASURE_TIME
-
 /**
  * @brief Shows an image using OpenCV
  *
@@ -25,107 +38,411 @@ void showImageCPU(cv::Mat img)
     cv::waitKey(0);
 }
 /**
- * @brief Trivial CPU Convolution implementation
+ * @brief Computes the optimal otsu threshold of a given image
+ *
+ * @param image  Input image
+ * @return int Optimal Otsu threshold
+ */
+int otsuThreshold(cv::Mat &image);
+int otsuThreshold(cv::Mat &image)
+{
+    int hist[256];
+    int total = histogramCPU(image, hist);
+    return otsuThresholdFromHistogram(hist, total);
+}
+
+/**
+ * @brief Converts one RGB row to grayscale
  *
- * @param inputImage Input image
- * @param kernel Filter kernel
- * @param kernelSize Kernel size
- * @return cv::Mat Output image
+ * @param in Input RGB row
+ * @param out Output grayscale row
+ * @param cols Row length
  */
-cv::Mat applyConvolutionCPU(const cv::Mat &inputImage, const float *kernel, int kernelSize);
-cv::Mat applyConvolutionCPU(const cv::Mat &inputImage, const float *kernel, int kernelSize)
+ISA_KERNEL void grayRow(const cv::Vec3b *in, float *out, int cols)
 {
-    if (kernelSize % 2 == 0)
+    for (int j = 0; j < cols; j++)
     {
-        std::cerr << "Error: Kernel size must be odd." << std::endl;
-        return cv::Mat();
+        out[j] = 0.299 * float(in[j][0]) + 0.587 * float(in[j][1]) + 0.114 * float(in[j][2]);
     }
-    int pad = kernelSize / 2;
+}
+typedef void (*GrayRowFn)(const cv::Vec3b *, float *, int);
+static const IsaDispatch<GrayRowFn> grayRowIsa = IsaClones<GrayRowFn, grayRow>::table();
 
-    cv::Mat outputImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-#ifdef MEASURE_TIME
-    double start = cv::getTickCount();
-#endif
-    for (int y = pad; y < inputImage.rows - pad; y++)
+/**
+ * @brief Widens one 8-bit grayscale row (PGM, Y4M luma)
+ *
+ * @param in Input grayscale row
+ * @param out Output grayscale row
+ * @param cols Row length
+ */
+static inline void grayRow(const uchar *in, float *out, int cols)
+{
+    for (int j = 0; j < cols; j++)
     {
-        for (int x = pad; x < inputImage.cols - pad; x++)
+        out[j] = float(in[j]);
+    }
+}
+
+/**
+ * @brief Converts an RGB image to a CV_32F grayscale image. Row bands run on the CPU thread pool.
+ *
+ * @param img Input RGB image (CV_8UC3), or an 8-bit grayscale image (CV_8UC1) that is only widened
+ * @param img_gray Output grayscale image, (re)allocated as CV_32F
+ */
+void rgbToGrayCPU(const cv::Mat &img, cv::Mat &img_gray)
+{
+    img_gray.create(img.rows, img.cols, CV_32F);
+    const bool rgb = img.channels() == 3;
+    parallelForRows(img.rows, [&](int rowBegin, int rowEnd)
+                    {
+        for (int i = rowBegin; i < rowEnd; i++)
         {
-            float pixelValue = 0.0;
+            if (rgb)
+                grayRowIsa(img.ptr<cv::Vec3b>(i), img_gray.ptr<float>(i), img.cols);
+            else
+                grayRow(img.ptr<uchar>(i), img_gray.ptr<float>(i), img.cols);
+        } });
+}
 
-            // convolution
-            for (int ky = -pad; ky <= pad; ky++)
-            {
-                for (int kx = -pad; kx <= pad; kx++)
-                {
-                    int kernelIndex = (ky + pad) * kernelSize + (kx + pad);
-                    float kernelValue = kernel[kernelIndex];
+// NMS sectors: the pair of neighbours the magnitude is compared against
+enum NmsSector : uchar
+{
+    // 0 +- 22.5 degrees: left and right
+    SECTOR_0,
+    // 45 +- 22.5 degrees: above right and below left
+    SECTOR_45,
+    // 90 +- 22.5 degrees: above and below
+    SECTOR_90,
+    // 135 +- 22.5 degrees: above left and below right
+    SECTOR_135,
+};
+// tan(22.5) and tan(67.5), the sector boundaries
+const float TAN_22_5 = 0.41421356f;
+const float TAN_67_5 = 2.41421356f;
 
-                    int imageY = y + ky;
-                    int imageX = x + kx;
+/**
+ * @brief Squared magnitude and NMS sector of the gradient for one row.
+ * The sector only depends on the ratio |gy|/|gx| and on whether gx and gy have the same sign, so no atan2 or sqrt is needed.
+ *
+ * @param gx Sobel x row
+ * @param gy Sobel y row
+ * @param mag2 Output squared magnitude row
+ * @param sector Output NmsSector row
+ * @param cols Row length
+ */
+ISA_KERNEL void gradientSectorRow(const float *gx, const float *gy, float *mag2, uchar *sector, int cols)
+{
+    for (int j = 0; j < cols; j++)
+    {
+        float ax = std::fabs(gx[j]);
+        float ay = std::fabs(gy[j]);
+        mag2[j] = gx[j] * gx[j] + gy[j] * gy[j];
+        uchar diagonal = (gx[j] < 0) == (gy[j] < 0) ? SECTOR_45 : SECTOR_135;
+        sector[j] = ay <= TAN_22_5 * ax ? SECTOR_0 : (ay > TAN_67_5 * ax ? SECTOR_90 : diagonal);
+    }
+}
+typedef void (*GradientRowFn)(const float *, const float *, float *, uchar *, int);
+static const IsaDispatch<GradientRowFn> gradientSectorRowIsa = IsaClones<GradientRowFn, gradientSectorRow>::table();
 
-                    pixelValue += inputImage.at<float>(imageY, imageX) * kernelValue;
-                }
-            }
-            outputImage.at<float>(y, x) = float(pixelValue);
+/**
+ * @brief NMS(lowerboud+double thresholding) for one inner row, on squared magnitudes. First and last pixel are set to 0.
+ * The two neighbours of every pixel are picked with selects rather than looked up, so that the loop vectorizes.
+ *
+ * @param above Squared magnitude of the row above
+ * @param center Squared magnitude of the row
+ * @param below Squared magnitude of the row below
+ * @param sector NmsSector of the row
+ * @param out Output row: 255 strong, 128 weak, 0 otherwise
+ * @param cols Row length
+ * @param lowThreshold Low threshold (on the magnitude, not squared)
+ * @param highThreshold High threshold (on the magnitude, not squared)
+ */
+ISA_KERNEL void nmsThresholdRow(const float *above, const float *center, const float *below, const uchar *sector, float *out, int cols, float lowThreshold, float highThreshold)
+{
+    // magnitudes are non-negative, so comparing squares keeps the same result
+    const float low2 = lowThreshold * lowThreshold;
+    const float high2 = highThreshold * highThreshold;
+    out[0] = 0;
+    out[cols - 1] = 0;
+    for (int j = 1; j < cols - 1; j++)
+    {
+        // neighbours of each sector: left and right, above right and below left, above and below, above left and below right
+        const uchar s = sector[j];
+        const float a = s == SECTOR_0 ? center[j + 1] : (s == SECTOR_45 ? above[j + 1] : (s == SECTOR_90 ? above[j] : above[j - 1]));
+        const float b = s == SECTOR_0 ? center[j - 1] : (s == SECTOR_45 ? below[j - 1] : (s == SECTOR_90 ? below[j] : below[j + 1]));
+        const float value = center[j] > a && center[j] > b ? center[j] : 0;
+        // if greater than high_threshold, set to 255
+        // if greater than low_threshold, set to 128
+        // else set to 0
+        out[j] = value > high2 ? 255 : (value > low2 ? 128 : 0);
+    }
+}
+typedef void (*NmsRowFn)(const float *, const float *, const float *, const uchar *, float *, int, float, float);
+static const IsaDispatch<NmsRowFn> nmsThresholdRowIsa = IsaClones<NmsRowFn, nmsThresholdRow>::table();
+
+/***********************
+ *
+ * Fixed-point row helpers
+ *
+ **********************/
+
+/**
+ * @brief Converts one RGB row to 8-bit grayscale with integer luma weights (77, 150, 29)/256, rounded
+ *
+ * @param in Input RGB row
+ * @param out Output grayscale row
+ * @param cols Row length
+ */
+ISA_KERNEL void grayRow(const cv::Vec3b *in, uchar *out, int cols)
+{
+    for (int j = 0; j < cols; j++)
+    {
+        out[j] = (uchar)((77 * in[j][0] + 150 * in[j][1] + 29 * in[j][2] + 128) >> 8);
+    }
+}
+typedef void (*GrayRowFixedFn)(const cv::Vec3b *, uchar *, int);
+static const IsaDispatch<GrayRowFixedFn> grayRowFixedIsa = IsaClones<GrayRowFixedFn, grayRow>::table();
+
+/**
+ * @brief Horizontal Gaussian pass on 8-bit pixels with Q8 taps. The sum of the taps is 256, so the result fits in 16 bits
+ * and is normalized by the vertical pass. The radius-wide columns at both ends are 0, like CONV_BORDER_NONE.
+ *
+ * @param src Input row
+ * @param dst Output row, still scaled by 256
+ * @param cols Row length
+ * @param taps Q8 taps
+ * @param size Number of taps
+ */
+static inline void blurRowFixed(const uchar *src, ushort *dst, int cols, const int *taps, int size)
+{
+    const int r = size / 2;
+    if (cols < size)
+    {
+        std::fill(dst, dst + cols, (ushort)0);
+        return;
+    }
+    std::fill(dst, dst + r, (ushort)0);
+    std::fill(dst + cols - r, dst + cols, (ushort)0);
+    int j = r;
+#ifdef __SSE2__
+    // 8 pixels at a time. The sums fit in 16 unsigned bits, so wrapping 16-bit arithmetic gives the exact result
+    const __m128i zero = _mm_setzero_si128();
+    for (; j + 8 <= cols - r; j += 8)
+    {
+        __m128i sum = zero;
+        for (int k = 0; k < size; k++)
+        {
+            __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + j - r + k)), zero);
+            sum = _mm_add_epi16(sum, _mm_mullo_epi16(pixels, _mm_set1_epi16((short)taps[k])));
         }
+        _mm_storeu_si128((__m128i *)(dst + j), sum);
     }
-#ifdef MEASURE_TIME
-    double end = cv::getTickCount();
-    double time = (end - start) / cv::getTickFrequency();
-    cout << "Convolution CPU time: " << time * 1000 << "ms" << endl;
 #endif
+    for (; j < cols - r; j++)
+    {
+        int sum = 0;
+        for (int k = 0; k < size; k++)
+        {
+            sum += taps[k] * src[j - r + k];
+        }
+        dst[j] = (ushort)sum;
+    }
+}
 
-    return outputImage;
+/**
+ * @brief Vertical Gaussian pass with Q8 taps. Removes both passes' scale with a rounded shift by 16
+ *
+ * @param rows size input rows, top to bottom
+ * @param dst Output 8-bit row
+ * @param cols Row length
+ * @param taps Q8 taps
+ * @param size Number of taps
+ */
+static inline void blurColumnsFixed(const ushort *const *rows, uchar *dst, int cols, const int *taps, int size)
+{
+    int j = 0;
+#ifdef __SSE2__
+    // 8 pixels at a time, with 32-bit products rebuilt from the low and high halves of the 16-bit ones
+    const __m128i rounding = _mm_set1_epi32(1 << 15);
+    for (; j + 8 <= cols; j += 8)
+    {
+        __m128i sumLo = rounding;
+        __m128i sumHi = rounding;
+        for (int k = 0; k < size; k++)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(rows[k] + j));
+            __m128i tap = _mm_set1_epi16((short)taps[k]);
+            __m128i lo = _mm_mullo_epi16(pixels, tap);
+            __m128i hi = _mm_mulhi_epu16(pixels, tap);
+            sumLo = _mm_add_epi32(sumLo, _mm_unpacklo_epi16(lo, hi));
+            sumHi = _mm_add_epi32(sumHi, _mm_unpackhi_epi16(lo, hi));
+        }
+        __m128i words = _mm_packs_epi32(_mm_srli_epi32(sumLo, 16), _mm_srli_epi32(sumHi, 16));
+        _mm_storel_epi64((__m128i *)(dst + j), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; j < cols; j++)
+    {
+        unsigned sum = 1u << 15;
+        for (int k = 0; k < size; k++)
+        {
+            sum += taps[k] * rows[k][j];
+        }
+        dst[j] = (uchar)(sum >> 16);
+    }
 }
 
 /**
- * @brief Computes the optimal otsu threshold of a given image
+ * @brief Sobel x and y of one inner row of an 8-bit image. First and last pixel are set to 0.
  *
- * @param image  Input image
- * @return int Optimal Otsu threshold
+ * @param above Row above
+ * @param center Row
+ * @param below Row below
+ * @param kx Integer 3x3 Sobel x kernel
+ * @param ky Integer 3x3 Sobel y kernel
+ * @param gx Output x gradient row
+ * @param gy Output y gradient row
+ * @param cols Row length
  */
-int otsuThreshold(cv::Mat &image);
-int otsuThreshold(cv::Mat &image)
+static inline void sobelRowFixed(const uchar *above, const uchar *center, const uchar *below, const int *kx, const int *ky, short *gx, short *gy, int cols)
 {
-    int hist[256] = {0};
-    for (int i = 0; i < image.rows; i++)
+    const uchar *window[3] = {above, center, below};
+    gx[0] = gy[0] = 0;
+    gx[cols - 1] = gy[cols - 1] = 0;
+    int j = 1;
+#ifdef __SSE2__
+    // 8 pixels at a time, in 16-bit lanes
+    const __m128i zero = _mm_setzero_si128();
+    for (; j + 8 <= cols - 1; j += 8)
     {
-        for (int j = 0; j < image.cols; j++)
+        __m128i sx = zero;
+        __m128i sy = zero;
+        for (int i = 0; i < 3; i++)
         {
-            hist[(int)image.at<uchar>(i, j)]++;
+            for (int k = 0; k < 3; k++)
+            {
+                __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(window[i] + j - 1 + k)), zero);
+                sx = _mm_add_epi16(sx, _mm_mullo_epi16(pixels, _mm_set1_epi16((short)kx[3 * i + k])));
+                sy = _mm_add_epi16(sy, _mm_mullo_epi16(pixels, _mm_set1_epi16((short)ky[3 * i + k])));
+            }
         }
+        _mm_storeu_si128((__m128i *)(gx + j), sx);
+        _mm_storeu_si128((__m128i *)(gy + j), sy);
     }
-    int total = image.rows * image.cols;
-    float sum = 0;
-    for (int i = 0; i < 256; i++)
+#endif
+    for (; j < cols - 1; j++)
     {
-        sum += i * hist[i];
+        int sx = 0;
+        int sy = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const uchar *p = window[i] + j - 1;
+            sx += kx[3 * i] * p[0] + kx[3 * i + 1] * p[1] + kx[3 * i + 2] * p[2];
+            sy += ky[3 * i] * p[0] + ky[3 * i + 1] * p[1] + ky[3 * i + 2] * p[2];
+        }
+        gx[j] = (short)sx;
+        gy[j] = (short)sy;
     }
-    float sumB = 0;
-    int wB = 0;
-    int wF = 0;
-    float varMax = 0;
-    int threshold = 0;
-    for (int i = 0; i < 256; i++)
+}
+
+// tan(22.5) in Q15. tan(67.5) = 1 / tan(22.5), so both sector boundaries are tested with it by swapping |gx| and |gy|
+const int TAN_22_5_Q15 = 13573;
+
+/**
+ * @brief Squared magnitude and NMS sector of the gradient for one row, in integers.
+ * Gradients of 8-bit pixels are at most 1020 in absolute value, so every product fits in 32 bits.
+ *
+ * @param gx Sobel x row
+ * @param gy Sobel y row
+ * @param mag2 Output squared magnitude row
+ * @param sector Output NmsSector row
+ * @param cols Row length
+ */
+ISA_KERNEL void gradientSectorRow(const short *gx, const short *gy, int *mag2, uchar *sector, int cols)
+{
+    int j = 0;
+#ifdef __SSE2__
+    // 8 pixels at a time: madd of interleaved (gx, gy) pairs gives gx^2 + gy^2, madd with (tan, 0) pairs gives tan * |g|
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i tan = _mm_set1_epi32(TAN_22_5_Q15);
+    const __m128i one = _mm_set1_epi16(1);
+    for (; j + 8 <= cols; j += 8)
     {
-        wB += hist[i];
-        if (wB == 0)
-            continue;
-        wF = total - wB;
-        if (wF == 0)
-            break;
-        sumB += (float)(i * hist[i]);
-        float mB = sumB / wB;
-        float mF = (sum - sumB) / wF;
-        float varBetween = (float)wB * (float)wF * (mB - mF) * (mB - mF);
-        if (varBetween > varMax)
+        __m128i x = _mm_loadu_si128((const __m128i *)(gx + j));
+        __m128i y = _mm_loadu_si128((const __m128i *)(gy + j));
+        __m128i xyLo = _mm_unpacklo_epi16(x, y);
+        __m128i xyHi = _mm_unpackhi_epi16(x, y);
+        _mm_storeu_si128((__m128i *)(mag2 + j), _mm_madd_epi16(xyLo, xyLo));
+        _mm_storeu_si128((__m128i *)(mag2 + j + 4), _mm_madd_epi16(xyHi, xyHi));
+
+        // |v| = (v ^ s) - s with s the sign mask
+        __m128i sx = _mm_srai_epi16(x, 15);
+        __m128i sy = _mm_srai_epi16(y, 15);
+        __m128i ax = _mm_sub_epi16(_mm_xor_si128(x, sx), sx);
+        __m128i ay = _mm_sub_epi16(_mm_xor_si128(y, sy), sy);
+        __m128i masks[2];
+        for (int half = 0; half < 2; half++)
         {
-            varMax = varBetween;
-            threshold = i;
+            __m128i ax32 = half ? _mm_unpackhi_epi16(ax, zero) : _mm_unpacklo_epi16(ax, zero);
+            __m128i ay32 = half ? _mm_unpackhi_epi16(ay, zero) : _mm_unpacklo_epi16(ay, zero);
+            // sector 0: ay << 15 <= tan * ax. sector 90: ax << 15 < tan * ay
+            __m128i not0 = _mm_cmpgt_epi32(_mm_slli_epi32(ay32, 15), _mm_madd_epi16(ax32, tan));
+            __m128i is90 = _mm_cmpgt_epi32(_mm_madd_epi16(ay32, tan), _mm_slli_epi32(ax32, 15));
+            masks[half] = _mm_packs_epi32(not0, is90);
         }
+        // 16-bit masks: not0 in the low lanes of masks[0]/[1], is90 in the high ones
+        __m128i not0 = _mm_unpacklo_epi64(masks[0], masks[1]);
+        __m128i is90 = _mm_unpackhi_epi64(masks[0], masks[1]);
+        // diagonal: SECTOR_45 if gx and gy have the same sign, SECTOR_135 otherwise
+        __m128i diagonal = _mm_add_epi16(one, _mm_and_si128(_mm_xor_si128(sx, sy), _mm_set1_epi16(2)));
+        __m128i value = _mm_or_si128(_mm_and_si128(is90, _mm_set1_epi16(SECTOR_90)), _mm_andnot_si128(is90, diagonal));
+        value = _mm_and_si128(not0, value);
+        _mm_storel_epi64((__m128i *)(sector + j), _mm_packus_epi16(value, value));
+    }
+#endif
+    for (; j < cols; j++)
+    {
+        int ax = std::abs((int)gx[j]);
+        int ay = std::abs((int)gy[j]);
+        mag2[j] = gx[j] * gx[j] + gy[j] * gy[j];
+        uchar diagonal = (gx[j] < 0) == (gy[j] < 0) ? SECTOR_45 : SECTOR_135;
+        sector[j] = (ay << 15) <= TAN_22_5_Q15 * ax ? SECTOR_0 : ((ax << 15) < TAN_22_5_Q15 * ay ? SECTOR_90 : diagonal);
+    }
+}
+typedef void (*GradientRowFixedFn)(const short *, const short *, int *, uchar *, int);
+static const IsaDispatch<GradientRowFixedFn> gradientSectorRowFixedIsa = IsaClones<GradientRowFixedFn, gradientSectorRow>::table();
+
+/**
+ * @brief NMS(lowerboud+double thresholding) for one inner row, on integer squared magnitudes. The thresholds are compared
+ * squared; the low one is rounded down, which gives the same test on integer magnitudes. First and last pixel are set
+ * to 0.
+ *
+ * @param above Squared magnitude of the row above
+ * @param center Squared magnitude of the row
+ * @param below Squared magnitude of the row below
+ * @param sector NmsSector of the row
+ * @param out Output labels: HYSTERESIS_STRONG, HYSTERESIS_WEAK or 0
+ * @param cols Row length
+ * @param lowThreshold Low threshold (on the magnitude, not squared)
+ * @param highThreshold High threshold (on the magnitude, not squared)
+ */
+ISA_KERNEL void nmsThresholdRow(const int *above, const int *center, const int *below, const uchar *sector, uchar *out, int cols, float lowThreshold, int highThreshold)
+{
+    const int high2 = highThreshold * highThreshold;
+    const int low2 = (int)((double)lowThreshold * lowThreshold);
+    out[0] = 0;
+    out[cols - 1] = 0;
+    for (int j = 1; j < cols - 1; j++)
+    {
+        const uchar s = sector[j];
+        const int a = s == SECTOR_0 ? center[j + 1] : (s == SECTOR_45 ? above[j + 1] : (s == SECTOR_90 ? above[j] : above[j - 1]));
+        const int b = s == SECTOR_0 ? center[j - 1] : (s == SECTOR_45 ? below[j - 1] : (s == SECTOR_90 ? below[j] : below[j + 1]));
+        const int value = center[j] > a && center[j] > b ? center[j] : 0;
+        out[j] = value > high2 ? HYSTERESIS_STRONG : (value > low2 ? HYSTERESIS_WEAK : 0);
     }
-    return threshold;
 }
+typedef void (*NmsRowFixedFn)(const int *, const int *, const int *, const uchar *, uchar *, int, float, int);
+static const IsaDispatch<NmsRowFixedFn> nmsThresholdRowFixedIsa = IsaClones<NmsRowFixedFn, nmsThresholdRow>::table();
 
 /**
  * @brief Applies Harris Corner Detection on an image
@@ -138,345 +455,1278 @@ int otsuThreshold(cv::Mat &image)
  * @return cv::Mat Image with Harris corners marked in red
  */
 cv::Mat harrisCornerDetectorCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH)
+{
+    PipelineContext ctx(gaussian_kernel, FILTER_WIDTH, sobel_x_kernel, sobel_y_kernel);
+    return harrisCornerDetectorCPU(img, ctx);
+}
 
+/**
+ * @brief Blur, Sobel and corner response of a grayscale image
+ *
+ * @param img_gray Grayscale image, CV_32F
+ * @param ctx Pipeline context, prepared for the size of img_gray. The response is left in ctx.response
+ * @return float Largest response
+ */
+static float cornerResponseCPU(const cv::Mat &img_gray, PipelineContext &ctx)
 {
-    auto start = std::chrono::high_resolution_clock::now();
-    cv::Mat img_gray(img->rows, img->cols, CV_32F);
-    // rgb to grayscale
-    for (int i = 0; i < img->rows; i++)
+    // apply Gaussian Blur
+    cv::Mat &img_blurred = ctx.blurred;
     {
-        for (int j = 0; j < img->cols; j++)
-        {
-            cv::Vec3b pixel = img->at<cv::Vec3b>(i, j);
-            img_gray.at<float>(i, j) = 0.299 * float(pixel[0]) + 0.587 * float(pixel[1]) + 0.114 * float(pixel[2]);
-        }
+        ScopedStageTimer timer(STAGE_BLUR);
+        ctx.backends.convolve(BACKEND_STAGE_BLUR, img_gray, img_blurred, ctx.gaussian);
     }
-    // cv::imwrite("debug/gray_cpu.jpg", img_gray);
-    // showImage(img_gray);
-
-    // apply Gaussian Blur
-    cv::Mat img_blurred(img_gray.rows, img_gray.cols, CV_32F);
-    img_blurred = applyConvolutionCPU(img_gray, gaussian_kernel, FILTER_WIDTH);
     // cv::imwrite("debug/blurred_cpu.jpg", img_blurred);
 
     // showImage(img_blurred);
 
     // computing the sobel x and y gradients
-    cv::Mat sobel_x, sobel_y;
-    sobel_x = applyConvolutionCPU(img_blurred, sobel_x_kernel, 3);
-    // cv::imwrite("debug/sobel_x_cpu.jpg", sobel_x);
-    sobel_y = applyConvolutionCPU(img_blurred, sobel_y_kernel, 3);
-    // cv::imwrite("debug/sobel_y_cpu.jpg", sobel_y);
+    cv::Mat &sobel_x = ctx.gradX;
+    cv::Mat &sobel_y = ctx.gradY;
+    {
+        ScopedStageTimer timer(STAGE_SOBEL);
+        ctx.backends.convolve(BACKEND_STAGE_SOBEL, img_blurred, sobel_x, ctx.sobelX);
+        // cv::imwrite("debug/sobel_x_cpu.jpg", sobel_x);
+        ctx.backends.convolve(BACKEND_STAGE_SOBEL, img_blurred, sobel_y, ctx.sobelY);
+        // cv::imwrite("debug/sobel_y_cpu.jpg", sobel_y);
+    }
+
+    // Computing the corner response map (windowed structure tensor) and its max
+    ScopedStageTimer timer(STAGE_RESPONSE);
+    return structureTensorResponseCPU(sobel_x, sobel_y, ctx.response, ctx.tensor);
+}
 
-    // Computing harris response map
-    cv::Mat img_harris = cv::Mat::zeros(img_blurred.rows, img_blurred.cols, CV_32F);
-    for (int i = 1; i < img_blurred.rows - 1; i++)
+/**
+ * @brief Harris response of an image, without selecting the corners. Lets the tiled driver find the largest response
+ * of an image processed in pieces, see PipelineContext::cornerReference
+ *
+ * @param img Input RGB image
+ * @param ctx Pipeline context. The response is left in ctx.response
+ * @return float Largest response
+ */
+float cornerResponseMapCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    ctx.prepare(img->rows, img->cols);
     {
-        for (int j = 1; j < img_blurred.cols - 1; j++)
-        {
-            float Ix2 = sobel_x.at<float>(i, j) * sobel_x.at<float>(i, j);
-            float Iy2 = sobel_y.at<float>(i, j) * sobel_y.at<float>(i, j);
-            float Ixy = sobel_x.at<float>(i, j) * sobel_y.at<float>(i, j);
-            float det = Ix2 * Iy2 - Ixy * Ixy;
-            float trace = Ix2 + Iy2;
-            // img_harris.at<float>(i, j) = det - 0.05 * trace * trace;
-            if (trace != 0)
-            {
+        ScopedStageTimer timer(STAGE_GRAY);
+        ctx.backends.gray(*img, ctx.gray);
+    }
+    return cornerResponseCPU(ctx.gray, ctx);
+}
 
-                img_harris.at<float>(i, j) = det / (trace);
-            }
-            else
-            {
-                img_harris.at<float>(i, j) = 0;
-            }
-            // cout << img_harris.at<float>(i, j) << endl;
+/**
+ * @brief Runs level(l) on the coarse pyramid levels 1 ... n - 1 of a context, each with its own level context. The
+ * levels that still hold more than one thread's share of the base image run one after another on every worker; the
+ * smaller ones run concurrently, one task per level, their own parallel loops running inline, so that the workers are
+ * not left idle on the few rows of each
+ *
+ * @param ctx Pipeline context, with the pyramid built
+ * @param level Body, receives the level index
+ */
+template <typename Level>
+static void forEachCoarseLevelCPU(PipelineContext &ctx, const Level &level)
+{
+    const int levels = ctx.pyramid.size();
+    // created up front: the concurrent levels must not grow levelContexts
+    for (int l = 1; l < levels; l++)
+        ctx.levelContext(l);
+    const double share = (double)ctx.pyramid[0].rows * ctx.pyramid[0].cols / getNumThreadsCPU();
+    int first = 1;
+    for (; first < levels && (double)ctx.pyramid[first].rows * ctx.pyramid[first].cols > share; first++)
+        level(first);
+    parallelForRows(levels - first, [&](int begin, int end)
+                    {
+        for (int l = begin; l < end; l++)
+            level(first + l); }, 1);
+}
+
+/**
+ * @brief Corners of every pyramid level, merged at full resolution. Each level keeps its local maxima above 3% of
+ * its own largest response, with the spacing scaled to the level; the merged list is ranked by response relative to
+ * the level maximum (so 1 is the strongest corner of a level) and the count and spacing limits of the context are
+ * applied across levels.
+ *
+ * @param ctx Pipeline context, with the base grayscale image in ctx.gray. The result is left in ctx.keypoints
+ */
+static void multiScaleKeypointsCPU(PipelineContext &ctx)
+{
+    {
+        ScopedStageTimer timer(STAGE_PYRAMID);
+        ctx.pyramid.build(ctx.gray, ctx.pyramidLevels);
+    }
+    const int levels = ctx.pyramid.size();
+    // thread_local, so the tasks below must go through a reference to this thread's copy
+    static thread_local std::vector<float> levelMaxima;
+    std::vector<float> &maxima = levelMaxima;
+    maxima.assign(levels, 0.0f);
+    auto detect = [&](int l)
+    {
+        PipelineContext &level = l == 0 ? ctx : *ctx.levelContexts[l - 1];
+        const cv::Mat &level_gray = ctx.pyramid[l];
+        level.prepare(level_gray.rows, level_gray.cols);
+        const float max = cornerResponseCPU(level_gray, level);
+        maxima[l] = max;
+        if (!(max > 0))
+            return;
+        ScopedStageTimer timer(STAGE_NMS);
+        detectKeypointsCPU(level.response, 0.03 * max, ctx.maxKeypoints, ctx.keypointMinDistance / (1 << l), level.keypoints);
+    };
+    detect(0);
+    forEachCoarseLevelCPU(ctx, detect);
+
+    // merged in level order, whatever order the levels ran in
+    static thread_local std::vector<Keypoint> merged;
+    merged.clear();
+    for (int l = 0; l < levels; l++)
+    {
+        const float max = maxima[l];
+        if (!(max > 0))
+            continue;
+        const PipelineContext &level = l == 0 ? ctx : *ctx.levelContexts[l - 1];
+        for (Keypoint kp : level.keypoints)
+        {
+            kp.x <<= l;
+            kp.y <<= l;
+            kp.response /= max;
+            kp.level = l;
+            merged.push_back(kp);
         }
     }
+    ScopedStageTimer timer(STAGE_NMS);
+    selectKeypointsCPU(merged, ctx.rows, ctx.cols, ctx.maxKeypoints, ctx.keypointMinDistance, ctx.keypoints);
+}
 
-    // save harris response map
-    // cv::imwrite("debug/harris_cpu.jpg", img_harris);
+/**
+ * @brief Paints the corners on the backend of BACKEND_DETECTOR_CORNERS, if there is one and the context asks for
+ * what it implements: dense corners at full resolution, with the Gaussian window of the blur and the det / trace or
+ * Shi-Tomasi response
+ *
+ * @param img Input RGB image, painted in place
+ * @param ctx Pipeline context
+ * @return Backend* Backend that painted the corners, nullptr to run the host pipeline
+ */
+static Backend *cornersOnDetectorBackend(cv::Mat &img, PipelineContext &ctx)
+{
+    Backend *backend = ctx.backends.detectors[BACKEND_DETECTOR_CORNERS];
+    if (!backend || img.channels() != 3 || ctx.pyramidLevels > 1 || ctx.maxKeypoints > 0 || ctx.keypointMinDistance > 0 || ctx.cornerReference > 0 ||
+        ctx.tensor.window != TENSOR_WINDOW_GAUSSIAN || ctx.tensor.windowSize != ctx.gaussian.size || ctx.tensor.response == RESPONSE_HARRIS_K)
+        return nullptr;
+    ScopedStageTimer timer(STAGE_DETECTOR);
+    if (backend->corners(img, ctx.gaussian, ctx.sobelX, ctx.sobelY, ctx.tensor.response == RESPONSE_SHI_TOMASI))
+        return backend;
+    ctx.backends.fail(backend);
+    return nullptr;
+}
 
-    // normalize the image
-    // cv::normalize(img_harris, img_harris, 0, 1, cv::NORM_MINMAX);
+/**
+ * @brief Applies Harris Corner Detection on an image, reusing the buffers of a pipeline context.
+ * With ctx.pyramidLevels > 1 the corners of the coarser levels are added (see multiScaleKeypointsCPU)
+ *
+ * @param img Input image
+ * @param ctx Pipeline context
+ * @return cv::Mat Image with Harris corners marked in red
+ */
+cv::Mat harrisCornerDetectorCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    ctx.prepare(img->rows, img->cols);
+    if (Backend *backend = cornersOnDetectorBackend(*img, ctx))
+    {
+        auto end = std::chrono::high_resolution_clock::now();
+        if (ctx.verbose)
+            cout << "Harris " << backend->name() << " time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << endl;
+        return *img;
+    }
+    // rgb to grayscale
+    cv::Mat &img_gray = ctx.gray;
+    {
+        ScopedStageTimer timer(STAGE_GRAY);
+        ctx.backends.gray(*img, img_gray);
+    }
+    // cv::imwrite("debug/gray_cpu.jpg", img_gray);
+    // showImage(img_gray);
 
-    // finding max in harris response map
-    float max = -100000000;
-    float min = 1000000;
-    // find max
-    for (int i = 0; i < img_harris.rows; i++)
+    if (ctx.pyramidLevels > 1)
     {
-        for (int j = 0; j < img_harris.cols; j++)
+        multiScaleKeypointsCPU(ctx);
         {
-            if (img_harris.at<float>(i, j) > max)
-            {
-                max = img_harris.at<float>(i, j);
-            }
-            if (img_harris.at<float>(i, j) < min)
-            {
-                min = img_harris.at<float>(i, j);
-            }
+            ScopedStageTimer timer(STAGE_THRESHOLD);
+            drawKeypoints(*img, ctx.keypoints, cv::Vec3b(240, 0, 0));
         }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        if (ctx.verbose)
+            cout << "Harris CPU time: " << duration.count() << "ms, " << ctx.keypoints.size() << " keypoints on " << ctx.pyramid.size() << " levels" << endl;
+        return *img;
     }
 
-    // showImage(img_harris);
-    // print max value
+    const float max = cornerResponseCPU(img_gray, ctx);
+    const int rows = img->rows;
+    const int cols = img->cols;
+    cv::Mat &img_harris = ctx.response;
+
+    // save harris response map
+    // cv::imwrite("debug/harris_cpu.jpg", img_harris);
 
-    // NMS
-    for (int i = 1; i < img_harris.rows - 1; i++)
+    const float threshold = 0.03 * (ctx.cornerReference > 0 ? ctx.cornerReference : max);
+    if (ctx.maxKeypoints > 0 || ctx.keypointMinDistance > 0)
     {
-        for (int j = 1; j < img_harris.cols - 1; j++)
+        // sparse output: only the selected keypoints are painted
+        {
+            ScopedStageTimer timer(STAGE_NMS);
+            detectKeypointsCPU(img_harris, threshold, ctx.maxKeypoints, ctx.keypointMinDistance, ctx.keypoints);
+        }
         {
-            float local_max = -10000;
-            for (int k = -1; k <= 1; k++)
+            ScopedStageTimer timer(STAGE_THRESHOLD);
+            drawKeypoints(*img, ctx.keypoints, cv::Vec3b(240, 0, 0));
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        if (ctx.verbose)
+            cout << "Harris CPU time: " << duration.count() << "ms, " << ctx.keypoints.size() << " keypoints" << endl;
+        return *img;
+    }
+
+    // NMS. Written to a separate map so that bands only read the response (rows i-1 and i+1 are halo rows)
+    cv::Mat &img_nms = ctx.responseNms;
+    {
+        ScopedStageTimer timer(STAGE_NMS);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = std::max(rowBegin, 1); i < std::min(rowEnd, rows - 1); i++)
             {
-                for (int l = -1; l <= 1; l++)
+                const float *above = img_harris.ptr<float>(i - 1);
+                const float *center = img_harris.ptr<float>(i);
+                const float *below = img_harris.ptr<float>(i + 1);
+                float *out = img_nms.ptr<float>(i);
+                for (int j = 1; j < cols - 1; j++)
                 {
-                    if (img_harris.rows > i + k && img_harris.cols > j + l && i + k >= 0 && j + l >= 0 && img_harris.at<float>(i + k, j + l) > local_max)
+                    float local_max = -10000;
+                    for (int l = -1; l <= 1; l++)
                     {
-                        local_max = img_harris.at<float>(i + k, j + l);
+                        local_max = std::max(local_max, std::max(above[j + l], std::max(center[j + l], below[j + l])));
                     }
+                    out[j] = center[j] < local_max ? 0 : center[j];
                 }
-            }
-            if (img_harris.at<float>(i, j) < local_max)
-            {
-                img_harris.at<float>(i, j) = 0;
-            }
-        }
+            } });
     }
 
-    // corner thresholding
-    for (int i = 0; i < img_harris.rows; i++)
+    // corner thresholding: a pixel is painted if a corner lies in its 3x3 neighbourhood, so each band only writes its own rows
     {
-        for (int j = 0; j < img_harris.cols; j++)
-        {
-            // if the pixel is a corner
-            if (img_harris.at<float>(i, j) > 0.03 * max)
+        ScopedStageTimer timer(STAGE_THRESHOLD);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int y = rowBegin; y < rowEnd; y++)
             {
-                // color 2x2 pixels
+                cv::Vec3b *out = img->ptr<cv::Vec3b>(y);
                 for (int k = -1; k <= 1; k++)
                 {
-                    for (int l = -1; l <= 1; l++)
+                    if (y + k < 0 || y + k >= rows)
+                        continue;
+                    const float *corners = img_nms.ptr<float>(y + k);
+                    for (int j = 0; j < cols; j++)
                     {
-                        int x = j + k;
-                        int y = i + l;
-                        if (x >= 0 && x < img_harris.cols && y >= 0 && y < img_harris.rows)
+                        // if the pixel is a corner, color its 3x3 window
+                        if (corners[j] > threshold)
                         {
-                            img->at<cv::Vec3b>(y, x) = cv::Vec3b(240, 0, 0);
+                            for (int x = std::max(j - 1, 0); x <= std::min(j + 1, cols - 1); x++)
+                            {
+                                out[x] = cv::Vec3b(240, 0, 0);
+                            }
                         }
                     }
                 }
-            }
-        }
+            } });
     }
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    cout << "Harris CPU time: " << duration.count() << "ms" << endl;
+    if (ctx.verbose)
+        cout << "Harris CPU time: " << duration.count() << "ms" << endl;
 
     return *img;
 }
 
 /**
- * @brief Binirizes an image using Otsu's method
+ * @brief Otsu binarization into a given grayscale buffer
  *
- * @param img Input image
- * @return cv::Mat  Binarized image
+ * @param img Input RGB image
+ * @param img_gray Output binarized image, CV_32F
+ * @param otsu Threshold state
+ * @param local Tile thresholds, used instead of otsu when local.tileSize > 0
+ * @param classes Number of classes, more than 2 gives a label image of multi-level thresholds
+ * @param backends Backend of the grayscale conversion
+ * @param verbose Print the time taken
+ * @return cv::Mat img_gray
  */
-cv::Mat otsuBinarization(cv::Mat *img)
+static cv::Mat otsuBinarizationInto(const cv::Mat &img, cv::Mat &img_gray, OtsuTracker &otsu, LocalOtsu &local, int classes, BackendSelection &backends, bool verbose)
 {
     auto start = std::chrono::high_resolution_clock::now();
-    cv::Mat img_gray(img->rows, img->cols, CV_32F);
     // rgb to grayscale
-    for (int i = 0; i < img->rows; i++)
     {
-        for (int j = 0; j < img->cols; j++)
+        ScopedStageTimer timer(STAGE_GRAY);
+        backends.gray(img, img_gray);
+    }
+
+    if (local.tileSize > 0)
+    {
+        // one threshold per tile, interpolated between the tile centres
         {
-            cv::Vec3b pixel = img->at<cv::Vec3b>(i, j);
-            img_gray.at<float>(i, j) = 0.299 * float(pixel[0]) + 0.587 * float(pixel[1]) + 0.114 * float(pixel[2]);
+            ScopedStageTimer timer(STAGE_OTSU);
+            local.computeThresholds(img_gray);
         }
+        ScopedStageTimer timer(STAGE_THRESHOLD);
+        local.binarize(img_gray, img_gray);
     }
-
-    // otsu thresholding
-    int threshold = otsuThreshold(img_gray);
-    // cout << "Threshold: " << threshold << endl;
-
-    // binarize the image
-    for (int i = 0; i < img_gray.rows; i++)
+    else if (classes > 2)
     {
-        for (int j = 0; j < img_gray.cols; j++)
+        // classes - 1 thresholds from the histogram, taken on the sampling grid of otsu
+        int thresholds[MAX_OTSU_CLASSES - 1];
         {
-            if (img_gray.at<float>(i, j) > threshold)
-            {
-                img_gray.at<float>(i, j) = 255;
-            }
-            else
-            {
-                img_gray.at<float>(i, j) = 0;
-            }
+            ScopedStageTimer timer(STAGE_OTSU);
+            int hist[256];
+            histogramCPU(img_gray, hist, otsu.sampleStep);
+            multiOtsuThresholds(hist, classes, thresholds);
+        }
+        ScopedStageTimer timer(STAGE_THRESHOLD);
+        otsuLabelsCPU(img_gray, img_gray, thresholds, classes);
+    }
+    else
+    {
+        // otsu thresholding
+        int threshold;
+        {
+            ScopedStageTimer timer(STAGE_OTSU);
+            threshold = otsu.threshold(img_gray);
         }
+        // cout << "Threshold: " << threshold << endl;
+
+        // binarize the image
+        ScopedStageTimer timer(STAGE_THRESHOLD);
+        parallelForRows(img_gray.rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                float *row = img_gray.ptr<float>(i);
+                for (int j = 0; j < img_gray.cols; j++)
+                {
+                    row[j] = row[j] > threshold ? 255 : 0;
+                }
+            } });
     }
 
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    cout << "Otsu CPU time: " << duration.count() << "ms" << endl;
+    if (verbose)
+        cout << "Otsu CPU time: " << duration.count() << "ms" << endl;
     return img_gray;
 }
 
 /**
- * @brief Applies Canny Edge Detection on an image
+ * @brief Image the Otsu threshold of a detector is taken from: the grayscale image for the binarization, the blurred
+ * grayscale image for Canny. Lets the tiled driver build the histogram of a whole image from its tiles
  *
- * @param img Input image
- * @param gaussian_kernel Gaussian kernel
- * @param sobel_x_kernel  Sobel x kernel
- * @param sobel_y_kernel Sobel y kernel
- * @param FILTER_WIDTH Filter width of the gaussian kernel
- * @return cv::Mat Canny edge detected image
+ * @param img Input RGB image
+ * @param ctx Pipeline context
+ * @param blurred true for the blurred image (Canny)
+ * @return cv::Mat CV_32F image, stored in the context
  */
-cv::Mat cannyEdgeDetectionCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH)
+cv::Mat otsuSourceCPU(cv::Mat *img, PipelineContext &ctx, bool blurred)
 {
-    // rgb to grayscale
-    auto start = std::chrono::high_resolution_clock::now();
-    cv::Mat img_gray(img->rows, img->cols, CV_32F);
-    for (int i = 0; i < img->rows; i++)
+    ctx.prepare(img->rows, img->cols);
     {
-        for (int j = 0; j < img->cols; j++)
-        {
-            cv::Vec3b pixel = img->at<cv::Vec3b>(i, j);
-            img_gray.at<float>(i, j) = 0.299 * float(pixel[0]) + 0.587 * float(pixel[1]) + 0.114 * float(pixel[2]);
-        }
+        ScopedStageTimer timer(STAGE_GRAY);
+        ctx.backends.gray(*img, ctx.gray);
     }
-    // cv::imwrite("debug/gray_cpu.jpg", img_gray);
-
-    // apply Gaussian Blur
-    cv::Mat img_blurred(img_gray.rows, img_gray.cols, CV_32F);
-    img_blurred = applyConvolutionCPU(img_gray, gaussian_kernel, FILTER_WIDTH);
-    // cv::imwrite("debug/blurred_cpu.jpg", img_blurred);
+    if (!blurred)
+        return ctx.gray;
+    ScopedStageTimer timer(STAGE_BLUR);
+    ctx.backends.convolve(BACKEND_STAGE_BLUR, ctx.gray, ctx.blurred, ctx.gaussian);
+    return ctx.blurred;
+}
 
-    // computing the sobel x and y gradients
-    cv::Mat sobel_x, sobel_y;
-    sobel_x = applyConvolutionCPU(img_blurred, sobel_x_kernel, 3);
-    // cv::imwrite("debug/sobel_x_cpu.jpg", sobel_x);
-    sobel_y = applyConvolutionCPU(img_blurred, sobel_y_kernel, 3);
-    // cv::imwrite("debug/sobel_y_cpu.jpg", sobel_y);
-
-    // computing the magnitude and direction of the gradient
-    cv::Mat magnitude = cv::Mat::zeros(img_blurred.rows, img_blurred.cols, CV_32F);
-    cv::Mat direction = cv::Mat::zeros(img_blurred.rows, img_blurred.cols, CV_32F);
-    for (int i = 0; i < img_blurred.rows; i++)
-    {
-        for (int j = 0; j < img_blurred.cols; j++)
-        {
-            magnitude.at<float>(i, j) = sqrt(sobel_x.at<float>(i, j) * sobel_x.at<float>(i, j) + sobel_y.at<float>(i, j) * sobel_y.at<float>(i, j));
-            direction.at<float>(i, j) = atan2(sobel_y.at<float>(i, j), sobel_x.at<float>(i, j));
-        }
-    }
-    // cv::imwrite("debug/combined_gradients_cpu.jpg", magnitude);
+/**
+ * @brief Binirizes an image using Otsu's method
+ *
+ * @param img Input image
+ * @return cv::Mat  Binarized image
+ */
+cv::Mat otsuBinarization(cv::Mat *img)
+{
+    cv::Mat img_gray;
+    OtsuTracker otsu;
+    LocalOtsu local;
+    BackendSelection backends;
+    return otsuBinarizationInto(*img, img_gray, otsu, local, 2, backends, true);
+}
+
+/**
+ * @brief Whether the Otsu threshold of a context can be left to a detector backend: pinned, or plain Otsu on every
+ * pixel. The tracker tolerance and sampling need the histogram on the host
+ */
+static bool otsuOnDevice(const OtsuTracker &otsu)
+{
+    return otsu.isPinned() || (otsu.tolerance == 0 && otsu.sampleStep == 1);
+}
+
+/**
+ * @brief Binarizes the image on the backend of BACKEND_DETECTOR_OTSU, if there is one and the context asks for a
+ * global threshold it can compute (see otsuOnDevice)
+ *
+ * @param img Input RGB or grayscale image
+ * @param ctx Pipeline context. The result is left in ctx.gray
+ * @return Backend* Backend that binarized the image, nullptr to run the host pipeline
+ */
+static Backend *otsuOnDetectorBackend(const cv::Mat &img, PipelineContext &ctx)
+{
+    Backend *backend = ctx.backends.detectors[BACKEND_DETECTOR_OTSU];
+    if (!backend || ctx.localOtsu.tileSize > 0 || ctx.otsuClasses > 2 || !otsuOnDevice(ctx.otsu))
+        return nullptr;
+    ScopedStageTimer timer(STAGE_DETECTOR);
+    if (backend->otsu(img, ctx.otsu.isPinned() ? ctx.otsu.current() : -1, ctx.gray))
+        return backend;
+    ctx.backends.fail(backend);
+    return nullptr;
+}
+
+/**
+ * @brief Binirizes an image using Otsu's method, reusing the buffers of a pipeline context
+ *
+ * @param img Input image
+ * @param ctx Pipeline context
+ * @return cv::Mat  Binarized image, stored in the context
+ */
+cv::Mat otsuBinarization(cv::Mat *img, PipelineContext &ctx)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    ctx.prepare(img->rows, img->cols);
+    if (Backend *backend = otsuOnDetectorBackend(*img, ctx))
+    {
+        auto end = std::chrono::high_resolution_clock::now();
+        if (ctx.verbose)
+            cout << "Otsu " << backend->name() << " time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << endl;
+        return ctx.gray;
+    }
+    return otsuBinarizationInto(*img, ctx.gray, ctx.otsu, ctx.localOtsu, ctx.otsuClasses, ctx.backends, ctx.verbose);
+}
+
+/**
+ * @brief Applies Canny Edge Detection on an image
+ *
+ * @param img Input image
+ * @param gaussian_kernel Gaussian kernel
+ * @param sobel_x_kernel  Sobel x kernel
+ * @param sobel_y_kernel Sobel y kernel
+ * @param FILTER_WIDTH Filter width of the gaussian kernel
+ * @return cv::Mat Canny edge detected image
+ */
+cv::Mat cannyEdgeDetectionCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH)
+{
+    PipelineContext ctx(gaussian_kernel, FILTER_WIDTH, sobel_x_kernel, sobel_y_kernel);
+    // the result lives in ctx, which is about to go away
+    return cannyEdgeDetectionCPU(img, ctx).clone();
+}
 
-    float highThreshold = float(otsuThreshold(img_blurred));
-    float lowThreshold = highThreshold / 2;
-    // NMS(lowerboud+double thresholding)
-    cv::Mat nonMaxSuppressed = cv::Mat::zeros(img_blurred.rows, img_blurred.cols, CV_32F);
-    for (int i = 1; i < img_blurred.rows - 1; i++)
+/**
+ * @brief Low threshold of Canny for a high threshold: ctx.cannyLow when it is set, half of the high one otherwise.
+ * Every float Canny path takes it from here, so whole frames, dirty tiles and streamed bands agree
+ */
+static float cannyLowThreshold(const PipelineContext &ctx, float highThreshold)
+{
+    return ctx.cannyLow >= 0 ? ctx.cannyLow : highThreshold / 2;
+}
+
+/**
+ * @brief Canny from the gradient: NMS with the double threshold, then hysteresis
+ *
+ * @param ctx Pipeline context, with the squared magnitude and sector of the gradient. The edges are left in ctx.edges
+ * @param highThreshold High threshold, on the magnitude. The low one is ctx.cannyLow, or half of it
+ */
+static void cannyThresholdCPU(PipelineContext &ctx, float highThreshold)
+{
+    const int rows = ctx.rows;
+    const int cols = ctx.cols;
+    const cv::Mat &magnitude = ctx.magnitude;
+    const cv::Mat &direction = ctx.direction;
+    const float lowThreshold = cannyLowThreshold(ctx, highThreshold);
+    // NMS(lowerboud+double thresholding). Rows i-1 and i+1 of the magnitude are halo rows
+    cv::Mat &nonMaxSuppressed = ctx.thresholded;
+    {
+        ScopedStageTimer timer(STAGE_NMS);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = std::max(rowBegin, 1); i < std::min(rowEnd, rows - 1); i++)
+            {
+                nmsThresholdRowIsa(magnitude.ptr<float>(i - 1), magnitude.ptr<float>(i), magnitude.ptr<float>(i + 1), direction.ptr<uchar>(i), nonMaxSuppressed.ptr<float>(i), cols, lowThreshold, highThreshold);
+            } });
+    }
+
+    // cv::imwrite("debug/non_max_suppressed_cpu.jpg", nonMaxSuppressed);
+
+    cv::Mat &img_canny = ctx.edges;
+    // float highThreshold = 40;
+
+    // cout << "Threshold: " << highThreshold << endl;
+
+    // hysteresis: weak pixels are kept if they are connected to a strong one through any chain of weak pixels
+    {
+        ScopedStageTimer timer(STAGE_HYSTERESIS);
+        hysteresisCPU(nonMaxSuppressed, img_canny);
+    }
+    // save it
+    // cv::imwrite("debug/2_cpu.jpg", img_canny);
+}
+
+/**
+ * @brief Canny from a grayscale image: blur, Sobel, gradient, NMS with the Otsu double threshold and hysteresis
+ *
+ * @param img_gray Grayscale image, CV_32F
+ * @param ctx Pipeline context, prepared for the size of img_gray. The edges are left in ctx.edges
+ * @return float High threshold used
+ */
+static float cannyFromGrayCPU(const cv::Mat &img_gray, PipelineContext &ctx)
+{
+    // apply Gaussian Blur
+    cv::Mat &img_blurred = ctx.blurred;
+    {
+        ScopedStageTimer timer(STAGE_BLUR);
+        ctx.backends.convolve(BACKEND_STAGE_BLUR, img_gray, img_blurred, ctx.gaussian);
+    }
+    // cv::imwrite("debug/blurred_cpu.jpg", img_blurred);
+
+    // computing the sobel x and y gradients
+    cv::Mat &sobel_x = ctx.gradX;
+    cv::Mat &sobel_y = ctx.gradY;
     {
-        for (int j = 1; j < img_blurred.cols - 1; j++)
+        ScopedStageTimer timer(STAGE_SOBEL);
+        ctx.backends.convolve(BACKEND_STAGE_SOBEL, img_blurred, sobel_x, ctx.sobelX);
+        // cv::imwrite("debug/sobel_x_cpu.jpg", sobel_x);
+        ctx.backends.convolve(BACKEND_STAGE_SOBEL, img_blurred, sobel_y, ctx.sobelY);
+        // cv::imwrite("debug/sobel_y_cpu.jpg", sobel_y);
+    }
+
+    const int rows = img_blurred.rows;
+    const int cols = img_blurred.cols;
+
+    // computing the squared magnitude and the NMS sector of the gradient
+    cv::Mat &magnitude = ctx.magnitude;
+    cv::Mat &direction = ctx.direction;
+    {
+        ScopedStageTimer timer(STAGE_GRADIENT);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                gradientSectorRowIsa(sobel_x.ptr<float>(i), sobel_y.ptr<float>(i), magnitude.ptr<float>(i), direction.ptr<uchar>(i), cols);
+            } });
+    }
+    // cv::imwrite("debug/combined_gradients_cpu.jpg", magnitude);
+
+    float highThreshold;
+    {
+        ScopedStageTimer timer(STAGE_OTSU);
+        highThreshold = float(ctx.otsu.threshold(img_blurred));
+    }
+    cannyThresholdCPU(ctx, highThreshold);
+    return highThreshold;
+}
+
+/**
+ * @brief Adds the edges of the coarse pyramid levels to the full resolution edges. Each level runs the whole Canny
+ * with its own Otsu threshold, unless the thresholds are set by hand, and a coarse edge pixel marks the 2^l x 2^l block it covers
+ *
+ * @param ctx Pipeline context, with the base grayscale image in ctx.gray and its edges in ctx.edges
+ */
+static void multiScaleCannyCPU(PipelineContext &ctx)
+{
+    {
+        ScopedStageTimer timer(STAGE_PYRAMID);
+        ctx.pyramid.build(ctx.gray, ctx.pyramidLevels);
+    }
+    const int levels = ctx.pyramid.size();
+    forEachCoarseLevelCPU(ctx, [&](int l)
+                          {
+        PipelineContext &level = *ctx.levelContexts[l - 1];
+        level.prepare(ctx.pyramid[l].rows, ctx.pyramid[l].cols);
+        cannyFromGrayCPU(ctx.pyramid[l], level); });
+
+    ScopedStageTimer timer(STAGE_THRESHOLD);
+    parallelForRows(ctx.rows, [&](int rowBegin, int rowEnd)
+                    {
+        for (int y = rowBegin; y < rowEnd; y++)
         {
-            float angle = direction.at<float>(i, j) * 180 / M_PI;
-            if ((angle >= -22.5 && angle < 22.5) || (angle >= 157.5 && angle <= 180) || (angle >= -180 && angle < -157.5))
+            float *out = ctx.edges.ptr<float>(y);
+            for (int l = 1; l < levels; l++)
             {
-                if (magnitude.at<float>(i, j) > magnitude.at<float>(i, j + 1) && magnitude.at<float>(i, j) > magnitude.at<float>(i, j - 1))
+                const float *coarse = ctx.levelContexts[l - 1]->edges.ptr<float>(y >> l);
+                for (int j = 0; j < ctx.cols; j++)
+                    out[j] = std::max(out[j], coarse[j >> l]);
+            }
+        } });
+}
+
+/**
+ * @brief Runs Canny on the backend of BACKEND_DETECTOR_CANNY, if there is one and the context asks for what it
+ * implements: a single level, a threshold it can compute (see otsuOnDevice) and no caller reading the double
+ * threshold map
+ *
+ * @param img Input RGB or grayscale image
+ * @param ctx Pipeline context. The edges are left in ctx.edges
+ * @return Backend* Backend that found the edges, nullptr to run the host pipeline
+ */
+static Backend *cannyOnDetectorBackend(const cv::Mat &img, PipelineContext &ctx)
+{
+    Backend *backend = ctx.backends.detectors[BACKEND_DETECTOR_CANNY];
+    if (!backend || ctx.keepThresholded || ctx.pyramidLevels > 1 || !otsuOnDevice(ctx.otsu))
+        return nullptr;
+    ScopedStageTimer timer(STAGE_DETECTOR);
+    if (backend->canny(img, ctx.gaussian, ctx.sobelX, ctx.sobelY, ctx.cannyLow, ctx.otsu.isPinned() ? ctx.otsu.current() : -1, ctx.edges))
+        return backend;
+    ctx.backends.fail(backend);
+    return nullptr;
+}
+
+/**
+ * @brief Applies Canny Edge Detection on an image, reusing the buffers of a pipeline context.
+ * With ctx.pyramidLevels > 1 the edges of the coarser levels are added (see multiScaleCannyCPU)
+ *
+ * @param img Input image
+ * @param ctx Pipeline context
+ * @return cv::Mat Canny edge detected image, stored in the context
+ */
+cv::Mat cannyEdgeDetectionCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    // rgb to grayscale
+    auto start = std::chrono::high_resolution_clock::now();
+    ctx.prepare(img->rows, img->cols);
+    if (Backend *backend = cannyOnDetectorBackend(*img, ctx))
+    {
+        auto end = std::chrono::high_resolution_clock::now();
+        if (ctx.verbose)
+            cout << "Canny " << backend->name() << " time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << endl;
+        return ctx.edges;
+    }
+    {
+        ScopedStageTimer timer(STAGE_GRAY);
+        ctx.backends.gray(*img, ctx.gray);
+    }
+    // cv::imwrite("debug/gray_cpu.jpg", img_gray);
+
+    cannyFromGrayCPU(ctx.gray, ctx);
+    if (ctx.pyramidLevels > 1)
+    {
+        multiScaleCannyCPU(ctx);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    if (ctx.verbose)
+        cout << "Canny CPU time: " << duration.count() << "ms" << endl;
+
+    return ctx.edges;
+}
+
+/**
+ * @brief Calibrates the backends of a context on its first frame: the stages first (see BackendSelection::calibrate),
+ * then the detector whole on the backends that run it against the host pipeline on the stages just selected
+ *
+ * @param img First frame, RGB or grayscale as the detectors take it. Not modified
+ * @param ctx Pipeline context. Its Otsu state is left as it was
+ * @param detector Detector that will run on the context, BACKEND_DETECTOR_COUNT for none
+ */
+void calibrateBackendsCPU(const cv::Mat &img, PipelineContext &ctx, BackendDetector detector)
+{
+    ctx.backends.calibrate(img, ctx.gaussian, ctx.sobelX, ctx.verbose);
+    if (detector == BACKEND_DETECTOR_COUNT)
+        return;
+    const bool verbose = ctx.verbose;
+    const OtsuTracker otsu = ctx.otsu;
+    ctx.verbose = false;
+    cv::Mat frame;
+    ctx.backends.calibrateDetector(detector, [&]()
+                                   {
+        img.copyTo(frame);
+        if (detector == BACKEND_DETECTOR_CANNY)
+            cannyEdgeDetectionCPU(&frame, ctx);
+        else if (detector == BACKEND_DETECTOR_CORNERS)
+            harrisCornerDetectorCPU(&frame, ctx);
+        else
+            otsuBinarization(&frame, ctx); }, verbose);
+    ctx.verbose = verbose;
+    ctx.otsu = otsu;
+}
+
+/**
+ * @brief Canny on a video frame, recomputing only the tiles that changed since the frames the cached results come
+ * from (see DirtyTiles). Blur, Sobel, gradient and NMS run on the dirty tiles and their neighbours, and hysteresis
+ * only revisits the edge chains crossing them. When the Otsu threshold moves, NMS and hysteresis run on the whole
+ * frame again. Needs separable kernels whose combined radius (blur, Sobel, NMS) is below the tile size
+ *
+ * @param img Input image
+ * @param ctx Pipeline context, reused across the frames of the video
+ * @return cv::Mat Canny edge detected image, stored in the context
+ */
+cv::Mat cannyEdgeDetectionIncrementalCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    if (img->rows != ctx.rows || img->cols != ctx.cols)
+    {
+        // prepare reallocates the reference image
+        ctx.tiles.invalidate();
+    }
+    ctx.prepare(img->rows, img->cols);
+    ctx.frameGray.create(img->rows, img->cols, CV_32F);
+    {
+        ScopedStageTimer timer(STAGE_GRAY);
+        ctx.backends.gray(*img, ctx.frameGray);
+    }
+    DirtyTiles &tiles = ctx.tiles;
+    {
+        ScopedStageTimer timer(STAGE_TILES);
+        tiles.update(ctx.frameGray, ctx.gray);
+    }
+    const std::vector<cv::Rect> &regions = tiles.regions;
+    const int num_regions = (int)regions.size();
+
+    if (num_regions == tiles.tilesX * tiles.tilesY)
+    {
+        ctx.tilesHighThreshold = cannyFromGrayCPU(ctx.gray, ctx);
+    }
+    else if (num_regions > 0)
+    {
+        // tiles run in parallel: each one only writes its own pixels
+        const ConvolutionKernel &gaussian = ctx.gaussian;
+        {
+            ScopedStageTimer timer(STAGE_BLUR);
+            parallelForRows(num_regions, [&](int first, int last)
+                            {
+                static thread_local std::vector<float> scratch;
+                for (int t = first; t < last; t++)
+                    separableConvolutionRectCPU(ctx.gray, ctx.blurred, gaussian.row.data(), gaussian.col.data(), gaussian.size, CONV_BORDER_NONE, regions[t], scratch); }, 1);
+        }
+        {
+            ScopedStageTimer timer(STAGE_SOBEL);
+            parallelForRows(num_regions, [&](int first, int last)
+                            {
+                static thread_local std::vector<float> scratch;
+                for (int t = first; t < last; t++)
                 {
-                    nonMaxSuppressed.at<float>(i, j) = magnitude.at<float>(i, j);
-                }
+                    separableConvolutionRectCPU(ctx.blurred, ctx.gradX, ctx.sobelX.row.data(), ctx.sobelX.col.data(), 3, CONV_BORDER_NONE, regions[t], scratch);
+                    separableConvolutionRectCPU(ctx.blurred, ctx.gradY, ctx.sobelY.row.data(), ctx.sobelY.col.data(), 3, CONV_BORDER_NONE, regions[t], scratch);
+                } }, 1);
+        }
+        {
+            ScopedStageTimer timer(STAGE_GRADIENT);
+            parallelForRows(num_regions, [&](int first, int last)
+                            {
+                for (int t = first; t < last; t++)
+                {
+                    const cv::Rect &r = regions[t];
+                    for (int i = r.y; i < r.y + r.height; i++)
+                        gradientSectorRowIsa(ctx.gradX.ptr<float>(i) + r.x, ctx.gradY.ptr<float>(i) + r.x, ctx.magnitude.ptr<float>(i) + r.x, ctx.direction.ptr<uchar>(i) + r.x, r.width);
+                } }, 1);
+        }
+        float highThreshold;
+        {
+            ScopedStageTimer timer(STAGE_OTSU);
+            highThreshold = float(ctx.otsu.threshold(ctx.blurred));
+        }
+        if (highThreshold != ctx.tilesHighThreshold)
+        {
+            cannyThresholdCPU(ctx, highThreshold);
+            ctx.tilesHighThreshold = highThreshold;
+        }
+        else
+        {
+            const float lowThreshold = cannyLowThreshold(ctx, highThreshold);
+            const int rows = ctx.rows;
+            const int cols = ctx.cols;
+            {
+                ScopedStageTimer timer(STAGE_NMS);
+                parallelForRows(num_regions, [&](int first, int last)
+                                {
+                    // nmsThresholdRow zeroes the ends of its span, so the span is widened by a pixel where possible
+                    static thread_local std::vector<float> row;
+                    row.resize(cols);
+                    for (int t = first; t < last; t++)
+                    {
+                        const cv::Rect &r = regions[t];
+                        const int lo = std::max(r.x - 1, 0);
+                        const int hi = std::min(r.x + r.width + 1, cols);
+                        for (int i = std::max(r.y, 1); i < std::min(r.y + r.height, rows - 1); i++)
+                        {
+                            nmsThresholdRowIsa(ctx.magnitude.ptr<float>(i - 1) + lo, ctx.magnitude.ptr<float>(i) + lo, ctx.magnitude.ptr<float>(i + 1) + lo, ctx.direction.ptr<uchar>(i) + lo, row.data(), hi - lo, lowThreshold, highThreshold);
+                            std::copy(row.data() + r.x - lo, row.data() + r.x - lo + r.width, ctx.thresholded.ptr<float>(i) + r.x);
+                        }
+                    } }, 1);
             }
-            else if ((angle >= 22.5 && angle < 67.5) || (angle >= -157.5 && angle < -112.5))
+            ScopedStageTimer timer(STAGE_HYSTERESIS);
+            hysteresisRegionsCPU(ctx.thresholded, ctx.edges, regions);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    if (ctx.verbose)
+        printf("Canny CPU time: %ldms, tiles recomputed: %d/%d (%.1f%%)\n", (long)duration.count(), num_regions, tiles.tilesX * tiles.tilesY, 100.0f * tiles.lastFraction());
+
+    return ctx.edges;
+}
+
+/**
+ * @brief Rolling window of image rows: row y lives in slot y % size
+ */
+template <typename T>
+struct RowRing
+{
+    std::vector<T> data;
+    int width = 0;
+    int size = 0;
+
+    void init(int w, int n)
+    {
+        width = w;
+        size = n;
+        data.assign((size_t)w * n, T(0));
+    }
+    T *row(int y) { return data.data() + (size_t)(y % size) * width; }
+};
+
+/**
+ * @brief Row buffers of one streaming Canny band. Kept per thread and reused, so a band does not allocate
+ * once the frame width has been seen
+ */
+struct CannyStreamBuffers
+{
+    std::vector<float> gray, blurred, gx, gy;
+    RowRing<float> hblur, hx, hy, mag, tts;
+    RowRing<uchar> dir;
+
+    void init(int cols, int gaussWidth)
+    {
+        gray.resize(cols);
+        blurred.resize(cols);
+        gx.resize(cols);
+        gy.resize(cols);
+        hblur.init(cols, gaussWidth);
+        hx.init(cols, 3);
+        hy.init(cols, 3);
+        mag.init(cols, 3);
+        dir.init(cols, 3);
+        tts.init(cols, 1);
+    }
+};
+
+/**
+ * @brief Streaming Canny over the rows [rowBegin, rowEnd), up to the double threshold. Every stage keeps only the rows
+ * its consumer still needs, and each thresholded row is packed into the label plane as soon as it is ready.
+ * Starting rowBegin - (radius + 2) rows early warms the windows up, so bands can run independently.
+ * If hist is not null, the blurred rows [rowBegin, rowEnd) on the sampling grid of ctx.otsu are accumulated into it.
+ *
+ * @param img Input RGB image
+ * @param ctx Pipeline context, for the separable kernels
+ * @param labels Output double threshold map, CV_8U (HYSTERESIS_STRONG, HYSTERESIS_WEAK or 0)
+ * @param rowBegin First row
+ * @param rowEnd One past the last row
+ * @param lowThreshold Low threshold
+ * @param highThreshold High threshold
+ * @param hist 256-bin histogram of the blurred image, or nullptr
+ * @param histOnly If true, only gray and blur are computed, for hist
+ */
+static void cannyStreamBand(const cv::Mat &img, const PipelineContext &ctx, cv::Mat &labels, int rowBegin, int rowEnd, float lowThreshold, float highThreshold, int *hist, bool histOnly)
+{
+    const int rows = img.rows;
+    const int cols = img.cols;
+    const ConvolutionKernel &gauss = ctx.gaussian;
+    const int gp = gauss.size / 2;
+    const int step = std::max(1, ctx.otsu.sampleStep);
+    // distance in rows between the gray row being read and the last stage
+    const int latency = histOnly ? gp : gp + 2;
+
+    static thread_local CannyStreamBuffers buffers;
+    buffers.init(cols, gauss.size);
+    std::vector<float> &gray = buffers.gray, &blurred = buffers.blurred, &gx = buffers.gx, &gy = buffers.gy;
+    RowRing<float> &hblur = buffers.hblur, &hx = buffers.hx, &hy = buffers.hy, &mag = buffers.mag, &tts = buffers.tts;
+    RowRing<uchar> &dir = buffers.dir;
+    const float *window[16];
+    const float *sobelWindow[3];
+
+    // a stage row is only valid once its whole input window has been produced (or if it is a zero border row)
+    const int y0 = std::max(0, rowBegin - latency);
+    const int bMin = y0 == 0 ? 0 : y0 + gp;
+    const int sMin = bMin == 0 ? 0 : bMin + 1;
+    const int nMin = sMin == 0 ? 0 : sMin + 1;
+
+    for (int y = y0; y < rowEnd + latency; y++)
+    {
+        // 1. gray + horizontal blur
+        if (y < rows)
+        {
+            if (img.channels() == 3)
+                grayRowIsa(img.ptr<cv::Vec3b>(y), gray.data(), cols);
+            else
+                grayRow(img.ptr<uchar>(y), gray.data(), cols);
+            convolveRowCPU(gray.data(), hblur.row(y), cols, gauss.row.data(), gauss.size, CONV_BORDER_NONE);
+        }
+
+        // 2. vertical blur, then the horizontal sobel passes
+        int b = y - gp;
+        if (b >= bMin && b < rows)
+        {
+            if (b < gp || b >= rows - gp)
             {
-                if (magnitude.at<float>(i, j) > magnitude.at<float>(i - 1, j + 1) && magnitude.at<float>(i, j) > magnitude.at<float>(i + 1, j - 1))
-                {
-                    nonMaxSuppressed.at<float>(i, j) = magnitude.at<float>(i, j);
-                }
+                std::fill(blurred.begin(), blurred.end(), 0.0f);
             }
-            else if ((angle >= 67.5 && angle < 112.5) || (angle >= -112.5 && angle < -67.5))
+            else
             {
-                if (magnitude.at<float>(i, j) > magnitude.at<float>(i - 1, j) && magnitude.at<float>(i, j) > magnitude.at<float>(i + 1, j))
+                for (int i = 0; i < gauss.size; i++)
                 {
-                    nonMaxSuppressed.at<float>(i, j) = magnitude.at<float>(i, j);
+                    window[i] = hblur.row(b - gp + i);
                 }
+                convolveColumnsCPU(window, blurred.data(), cols, gauss.col.data(), gauss.size);
             }
-            else if ((angle >= 112.5 && angle < 157.5) || (angle >= -67.5 && angle < -22.5))
+            if (hist && b >= rowBegin && b < rowEnd && b % step == 0)
             {
-                if (magnitude.at<float>(i, j) > magnitude.at<float>(i - 1, j - 1) && magnitude.at<float>(i, j) > magnitude.at<float>(i + 1, j + 1))
+                for (int j = 0; j < cols; j += step)
                 {
-                    nonMaxSuppressed.at<float>(i, j) = magnitude.at<float>(i, j);
+                    hist[std::min(255, std::max(0, (int)blurred[j]))]++;
                 }
             }
-            // if greater than high_threshold, set to 255
-            // if greater than low_threshold, set to 128
-            // else set to 0
-            if (nonMaxSuppressed.at<float>(i, j) > highThreshold)
-            {
-                nonMaxSuppressed.at<float>(i, j) = 255;
-            }
-            else if (nonMaxSuppressed.at<float>(i, j) > lowThreshold)
+            if (histOnly)
+                continue;
+            convolveRowCPU(blurred.data(), hx.row(b), cols, ctx.sobelX.row.data(), 3, CONV_BORDER_NONE);
+            convolveRowCPU(blurred.data(), hy.row(b), cols, ctx.sobelY.row.data(), 3, CONV_BORDER_NONE);
+        }
+        if (histOnly)
+            continue;
+
+        // 3. vertical sobel passes, squared magnitude and NMS sector
+        int s = b - 1;
+        if (s >= sMin && s < rows)
+        {
+            if (s == 0 || s == rows - 1)
             {
-                nonMaxSuppressed.at<float>(i, j) = 128;
+                std::fill(gx.begin(), gx.end(), 0.0f);
+                std::fill(gy.begin(), gy.end(), 0.0f);
             }
             else
             {
-                nonMaxSuppressed.at<float>(i, j) = 0;
+                for (int i = 0; i < 3; i++)
+                    sobelWindow[i] = hx.row(s - 1 + i);
+                convolveColumnsCPU(sobelWindow, gx.data(), cols, ctx.sobelX.col.data(), 3);
+                for (int i = 0; i < 3; i++)
+                    sobelWindow[i] = hy.row(s - 1 + i);
+                convolveColumnsCPU(sobelWindow, gy.data(), cols, ctx.sobelY.col.data(), 3);
             }
+            gradientSectorRowIsa(gx.data(), gy.data(), mag.row(s), dir.row(s), cols);
         }
+
+        // 4. NMS + double threshold, packed into the label plane
+        int n = s - 1;
+        if (n < nMin || n < rowBegin || n >= rowEnd)
+            continue;
+        uchar *out = labels.ptr<uchar>(n);
+        if (n == 0 || n == rows - 1)
+        {
+            std::fill(out, out + cols, (uchar)0);
+            continue;
+        }
+        nmsThresholdRowIsa(mag.row(n - 1), mag.row(n), mag.row(n + 1), dir.row(n), tts.row(n), cols, lowThreshold, highThreshold);
+        const float *thresholded = tts.row(n);
+        for (int j = 0; j < cols; j++)
+            out[j] = (uchar)thresholded[j];
     }
+}
 
-    // cv::imwrite("debug/non_max_suppressed_cpu.jpg", nonMaxSuppressed);
+/**
+ * @brief Applies Canny Edge Detection on an image as a single fused streaming pass.
+ * Instead of eight full-frame intermediates, each stage keeps a rolling window of a few rows that stays in cache.
+ * The Otsu threshold needs the whole blurred image, so it is computed first by a lighter gray+blur-only stream.
+ * On videos with a tolerance set in ctx.otsu, that stream is skipped: the last threshold is used and the histogram
+ * gathered by the main stream decides whether the next frame gets a new one.
+ * Row bands still run on the CPU thread pool, each band warming up its own windows.
+ * Hysteresis needs the whole connectivity of the image, so the stream ends in a one byte per pixel label plane
+ * that is tracked afterwards.
+ *
+ * @param img Input image
+ * @param gaussian_kernel Gaussian kernel
+ * @param sobel_x_kernel  Sobel x kernel
+ * @param sobel_y_kernel Sobel y kernel
+ * @param FILTER_WIDTH Filter width of the gaussian kernel
+ * @return cv::Mat Canny edge detected image
+ */
+cv::Mat cannyEdgeDetectionStreamCPU(cv::Mat *img, const float *gaussian_kernel, const float *sobel_x_kernel, const float *sobel_y_kernel, int FILTER_WIDTH)
+{
+    PipelineContext ctx(gaussian_kernel, FILTER_WIDTH, sobel_x_kernel, sobel_y_kernel);
+    // the result lives in ctx, which is about to go away
+    return cannyEdgeDetectionStreamCPU(img, ctx).clone();
+}
 
-    cv::Mat img_canny = cv::Mat::zeros(img_blurred.rows, img_blurred.cols, CV_32F);
-    // float highThreshold = 40;
+/**
+ * @brief Streaming Canny Edge Detection, reusing the buffers of a pipeline context
+ *
+ * @param img Input image
+ * @param ctx Pipeline context
+ * @return cv::Mat Canny edge detected image, stored in the context
+ */
+cv::Mat cannyEdgeDetectionStreamCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    if (ctx.gaussian.size > 15 || !ctx.gaussian.separable || !ctx.sobelX.separable || !ctx.sobelY.separable)
+    {
+        // streaming relies on separable kernels
+        return cannyEdgeDetectionCPU(img, ctx);
+    }
 
-    // cout << "Threshold: " << highThreshold << endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    ctx.prepare(img->rows, img->cols);
+    const int rows = img->rows;
+    const int min_band = 64;
+    cv::Mat &labels = ctx.labels;
+
+    // Otsu threshold of the blurred image, one histogram per band
+    int hist[256] = {0};
+    std::mutex hist_mutex;
+    const int step = std::max(1, ctx.otsu.sampleStep);
+    const int samples = ((rows + step - 1) / step) * ((img->cols + step - 1) / step);
+    // the last threshold can be used right away, and this frame's histogram comes for free with the main stream
+    const bool reuse = ctx.otsu.canReuse();
+    auto stream = [&](float low, float high, bool histOnly)
+    {
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            int band_hist[256] = {0};
+            cannyStreamBand(*img, ctx, labels, rowBegin, rowEnd, low, high, band_hist, histOnly);
+            std::lock_guard<std::mutex> lock(hist_mutex);
+            for (int i = 0; i < 256; i++)
+                hist[i] += band_hist[i]; }, min_band);
+    };
+    float highThreshold;
+    if (reuse)
+    {
+        highThreshold = float(ctx.otsu.current());
+    }
+    else
+    {
+        ScopedStageTimer timer(STAGE_OTSU);
+        stream(0, 0, true);
+        highThreshold = float(ctx.otsu.update(hist, samples));
+        std::fill(hist, hist + 256, 0);
+    }
+    const float lowThreshold = cannyLowThreshold(ctx, highThreshold);
 
-    // hysteresis
-    for (int i = 1; i < img_blurred.rows - 1; i++)
     {
-        for (int j = 1; j < img_blurred.cols - 1; j++)
+        ScopedStageTimer timer(STAGE_STREAM);
+        if (reuse)
+        {
+            stream(lowThreshold, highThreshold, false);
+        }
+        else
         {
-            if (nonMaxSuppressed.at<float>(i, j) >= 255)
+            parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                            { cannyStreamBand(*img, ctx, labels, rowBegin, rowEnd, lowThreshold, highThreshold, nullptr, false); }, min_band);
+        }
+    }
+    if (reuse)
+    {
+        // threshold of the next frame
+        ctx.otsu.update(hist, samples);
+    }
+
+    cv::Mat &img_canny = ctx.edges;
+    {
+        ScopedStageTimer timer(STAGE_HYSTERESIS);
+        hysteresisCPU(labels, ctx.labelEdges);
+        ctx.labelEdges.convertTo(img_canny, CV_32F);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    if (ctx.verbose)
+        cout << "Canny CPU (streaming) time: " << duration.count() << "ms" << endl;
+
+    return img_canny;
+}
+
+/**
+ * @brief Converts an RGB image to 8-bit grayscale with integer luma weights. Row bands run on the CPU thread pool.
+ *
+ * @param img Input RGB image (CV_8UC3), or an 8-bit grayscale image (CV_8UC1) that is copied as is
+ * @param img_gray Output grayscale image, (re)allocated as CV_8U
+ */
+void rgbToGrayFixedCPU(const cv::Mat &img, cv::Mat &img_gray)
+{
+    if (img.channels() == 1)
+    {
+        img.copyTo(img_gray);
+        return;
+    }
+    img_gray.create(img.rows, img.cols, CV_8U);
+    parallelForRows(img.rows, [&](int rowBegin, int rowEnd)
+                    {
+        for (int i = rowBegin; i < rowEnd; i++)
+        {
+            grayRowFixedIsa(img.ptr<cv::Vec3b>(i), img_gray.ptr<uchar>(i), img.cols);
+        } });
+}
+
+/**
+ * @brief Applies Canny Edge Detection with 8/16/32-bit integers instead of floats: 8-bit grayscale and blur, Q8 Gaussian taps
+ * normalized by shifts, 16-bit gradients, 32-bit squared magnitude and 8-bit labels. Every intermediate is 1 to 4 times
+ * smaller than its CV_32F counterpart, which is what bounds the float pipeline at large resolutions.
+ * The result differs from the float pipeline only by rounding. Falls back to it if the kernels have no integer form.
+ *
+ * @param img Input image
+ * @param ctx Pipeline context
+ * @return cv::Mat Canny edge detected image, CV_8U, stored in the context
+ */
+cv::Mat cannyEdgeDetectionFixedCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    if (!ctx.fixedPoint)
+    {
+        return cannyEdgeDetectionCPU(img, ctx);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    ctx.prepare(img->rows, img->cols);
+    ctx.prepareFixed();
+    const int rows = img->rows;
+    const int cols = img->cols;
+    const int size = ctx.gaussian.size;
+    const int gp = size / 2;
+
+    {
+        ScopedStageTimer timer(STAGE_GRAY);
+        rgbToGrayFixedCPU(*img, ctx.gray8);
+    }
+
+    // separable Gaussian: 16-bit horizontal pass, then the vertical pass back to 8 bits. The pad-wide frame stays 0
+    {
+        ScopedStageTimer timer(STAGE_BLUR);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
             {
-                img_canny.at<float>(i, j) = 255;
-            }
-            else if (nonMaxSuppressed.at<float>(i, j) >= 128)
+                blurRowFixed(ctx.gray8.ptr<uchar>(i), ctx.hblur16.ptr<ushort>(i), cols, ctx.gaussianRowQ8.data(), size);
+            } });
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            const ushort *window[15];
+            for (int i = rowBegin; i < rowEnd; i++)
             {
-                bool is_connected_to_strong = false;
-                for (int k = -1; k <= 1 && !is_connected_to_strong; k++)
+                uchar *out = ctx.blurred8.ptr<uchar>(i);
+                if (i < gp || i >= rows - gp)
                 {
-                    for (int l = -1; l <= 1; l++)
-                    {
-                        if (nonMaxSuppressed.at<float>(i + k, j + l) >= 255)
-                        {
-                            // img_canny.at<float>(i, j) = 255;
-                            is_connected_to_strong = true;
-                            break;
-                        }
-                    }
+                    std::fill(out, out + cols, (uchar)0);
+                    continue;
                 }
-                if (is_connected_to_strong)
+                for (int k = 0; k < size; k++)
+                    window[k] = ctx.hblur16.ptr<ushort>(i - gp + k);
+                blurColumnsFixed(window, out, cols, ctx.gaussianColQ8.data(), size);
+            } });
+    }
+
+    {
+        ScopedStageTimer timer(STAGE_SOBEL);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                short *gx = ctx.gradX16.ptr<short>(i);
+                short *gy = ctx.gradY16.ptr<short>(i);
+                if (i == 0 || i == rows - 1)
                 {
-                    img_canny.at<float>(i, j) = 1;
+                    std::fill(gx, gx + cols, (short)0);
+                    std::fill(gy, gy + cols, (short)0);
+                    continue;
                 }
-                else
+                sobelRowFixed(ctx.blurred8.ptr<uchar>(i - 1), ctx.blurred8.ptr<uchar>(i), ctx.blurred8.ptr<uchar>(i + 1), ctx.sobelXInt.data(), ctx.sobelYInt.data(), gx, gy, cols);
+            } });
+    }
+
+    {
+        ScopedStageTimer timer(STAGE_GRADIENT);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                gradientSectorRowFixedIsa(ctx.gradX16.ptr<short>(i), ctx.gradY16.ptr<short>(i), ctx.magnitude32.ptr<int>(i), ctx.direction.ptr<uchar>(i), cols);
+            } });
+    }
+
+    int highThreshold;
+    {
+        ScopedStageTimer timer(STAGE_OTSU);
+        highThreshold = ctx.otsu.threshold(ctx.blurred8);
+    }
+    const float lowThreshold = cannyLowThreshold(ctx, (float)highThreshold);
+
+    cv::Mat &labels = ctx.labels;
+    {
+        ScopedStageTimer timer(STAGE_NMS);
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                uchar *out = labels.ptr<uchar>(i);
+                if (i == 0 || i == rows - 1)
                 {
-                    img_canny.at<float>(i, j) = 0;
+                    std::fill(out, out + cols, (uchar)0);
+                    continue;
                 }
-            }
-            else
-            {
-                img_canny.at<float>(i, j) = 0;
-            }
-        }
+                nmsThresholdRowFixedIsa(ctx.magnitude32.ptr<int>(i - 1), ctx.magnitude32.ptr<int>(i), ctx.magnitude32.ptr<int>(i + 1), ctx.direction.ptr<uchar>(i), out, cols, lowThreshold, highThreshold);
+            } });
     }
-    // save it
-    // cv::imwrite("debug/2_cpu.jpg", img_canny);
+
+    {
+        ScopedStageTimer timer(STAGE_HYSTERESIS);
+        hysteresisCPU(labels, ctx.labelEdges);
+    }
+
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    cout << "Canny CPU time: " << duration.count() << "ms" << endl;
+    if (ctx.verbose)
+        cout << "Canny CPU (fixed point) time: " << duration.count() << "ms" << endl;
 
-    return img_canny;
+    return ctx.labelEdges;
+}
+
+/**
+ * @brief Binirizes an image using Otsu's method on an 8-bit grayscale image
+ *
+ * @param img Input image
+ * @param ctx Pipeline context
+ * @return cv::Mat Binarized image, CV_8U, stored in the context
+ */
+cv::Mat otsuBinarizationFixed(cv::Mat *img, PipelineContext &ctx)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    ctx.prepare(img->rows, img->cols);
+    ctx.prepareFixed();
+    cv::Mat &img_gray = ctx.gray8;
+    {
+        ScopedStageTimer timer(STAGE_GRAY);
+        rgbToGrayFixedCPU(*img, img_gray);
+    }
+
+    int threshold;
+    {
+        ScopedStageTimer timer(STAGE_OTSU);
+        threshold = ctx.otsu.threshold(img_gray);
+    }
+
+    {
+        ScopedStageTimer timer(STAGE_THRESHOLD);
+        parallelForRows(img_gray.rows, [&](int rowBegin, int rowEnd)
+                        {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                uchar *row = img_gray.ptr<uchar>(i);
+                for (int j = 0; j < img_gray.cols; j++)
+                {
+                    row[j] = row[j] > threshold ? 255 : 0;
+                }
+            } });
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    if (ctx.verbose)
+        cout << "Otsu CPU (fixed point) time: " << duration.count() << "ms" << endl;
+    return img_gray;
 }
@@ -0,0 +1,154 @@
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <sys/stat.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#include "../include/frame_writer.h"
+using namespace std;
+
+/**
+ * @brief File name of a path without directory and extension
+ */
+static std::string stemOf(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static bool isDirectory(const std::string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+/**
+ * @brief Prepares the output. Directories are created if missing (one level), video files are opened on the first frame
+ *
+ * @param out Output directory or file
+ * @param input Input filename, used to name the files written in a directory
+ * @param video Whether the input is a video (several frames)
+ * @return true if the output can be written
+ */
+bool FrameWriter::open(const std::string &out, const std::string &input, bool video)
+{
+    target = out;
+    frameCount = 0;
+    numbered = video;
+    toVideo = false;
+    toY4m = false;
+
+    std::string ext = extensionOf(out);
+    if (out == "-" || ext == "y4m")
+    {
+        // opened on the first frame, which gives the size
+        toY4m = true;
+    }
+    else if (out.back() == '/' || ext == "" || isDirectory(out))
+    {
+        std::string dir = out.back() == '/' ? out.substr(0, out.size() - 1) : out;
+        if (!isDirectory(dir) && mkdir(dir.c_str(), 0755) != 0)
+        {
+            std::cerr << "Error: Unable to create output directory " << dir << std::endl;
+            return false;
+        }
+        prefix = dir + "/" + stemOf(input);
+        extension = "png";
+    }
+    else if (ext == "mp4" || ext == "avi" || ext == "mkv" || ext == "mov")
+    {
+        toVideo = true;
+    }
+    else if (cv::haveImageWriter(out))
+    {
+        prefix = out.substr(0, out.size() - ext.size() - 1);
+        extension = ext;
+    }
+    else
+    {
+        std::cerr << "Error: Unsupported output file " << out << std::endl;
+        return false;
+    }
+    start = std::chrono::high_resolution_clock::now();
+    return true;
+}
+
+/**
+ * @brief Path of the index-th image
+ */
+std::string FrameWriter::framePath(int index) const
+{
+    if (!numbered)
+        return prefix + "." + extension;
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%06d.", index);
+    return prefix + suffix + extension;
+}
+
+/**
+ * @brief Writes one frame. Float images are saturated to 8 bits (the pipelines output 0-255 values)
+ * and frames going into a video are converted to 3 channels.
+ *
+ * @param frame BGR, BGRA or grayscale frame, CV_8U or CV_32F
+ * @return true on success
+ */
+bool FrameWriter::write(const cv::Mat &frame)
+{
+    const cv::Mat *out = &frame;
+    if (frame.depth() != CV_8U)
+    {
+        frame.convertTo(frame8u, CV_8U);
+        out = &frame8u;
+    }
+    if (out->channels() == 4 || (toVideo && out->channels() == 1))
+    {
+        cv::cvtColor(*out, frameBgr, out->channels() == 4 ? cv::COLOR_BGRA2BGR : cv::COLOR_GRAY2BGR);
+        out = &frameBgr;
+    }
+
+    bool ok = true;
+    if (toY4m)
+    {
+        // grayscale outputs (Canny, Otsu) give a mono stream
+        if (!y4mWriter.isOpened())
+            ok = y4mWriter.open(target, out->rows, out->cols, videoFps, out->channels() == 1);
+        ok = ok && y4mWriter.write(*out);
+    }
+    else if (toVideo)
+    {
+        if (!videoWriter.isOpened())
+        {
+            int fourcc = extensionOf(target) == "avi" ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G') : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+            ok = videoWriter.open(target, fourcc, videoFps, out->size(), true);
+        }
+        if (ok)
+            videoWriter.write(*out);
+    }
+    else
+    {
+        ok = cv::imwrite(framePath(frameCount), *out);
+    }
+    if (!ok)
+    {
+        std::cerr << "Error: Unable to write frame " << frameCount << " to " << target << std::endl;
+        return false;
+    }
+    frameCount++;
+    return true;
+}
+
+/**
+ * @brief Flushes the output and prints how many frames were written and at which rate.
+ * The time goes from open to close, so it includes decoding, processing and encoding.
+ */
+void FrameWriter::close()
+{
+    videoWriter.release();
+    y4mWriter.close();
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    printf("Headless: %d frame(s) written to %s in %.3f s (%.2f FPS)\n", frameCount, target.c_str(), seconds, seconds > 0 ? frameCount / seconds : 0.0);
+}
@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/cpu_dispatch.h"
+#ifdef CPU_DISPATCH_X86
+#include <immintrin.h>
+#endif
+#include "../include/thread_pool.h"
+#include "../include/histogram_cpu.h"
+using namespace std;
+
+// Bin of a pixel: 8-bit pixels are their own bin, float pixels are truncated and clamped to [0, 255]
+static inline int binOf(uchar value) { return value; }
+static inline int binOf(float value) { return std::min(255, std::max(0, (int)value)); }
+
+typedef void (*BinRowFn)(const float *row, int cols, int (*sub)[256]);
+
+/**
+ * @brief Counts a full float row (step 1) into four sub-histograms, scalar version
+ *
+ * @param row Input row
+ * @param cols Row length
+ * @param sub Sub-histograms, pixel j goes to sub[j % 4]
+ */
+static void binRowScalar(const float *row, int cols, int (*sub)[256])
+{
+    int j = 0;
+    for (; j + 4 <= cols; j += 4)
+    {
+        sub[0][binOf(row[j])]++;
+        sub[1][binOf(row[j + 1])]++;
+        sub[2][binOf(row[j + 2])]++;
+        sub[3][binOf(row[j + 3])]++;
+    }
+    for (; j < cols; j++)
+    {
+        sub[0][binOf(row[j])]++;
+    }
+}
+
+#ifdef CPU_DISPATCH_X86
+/**
+ * @brief Float row counting, SSE4.2 version: bins of 4 pixels at a time (truncation and clamping in vectors), the
+ * increments themselves stay scalar
+ */
+ISA_TARGET_SSE42 static void binRowSSE42(const float *row, int cols, int (*sub)[256])
+{
+    const __m128i lo = _mm_setzero_si128();
+    const __m128i hi = _mm_set1_epi32(255);
+    alignas(16) int bins[4];
+    int j = 0;
+    for (; j + 4 <= cols; j += 4)
+    {
+        _mm_store_si128((__m128i *)bins, _mm_min_epi32(_mm_max_epi32(_mm_cvttps_epi32(_mm_loadu_ps(row + j)), lo), hi));
+        sub[0][bins[0]]++;
+        sub[1][bins[1]]++;
+        sub[2][bins[2]]++;
+        sub[3][bins[3]]++;
+    }
+    binRowScalar(row + j, cols - j, sub);
+}
+
+/**
+ * @brief Float row counting, AVX2 version (bins of 8 pixels at a time)
+ */
+ISA_TARGET_AVX2 static void binRowAVX2(const float *row, int cols, int (*sub)[256])
+{
+    const __m256i lo = _mm256_setzero_si256();
+    const __m256i hi = _mm256_set1_epi32(255);
+    alignas(32) int bins[8];
+    int j = 0;
+    for (; j + 8 <= cols; j += 8)
+    {
+        _mm256_store_si256((__m256i *)bins, _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(_mm256_loadu_ps(row + j)), lo), hi));
+        for (int k = 0; k < 8; k++)
+            sub[k & 3][bins[k]]++;
+    }
+    binRowScalar(row + j, cols - j, sub);
+}
+
+/**
+ * @brief Float row counting, AVX-512 version (bins of 16 pixels at a time)
+ */
+ISA_TARGET_AVX512 static void binRowAVX512(const float *row, int cols, int (*sub)[256])
+{
+    const __m512i lo = _mm512_setzero_si512();
+    const __m512i hi = _mm512_set1_epi32(255);
+    alignas(64) int bins[16];
+    int j = 0;
+    for (; j + 16 <= cols; j += 16)
+    {
+        _mm512_store_si512(bins, _mm512_min_epi32(_mm512_max_epi32(_mm512_cvttps_epi32(_mm512_loadu_ps(row + j)), lo), hi));
+        for (int k = 0; k < 16; k++)
+            sub[k & 3][bins[k]]++;
+    }
+    binRowScalar(row + j, cols - j, sub);
+}
+
+static const IsaDispatch<BinRowFn> binRowIsa = {{binRowScalar, binRowSSE42, binRowAVX2, binRowAVX512}};
+#else
+static const IsaDispatch<BinRowFn> binRowIsa = {{binRowScalar, nullptr, nullptr, nullptr}};
+#endif
+
+/**
+ * @brief Histogram of the rows [rowBegin, rowEnd) that fall on the sampling grid.
+ * Consecutive pixels go to four different sub-histograms, so runs of equal pixels do not wait on the same counter.
+ * Full float rows are binned by the binRow variant of the active ISA tier.
+ *
+ * @param img Input image
+ * @param rowBegin First row
+ * @param rowEnd One past the last row
+ * @param step Sampling step in both directions
+ * @param hist Output histogram of the band
+ */
+template <typename T>
+static void histogramBand(const cv::Mat &img, int rowBegin, int rowEnd, int step, int *hist)
+{
+    int sub[4][256] = {};
+    const int cols = img.cols;
+    for (int i = (rowBegin + step - 1) / step * step; i < rowEnd; i += step)
+    {
+        const T *row = img.ptr<T>(i);
+        int j = 0;
+        if (step == 1 && std::is_same<T, float>::value)
+        {
+            binRowIsa((const float *)row, cols, sub);
+            continue;
+        }
+        if (step == 1)
+        {
+            for (; j + 4 <= cols; j += 4)
+            {
+                sub[0][binOf(row[j])]++;
+                sub[1][binOf(row[j + 1])]++;
+                sub[2][binOf(row[j + 2])]++;
+                sub[3][binOf(row[j + 3])]++;
+            }
+        }
+        for (; j < cols; j += step)
+        {
+            sub[0][binOf(row[j])]++;
+        }
+    }
+    for (int k = 0; k < 256; k++)
+    {
+        hist[k] = sub[0][k] + sub[1][k] + sub[2][k] + sub[3][k];
+    }
+}
+
+/**
+ * @brief Adds up count 256-bin histograms stored one after the other
+ *
+ * @param partials count histograms
+ * @param count Number of histograms
+ * @param hist Output histogram
+ */
+static void sumHistograms(const int *partials, int count, int *hist)
+{
+    int k = 0;
+#ifdef __SSE2__
+    for (; k < 256; k += 4)
+    {
+        __m128i sum = _mm_setzero_si128();
+        for (int b = 0; b < count; b++)
+        {
+            sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(partials + b * 256 + k)));
+        }
+        _mm_storeu_si128((__m128i *)(hist + k), sum);
+    }
+#endif
+    for (; k < 256; k++)
+    {
+        int sum = 0;
+        for (int b = 0; b < count; b++)
+        {
+            sum += partials[b * 256 + k];
+        }
+        hist[k] = sum;
+    }
+}
+
+/**
+ * @brief 256-bin histogram of an 8-bit or float image. Row bands run on the CPU thread pool, each into its own
+ * histogram, and the band histograms are summed at the end.
+ *
+ * @param img Input image, CV_8U or CV_32F (values are truncated and clamped to [0, 255])
+ * @param hist Output histogram
+ * @param step Only pixels whose row and column are multiples of step are counted
+ * @return int Number of counted pixels
+ */
+int histogramCPU(const cv::Mat &img, int *hist, int step)
+{
+    step = std::max(1, step);
+    // parallelForRows never makes more than 4 bands per thread. Kept per calling thread, so it is only allocated once
+    static thread_local std::vector<int> partials;
+    const int maxBands = getNumThreadsCPU() * 4;
+    if ((int)partials.size() < maxBands * 256)
+        partials.resize(maxBands * 256);
+    // the workers see their own thread_local, so they get the caller's buffer explicitly
+    int *band_hists = partials.data();
+    std::atomic<int> bands(0);
+    parallelForRows(img.rows, [&](int rowBegin, int rowEnd)
+                    {
+        int *band_hist = band_hists + 256 * bands.fetch_add(1);
+        if (img.depth() == CV_32F)
+            histogramBand<float>(img, rowBegin, rowEnd, step, band_hist);
+        else
+            histogramBand<uchar>(img, rowBegin, rowEnd, step, band_hist); }, 32);
+    sumHistograms(band_hists, bands.load(), hist);
+    return ((img.rows + step - 1) / step) * ((img.cols + step - 1) / step);
+}
+
+/**
+ * @brief Computes the optimal otsu threshold from a 256-bin histogram: the 2-class case of multiOtsuThresholds
+ *
+ * @param hist Histogram
+ * @param total Number of samples in the histogram
+ * @return int Optimal Otsu threshold, 0 if the histogram holds fewer than two gray levels
+ */
+int otsuThresholdFromHistogram(const int *hist, int total)
+{
+    int threshold = 0;
+    if (total > 0)
+        multiOtsuThresholds(hist, 2, &threshold);
+    return threshold;
+}
+
+/**
+ * @brief Multi-level Otsu: the classes-1 thresholds that maximize the between-class variance of a 256-bin histogram.
+ * Maximizing it is the same as maximizing the sum over the classes of (sum of values)^2 / (number of pixels), which
+ * prefix sums of the counts and of the first moments give in O(1) for any class. The best split is then found
+ * exactly by dynamic programming over the class boundaries, in O(classes * levels^2) instead of the
+ * levels^(classes-1) combinations of a brute-force search.
+ * Only the occupied gray levels are class boundaries, so no class is empty (splitting a class never lowers the
+ * variance, an empty class could only tie) and each threshold is the highest level of the class below it.
+ * With fewer occupied levels than classes, each level gets its own class and the levels are spread over the
+ * classes, lowest in the first and highest in the last, the classes in between staying empty (repeated thresholds).
+ *
+ * @param hist Histogram
+ * @param classes Number of classes, 2 to MAX_OTSU_CLASSES
+ * @param thresholds Output, classes-1 non-decreasing thresholds. A value v belongs to the class of the number of
+ * thresholds it is above (v > t). All 0 if the histogram holds fewer than two levels
+ */
+void multiOtsuThresholds(const int *hist, int classes, int *thresholds)
+{
+    // occupied gray levels, and prefix[j] and moment[j]: number of pixels and sum of their values in levels [0, j)
+    int levels[256];
+    double prefix[257], moment[257];
+    int count = 0;
+    prefix[0] = moment[0] = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (hist[i] <= 0)
+            continue;
+        levels[count] = i;
+        prefix[count + 1] = prefix[count] + hist[i];
+        moment[count + 1] = moment[count] + (double)i * hist[i];
+        count++;
+    }
+    if (count < 2)
+    {
+        std::fill(thresholds, thresholds + classes - 1, 0);
+        return;
+    }
+    if (count < classes)
+    {
+        for (int c = 0; c < classes - 1; c++)
+        {
+            // highest level whose class, (j * (classes - 1)) / (count - 1) rounded, is at most c
+            int j = 0;
+            while (j + 1 < count && ((j + 1) * (classes - 1) * 2 + count - 1) / (2 * (count - 1)) <= c)
+                j++;
+            thresholds[c] = levels[j];
+        }
+        return;
+    }
+    // score of the class made of the levels [a, b)
+    auto score = [&](int a, int b)
+    {
+        const double m = moment[b] - moment[a];
+        return m * m / (prefix[b] - prefix[a]);
+    };
+
+    // best[c][b]: best total score of the levels [0, b) split into c + 1 classes, start[c][b]: where its last class starts
+    static thread_local double best[MAX_OTSU_CLASSES][257];
+    static thread_local short start[MAX_OTSU_CLASSES][257];
+    for (int b = 1; b <= count; b++)
+        best[0][b] = score(0, b);
+    for (int c = 1; c < classes; c++)
+    {
+        // every class holds at least one level; the last class only needs to end at count
+        const int first = c == classes - 1 ? count : c + 1;
+        for (int b = first; b <= count; b++)
+        {
+            double value = -1;
+            int from = c;
+            for (int a = c; a < b; a++)
+            {
+                const double candidate = best[c - 1][a] + score(a, b);
+                if (candidate > value)
+                {
+                    value = candidate;
+                    from = a;
+                }
+            }
+            best[c][b] = value;
+            start[c][b] = (short)from;
+        }
+    }
+
+    int end = count;
+    for (int c = classes - 1; c > 0; c--)
+    {
+        end = start[c][end];
+        // the class below ends at level end - 1
+        thresholds[c - 1] = levels[end - 1];
+    }
+}
+
+typedef void (*LabelRowFn)(const float *src, float *dst, int cols, const float *thresholds, float level);
+
+/**
+ * @brief Labels a row: the number of thresholds a pixel is above, times level. Unused thresholds are padded with a
+ * value no pixel exceeds, so the compiler sees a fixed number of comparisons and vectorizes the row
+ */
+ISA_KERNEL void labelRow(const float *src, float *dst, int cols, const float *thresholds, float level)
+{
+    float t[MAX_OTSU_CLASSES - 1];
+    for (int c = 0; c < MAX_OTSU_CLASSES - 1; c++)
+        t[c] = thresholds[c];
+    for (int j = 0; j < cols; j++)
+    {
+        int label = 0;
+        for (int c = 0; c < MAX_OTSU_CLASSES - 1; c++)
+            label += src[j] > t[c];
+        dst[j] = label * level;
+    }
+}
+
+static const IsaDispatch<LabelRowFn> labelRowIsa = IsaClones<LabelRowFn, labelRow>::table();
+
+/**
+ * @brief Label image of multi-level thresholds. Class c of k is written as 255 * c / (k - 1), so the classes are
+ * evenly spread over the gray levels and 2 classes give the usual 0/255 binarization. Row bands run on the CPU
+ * thread pool
+ *
+ * @param img Input image, CV_32F
+ * @param out Output CV_32F label image, may be img
+ * @param thresholds classes-1 thresholds, from multiOtsuThresholds
+ * @param classes Number of classes, 2 to MAX_OTSU_CLASSES
+ */
+void otsuLabelsCPU(const cv::Mat &img, cv::Mat &out, const int *thresholds, int classes)
+{
+    float padded[MAX_OTSU_CLASSES - 1];
+    for (int c = 0; c < MAX_OTSU_CLASSES - 1; c++)
+        padded[c] = c < classes - 1 ? (float)thresholds[c] : 1e30f;
+    const float level = 255.0f / (classes - 1);
+    out.create(img.rows, img.cols, CV_32F);
+    parallelForRows(img.rows, [&](int rowBegin, int rowEnd)
+                    {
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            labelRowIsa(img.ptr<float>(y), out.ptr<float>(y), img.cols, padded, level);
+        } });
+}
+
+typedef void (*LocalThresholdRowFn)(const float *src, const float *above, const float *below, float weight, float *dst, int cols);
+
+/**
+ * @brief Binarizes a row against thresholds interpolated between two rows of tile centres
+ *
+ * @param src Input row
+ * @param above Thresholds of the tile centre row above (or at) the row
+ * @param below Thresholds of the tile centre row below
+ * @param weight Interpolation weight of below
+ * @param dst Output row of 0 and 255, may be src
+ * @param cols Row length
+ */
+ISA_KERNEL void localThresholdRow(const float *src, const float *above, const float *below, float weight, float *dst, int cols)
+{
+    for (int j = 0; j < cols; j++)
+    {
+        const float threshold = above[j] + weight * (below[j] - above[j]);
+        dst[j] = src[j] > threshold ? 255.0f : 0.0f;
+    }
+}
+
+static const IsaDispatch<LocalThresholdRowFn> localThresholdRowIsa = IsaClones<LocalThresholdRowFn, localThresholdRow>::table();
+
+// Tile t of count along length pixels covers [tileStart(t), tileStart(t + 1))
+static inline int tileStart(int t, int length, int count) { return (int)((long long)t * length / count); }
+static inline float tileCentre(int t, int length, int count) { return (tileStart(t, length, count) + tileStart(t + 1, length, count) - 1) * 0.5f; }
+
+/**
+ * @brief Interpolation between the tile centres along one axis. Pixels before the first centre or after the last one
+ * take the value of that tile
+ *
+ * @param length Image length along the axis
+ * @param count Number of tiles along the axis
+ * @param first Output, tile whose centre is at or before each pixel
+ * @param weight Output, weight of the next tile
+ */
+static void tileInterpolation(int length, int count, std::vector<int> &first, std::vector<float> &weight)
+{
+    first.resize(length);
+    weight.resize(length);
+    int t = 0;
+    for (int p = 0; p < length; p++)
+    {
+        while (t + 1 < count && tileCentre(t + 1, length, count) <= p)
+            t++;
+        const float c0 = tileCentre(t, length, count);
+        first[p] = t;
+        weight[p] = t + 1 < count && p > c0 ? (p - c0) / (tileCentre(t + 1, length, count) - c0) : 0.0f;
+    }
+}
+
+/**
+ * @brief Otsu threshold of every tile. Each row of a tile row is cut at the tile boundaries and the pieces are
+ * counted into the histograms of their tiles, so the image is read once, row by row. Tile rows run on the CPU thread
+ * pool. The thresholds are then interpolated along the rows of tile centres, ready for binarize
+ *
+ * @param img Input image, CV_32F (values are truncated and clamped to [0, 255])
+ */
+void LocalOtsu::computeThresholds(const cv::Mat &img)
+{
+    const int rows = img.rows;
+    const int cols = img.cols;
+    const int size = std::max(1, tileSize);
+    tilesY = std::max(1, (rows + size / 2) / size);
+    tilesX = std::max(1, (cols + size / 2) / size);
+    thresholds.resize((size_t)tilesY * tilesX);
+    rowThresholds.resize((size_t)tilesY * cols);
+    tileInterpolation(cols, tilesX, firstX, weightX);
+    tileInterpolation(rows, tilesY, firstY, weightY);
+
+    parallelForRows(tilesY, [&](int tileBegin, int tileEnd)
+                    {
+        // four sub-histograms per tile, see histogramBand
+        static thread_local std::vector<int> subs;
+        subs.resize((size_t)tilesX * 4 * 256);
+        int(*sub)[256] = (int(*)[256])subs.data();
+        const BinRowFn binRow = binRowIsa.get();
+        for (int ty = tileBegin; ty < tileEnd; ty++)
+        {
+            std::fill(subs.begin(), subs.end(), 0);
+            const int y0 = tileStart(ty, rows, tilesY);
+            const int y1 = tileStart(ty + 1, rows, tilesY);
+            for (int y = y0; y < y1; y++)
+            {
+                const float *row = img.ptr<float>(y);
+                for (int tx = 0; tx < tilesX; tx++)
+                {
+                    const int x0 = tileStart(tx, cols, tilesX);
+                    binRow(row + x0, tileStart(tx + 1, cols, tilesX) - x0, sub + 4 * tx);
+                }
+            }
+            float *tile = thresholds.data() + (size_t)ty * tilesX;
+            for (int tx = 0; tx < tilesX; tx++)
+            {
+                int hist[256];
+                sumHistograms(sub[4 * tx], 4, hist);
+                tile[tx] = (float)otsuThresholdFromHistogram(hist, (y1 - y0) * (tileStart(tx + 1, cols, tilesX) - tileStart(tx, cols, tilesX)));
+            }
+            float *interpolated = rowThresholds.data() + (size_t)ty * cols;
+            for (int x = 0; x < cols; x++)
+            {
+                const int tx = firstX[x];
+                interpolated[x] = tile[tx] + weightX[x] * (tile[std::min(tx + 1, tilesX - 1)] - tile[tx]);
+            }
+        } }, 1);
+}
+
+/**
+ * @brief Binarizes an image against the bilinear interpolation of the tile thresholds. Row bands run on the CPU
+ * thread pool
+ *
+ * @param img Image computeThresholds was called on, CV_32F
+ * @param out Output CV_32F map of 0 and 255, may be img
+ */
+void LocalOtsu::binarize(const cv::Mat &img, cv::Mat &out) const
+{
+    const int cols = img.cols;
+    out.create(img.rows, cols, CV_32F);
+    parallelForRows(img.rows, [&](int rowBegin, int rowEnd)
+                    {
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            const int ty = firstY[y];
+            localThresholdRowIsa(img.ptr<float>(y), rowThresholds.data() + (size_t)ty * cols,
+                                 rowThresholds.data() + (size_t)std::min(ty + 1, tilesY - 1) * cols, weightY[y], out.ptr<float>(y), cols);
+        } });
+}
+
+/**
+ * @brief Largest difference between the cumulative distributions of two histograms. Unlike a bin by bin
+ * difference it barely moves when noise shifts pixels to the next bin.
+ */
+static float ksDistance(const int *a, int totalA, const int *b, int totalB)
+{
+    double cumA = 0;
+    double cumB = 0;
+    double distance = 0;
+    for (int k = 0; k < 256; k++)
+    {
+        cumA += a[k];
+        cumB += b[k];
+        distance = std::max(distance, std::fabs(cumA / totalA - cumB / totalB));
+    }
+    return (float)distance;
+}
+
+/**
+ * @brief Otsu threshold of a frame, taken on the sampling grid. A pinned threshold is returned as is
+ *
+ * @param img Input image, CV_8U or CV_32F
+ * @return int Threshold
+ */
+int OtsuTracker::threshold(const cv::Mat &img)
+{
+    if (pinned)
+    {
+        frames++;
+        return value;
+    }
+    int hist[256];
+    int total = histogramCPU(img, hist, sampleStep);
+    return update(hist, total);
+}
+
+/**
+ * @brief Otsu threshold of a frame whose histogram is already known. The previous threshold is kept if the histogram
+ * is within tolerance of the one it was computed from, or if it is pinned
+ *
+ * @param hist Histogram of the frame
+ * @param total Number of samples in the histogram
+ * @return int Threshold
+ */
+int OtsuTracker::update(const int *hist, int total)
+{
+    frames++;
+    if (pinned)
+    {
+        return value;
+    }
+    if (valid && tolerance > 0 && total > 0 && referenceTotal > 0 && ksDistance(hist, total, reference, referenceTotal) <= tolerance)
+    {
+        return value;
+    }
+    value = otsuThresholdFromHistogram(hist, total);
+    std::memcpy(reference, hist, sizeof(reference));
+    referenceTotal = total;
+    valid = true;
+    recomputed++;
+    return value;
+}
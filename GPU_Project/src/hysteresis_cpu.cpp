@@ -0,0 +1,411 @@
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include "../include/hysteresis_cpu.h"
+#include "../include/thread_pool.h"
+using namespace std;
+
+/***********************
+ *
+ * Worklist
+ *
+ **********************/
+
+/**
+ * @brief Edge tracking by hysteresis as a flood fill: every strong pixel seeds a depth-first visit of the
+ * weak pixels 8-connected to it. Each pixel is pushed at most once, so the whole chain is recovered in O(N),
+ * no matter how long it is.
+ * @cite https://en.wikipedia.org/wiki/Canny_edge_detector#Edge_tracking_by_hysteresis
+ *
+ * @param tts Double threshold map (HYSTERESIS_STRONG, HYSTERESIS_WEAK or 0), width * height, continuous
+ * @param out Output edge map: HYSTERESIS_STRONG for edges, 0 otherwise. Must not alias tts
+ * @param width Width of the image
+ * @param height Height of the image
+ */
+template <typename T>
+void hysteresisWorklistCPU(const T *tts, T *out, int width, int height)
+{
+    static thread_local std::vector<int> stack;
+    const size_t n = (size_t)width * height;
+    std::fill(out, out + n, T(0));
+
+    for (size_t seed = 0; seed < n; seed++)
+    {
+        if (tts[seed] < HYSTERESIS_STRONG || out[seed] != 0)
+            continue;
+        out[seed] = T(HYSTERESIS_STRONG);
+        stack.push_back((int)seed);
+        while (!stack.empty())
+        {
+            int p = stack.back();
+            stack.pop_back();
+            int y = p / width;
+            int x = p - y * width;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                int yy = y + dy;
+                if (yy < 0 || yy >= height)
+                    continue;
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int xx = x + dx;
+                    if (xx < 0 || xx >= width)
+                        continue;
+                    int q = yy * width + xx;
+                    if (out[q] == 0 && tts[q] >= HYSTERESIS_WEAK)
+                    {
+                        out[q] = T(HYSTERESIS_STRONG);
+                        stack.push_back(q);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/***********************
+ *
+ * Union-find
+ *
+ **********************/
+
+// Roots are always the smallest pixel index of their component
+static inline int findRoot(std::vector<int> &parent, int p)
+{
+    int root = p;
+    while (parent[root] != root)
+        root = parent[root];
+    // path compression
+    while (parent[p] != root)
+    {
+        int next = parent[p];
+        parent[p] = root;
+        p = next;
+    }
+    return root;
+}
+
+static inline int findRootReadOnly(const std::vector<int> &parent, int p)
+{
+    while (parent[p] != p)
+        p = parent[p];
+    return p;
+}
+
+static inline void unite(std::vector<int> &parent, std::vector<uint8_t> &strong, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b)
+        return;
+    if (a > b)
+        std::swap(a, b);
+    parent[b] = a;
+    strong[a] |= strong[b];
+}
+
+// Union-find buffers of hysteresisUnionFindCPU and hysteresisLabelsCPU, kept from one call to the next
+static std::vector<int> unionFindParent;
+static std::vector<uint8_t> unionFindStrong;
+static std::vector<int> unionFindBands;
+static std::mutex unionFindMutex;
+
+/**
+ * @brief Phases 1 and 2 of hysteresisUnionFindCPU: every candidate (weak or strong) pixel ends up in the tree of its
+ * 8-connected component, whose root is flagged if the component contains a strong pixel
+ */
+template <typename T>
+static void labelCandidates(const T *tts, int width, int height, std::vector<int> &parent, std::vector<uint8_t> &strong, std::vector<int> &band_starts)
+{
+    const size_t n = (size_t)width * height;
+    parent.resize(n);
+    strong.resize(n);
+    band_starts.clear();
+    std::mutex band_mutex;
+
+    // 1. per-band labelling: look at the left, up-left, up and up-right neighbours inside the band
+    parallelForRows(height, [&](int rowBegin, int rowEnd)
+                    {
+        {
+            std::lock_guard<std::mutex> lock(band_mutex);
+            band_starts.push_back(rowBegin);
+        }
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                int p = y * width + x;
+                parent[p] = p;
+                strong[p] = tts[p] >= HYSTERESIS_STRONG;
+                if (tts[p] < HYSTERESIS_WEAK)
+                    continue;
+                if (x > 0 && tts[p - 1] >= HYSTERESIS_WEAK)
+                    unite(parent, strong, p, p - 1);
+                if (y > rowBegin)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int xx = x + dx;
+                        if (xx >= 0 && xx < width && tts[p - width + dx] >= HYSTERESIS_WEAK)
+                            unite(parent, strong, p, p - width + dx);
+                    }
+                }
+            }
+        }
+        // flatten the band so that later lookups are one hop
+        for (int p = rowBegin * width; p < rowEnd * width; p++)
+        {
+            if (tts[p] >= HYSTERESIS_WEAK)
+                parent[p] = findRoot(parent, p);
+        } });
+
+    // 2. merge across band boundaries
+    for (int y : band_starts)
+    {
+        if (y == 0)
+            continue;
+        for (int x = 0; x < width; x++)
+        {
+            int p = y * width + x;
+            if (tts[p] < HYSTERESIS_WEAK)
+                continue;
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int xx = x + dx;
+                if (xx >= 0 && xx < width && tts[p - width + dx] >= HYSTERESIS_WEAK)
+                    unite(parent, strong, p, p - width + dx);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Edge tracking by hysteresis through connected components, parallel over row bands.
+ * 1. Each band labels the components of its candidate (weak or strong) pixels and marks the strong ones.
+ * 2. Components are merged across band boundaries, one row pair per boundary.
+ * 3. Each band keeps the candidates whose component contains a strong pixel.
+ * Every phase is linear in the number of pixels, and phases 1 and 3 only write their own rows.
+ *
+ * @param tts Double threshold map (HYSTERESIS_STRONG, HYSTERESIS_WEAK or 0), width * height, continuous
+ * @param out Output edge map: HYSTERESIS_STRONG for edges, 0 otherwise. Must not alias tts
+ * @param width Width of the image
+ * @param height Height of the image
+ */
+template <typename T>
+void hysteresisUnionFindCPU(const T *tts, T *out, int width, int height)
+{
+    std::lock_guard<std::mutex> buffers_lock(unionFindMutex);
+    std::vector<int> &parent = unionFindParent;
+    std::vector<uint8_t> &strong = unionFindStrong;
+    labelCandidates(tts, width, height, parent, strong, unionFindBands);
+
+    // 3. resolve every candidate through its component
+    parallelForRows(height, [&](int rowBegin, int rowEnd)
+                    {
+        for (int p = rowBegin * width; p < rowEnd * width; p++)
+        {
+            out[p] = (tts[p] >= HYSTERESIS_WEAK && strong[findRootReadOnly(parent, p)]) ? T(HYSTERESIS_STRONG) : T(0);
+        } });
+}
+
+/**
+ * @brief Connected components of the candidate (weak or strong) pixels of a double threshold map, labelled like
+ * hysteresisUnionFindCPU but left unresolved, e.g. for the tiled Canny to join the components of neighbouring tiles
+ *
+ * @param tts Double threshold map, CV_32F or CV_8U, continuous
+ * @param labels Output, one per pixel: index of the root pixel of its component (the smallest pixel index in it), or
+ * -1 for the pixels below the low threshold
+ * @param strong Output, one per pixel: at the root of a component, whether it contains a strong pixel
+ */
+void hysteresisLabelsCPU(const cv::Mat &tts, std::vector<int> &labels, std::vector<uint8_t> &strong)
+{
+    std::lock_guard<std::mutex> buffers_lock(unionFindMutex);
+    const int width = tts.cols;
+    const int height = tts.rows;
+    const std::vector<int> &parent = unionFindParent;
+    if (tts.type() == CV_32F)
+        labelCandidates(tts.ptr<float>(), width, height, unionFindParent, unionFindStrong, unionFindBands);
+    else
+        labelCandidates(tts.ptr<uint8_t>(), width, height, unionFindParent, unionFindStrong, unionFindBands);
+    labels.resize(parent.size());
+    strong.resize(parent.size());
+    parallelForRows(height, [&](int rowBegin, int rowEnd)
+                    {
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            const bool is_float = tts.type() == CV_32F;
+            const float *row32 = is_float ? tts.ptr<float>(y) : nullptr;
+            const uint8_t *row8 = is_float ? nullptr : tts.ptr<uint8_t>(y);
+            for (int x = 0; x < width; x++)
+            {
+                const int p = y * width + x;
+                const bool candidate = is_float ? row32[x] >= HYSTERESIS_WEAK : row8[x] >= HYSTERESIS_WEAK;
+                labels[p] = candidate ? findRootReadOnly(parent, p) : -1;
+                strong[p] = unionFindStrong[p];
+            }
+        } });
+}
+
+template void hysteresisWorklistCPU<float>(const float *, float *, int, int);
+template void hysteresisWorklistCPU<uint8_t>(const uint8_t *, uint8_t *, int, int);
+template void hysteresisUnionFindCPU<float>(const float *, float *, int, int);
+template void hysteresisUnionFindCPU<uint8_t>(const uint8_t *, uint8_t *, int, int);
+
+/***********************
+ *
+ * Incremental
+ *
+ **********************/
+
+/**
+ * @brief Visits the 8-connected component of seed among the pixels accepted by inside, pushing each pixel once
+ * into component. visited holds the stamp of the pass that last reached a pixel
+ */
+template <typename Inside>
+static void collectComponent(int seed, int width, int height, const Inside &inside, std::vector<uint32_t> &visited, uint32_t stamp, std::vector<int> &component)
+{
+    component.clear();
+    visited[seed] = stamp;
+    component.push_back(seed);
+    for (size_t head = 0; head < component.size(); head++)
+    {
+        int p = component[head];
+        int y = p / width;
+        int x = p - y * width;
+        for (int yy = std::max(y - 1, 0); yy <= std::min(y + 1, height - 1); yy++)
+        {
+            for (int xx = std::max(x - 1, 0); xx <= std::min(x + 1, width - 1); xx++)
+            {
+                int q = yy * width + xx;
+                if (visited[q] != stamp && inside(q))
+                {
+                    visited[q] = stamp;
+                    component.push_back(q);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Updates the edges of the previous frame after the double threshold map changed only inside regions.
+ * Only components that touch a region can change: the old edge components touching one are cleared, then every
+ * component of the new map containing a region pixel or a cleared pixel is resolved again. The cost follows the
+ * size of those components, not the image.
+ */
+template <typename T>
+static void hysteresisRegionsCPU(const T *tts, T *out, int width, int height, const std::vector<cv::Rect> &regions)
+{
+    static thread_local std::vector<uint32_t> visited;
+    static thread_local uint32_t stamp = 0;
+    static thread_local std::vector<int> seeds, component;
+    const size_t n = (size_t)width * height;
+    if (visited.size() != n)
+    {
+        visited.assign(n, 0);
+        stamp = 0;
+    }
+    if (stamp >= 0xfffffffeu)
+    {
+        std::fill(visited.begin(), visited.end(), 0);
+        stamp = 0;
+    }
+    seeds.clear();
+
+    // 1. old edge components touching a region are cleared, their pixels become seeds
+    const uint32_t clear_stamp = ++stamp;
+    auto old_edge = [&](int q)
+    { return out[q] != 0; };
+    for (const cv::Rect &r : regions)
+    {
+        for (int y = r.y; y < r.y + r.height; y++)
+        {
+            for (int x = r.x; x < r.x + r.width; x++)
+            {
+                int p = y * width + x;
+                if (out[p] == 0 || visited[p] == clear_stamp)
+                    continue;
+                collectComponent(p, width, height, old_edge, visited, clear_stamp, component);
+                seeds.insert(seeds.end(), component.begin(), component.end());
+            }
+        }
+    }
+    for (int p : seeds)
+        out[p] = T(0);
+    for (const cv::Rect &r : regions)
+    {
+        for (int y = r.y; y < r.y + r.height; y++)
+        {
+            for (int x = r.x; x < r.x + r.width; x++)
+                seeds.push_back(y * width + x);
+        }
+    }
+
+    // 2. components of the new map reached from the seeds are edges if they contain a strong pixel
+    const uint32_t fill_stamp = ++stamp;
+    auto candidate = [&](int q)
+    { return tts[q] >= HYSTERESIS_WEAK; };
+    for (int p : seeds)
+    {
+        if (visited[p] == fill_stamp || !candidate(p))
+            continue;
+        collectComponent(p, width, height, candidate, visited, fill_stamp, component);
+        bool strong = false;
+        for (int q : component)
+            strong = strong || tts[q] >= HYSTERESIS_STRONG;
+        const T value = T(strong ? HYSTERESIS_STRONG : 0);
+        for (int q : component)
+            out[q] = value;
+    }
+}
+
+/**
+ * @brief Edge tracking by hysteresis, updating the edges of a previous call on a map that only changed inside regions.
+ * Gives the same edges as hysteresisCPU on the whole map.
+ *
+ * @param tts Double threshold map, CV_32F or CV_8U, continuous
+ * @param edges Edge map of the previous map, updated in place
+ * @param regions Rectangles containing every changed pixel of tts
+ */
+void hysteresisRegionsCPU(const cv::Mat &tts, cv::Mat &edges, const std::vector<cv::Rect> &regions)
+{
+    if (tts.type() == CV_32F)
+        hysteresisRegionsCPU(tts.ptr<float>(), edges.ptr<float>(), tts.cols, tts.rows, regions);
+    else
+        hysteresisRegionsCPU(tts.ptr<uint8_t>(), edges.ptr<uint8_t>(), tts.cols, tts.rows, regions);
+}
+
+/**
+ * @brief Edge tracking by hysteresis on a double threshold map
+ *
+ * @param tts Double threshold map, CV_32F or CV_8U, with HYSTERESIS_STRONG/HYSTERESIS_WEAK/0 values
+ * @param edges Output edge map, (re)allocated with the type of tts. Edges are HYSTERESIS_STRONG
+ * @param method Algorithm to use
+ */
+void hysteresisCPU(const cv::Mat &tts, cv::Mat &edges, HysteresisMethod method)
+{
+    cv::Mat input = tts.isContinuous() ? tts : tts.clone();
+    edges.create(input.rows, input.cols, input.type());
+    if (method == HYSTERESIS_AUTO)
+    {
+        method = getNumThreadsCPU() > 1 ? HYSTERESIS_UNION_FIND : HYSTERESIS_WORKLIST;
+    }
+
+    if (input.type() == CV_32F)
+    {
+        if (method == HYSTERESIS_UNION_FIND)
+            hysteresisUnionFindCPU(input.ptr<float>(), edges.ptr<float>(), input.cols, input.rows);
+        else
+            hysteresisWorklistCPU(input.ptr<float>(), edges.ptr<float>(), input.cols, input.rows);
+    }
+    else
+    {
+        if (method == HYSTERESIS_UNION_FIND)
+            hysteresisUnionFindCPU(input.ptr<uint8_t>(), edges.ptr<uint8_t>(), input.cols, input.rows);
+        else
+            hysteresisWorklistCPU(input.ptr<uint8_t>(), edges.ptr<uint8_t>(), input.cols, input.rows);
+    }
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/thread_pool.h"
+#include "../include/keypoints_cpu.h"
+using namespace std;
+
+/**
+ * @brief Stronger response first, then scan order, so the selection does not depend on the band layout
+ */
+static inline bool strongerKeypoint(const Keypoint &a, const Keypoint &b)
+{
+    if (a.response != b.response)
+        return a.response > b.response;
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+}
+
+/**
+ * @brief Uniform bucket grid of the accepted keypoints. Cells are minDistance wide, so a keypoint can only be too close
+ * to keypoints in the 3x3 cells around its own. Each cell is a linked list threaded through next, so nothing is
+ * allocated per keypoint.
+ */
+struct KeypointGrid
+{
+    int cellsX = 0, cellsY = 0;
+    float cellSize = 1;
+    std::vector<int> head;
+    std::vector<int> next;
+
+    void reset(int rows, int cols, float minDistance)
+    {
+        cellSize = minDistance;
+        cellsX = (int)(cols / cellSize) + 1;
+        cellsY = (int)(rows / cellSize) + 1;
+        head.assign((size_t)cellsX * cellsY, -1);
+        next.clear();
+    }
+
+    /**
+     * @brief Adds a keypoint unless an accepted one lies closer than minDistance
+     *
+     * @return true if the keypoint was added
+     */
+    bool tryInsert(const Keypoint &kp, const std::vector<Keypoint> &accepted, float minDistance2)
+    {
+        const int cx = (int)(kp.x / cellSize);
+        const int cy = (int)(kp.y / cellSize);
+        for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, cellsY - 1); y++)
+        {
+            for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, cellsX - 1); x++)
+            {
+                for (int i = head[(size_t)y * cellsX + x]; i >= 0; i = next[i])
+                {
+                    const float dx = (float)(accepted[i].x - kp.x);
+                    const float dy = (float)(accepted[i].y - kp.y);
+                    if (dx * dx + dy * dy < minDistance2)
+                        return false;
+                }
+            }
+        }
+        int &cell = head[(size_t)cy * cellsX + cx];
+        next.push_back(cell);
+        cell = (int)next.size() - 1;
+        return true;
+    }
+};
+
+/**
+ * @brief Keeps the strongest candidates, at most maxKeypoints of them and no two closer than minDistance.
+ * Candidates are ranked with a partial sort, batch by batch, and accepted greedily while no stronger accepted keypoint
+ * lies closer than minDistance, so only the head of the list is ever sorted.
+ *
+ * @param candidates Candidates, reordered
+ * @param rows Height of the image the coordinates refer to
+ * @param cols Width of the image the coordinates refer to
+ * @param maxKeypoints Maximum number of keypoints, 0 for no limit
+ * @param minDistance Minimum distance between two keypoints in pixels, 0 for none
+ * @param keypoints Output keypoints, strongest first
+ * @return int Number of keypoints
+ */
+int selectKeypointsCPU(std::vector<Keypoint> &candidates, int rows, int cols, int maxKeypoints, float minDistance, std::vector<Keypoint> &keypoints)
+{
+    static thread_local KeypointGrid grid;
+    keypoints.clear();
+    const size_t total = candidates.size();
+    const size_t limit = maxKeypoints > 0 ? (size_t)maxKeypoints : total;
+    const bool spaced = minDistance > 0;
+    if (spaced)
+        grid.reset(rows, cols, minDistance);
+    const float min_distance2 = minDistance * minDistance;
+
+    size_t sorted = 0;
+    while (keypoints.size() < limit && sorted < total)
+    {
+        // twice the missing keypoints per batch: enough when few candidates are suppressed
+        const size_t batch_end = std::min(total, sorted + std::max<size_t>(2 * (limit - keypoints.size()), 64));
+        std::partial_sort(candidates.begin() + sorted, candidates.begin() + batch_end, candidates.end(), strongerKeypoint);
+        for (; sorted < batch_end && keypoints.size() < limit; sorted++)
+        {
+            const Keypoint &kp = candidates[sorted];
+            if (!spaced || grid.tryInsert(kp, keypoints, min_distance2))
+                keypoints.push_back(kp);
+        }
+    }
+    return (int)keypoints.size();
+}
+
+/**
+ * @brief Extracts the strongest corners of a response map as a sparse list.
+ * Candidates are the 3x3 local maxima above the threshold, found in parallel bands straight from the response (no
+ * suppressed map is written), then selected by selectKeypointsCPU.
+ *
+ * @param response Corner response, CV_32F. The one-pixel border is never a candidate
+ * @param threshold Minimum response of a keypoint
+ * @param maxKeypoints Maximum number of keypoints, 0 for no limit
+ * @param minDistance Minimum distance between two keypoints in pixels, 0 to keep every local maximum
+ * @param keypoints Output keypoints, strongest first
+ * @return int Number of keypoints
+ */
+int detectKeypointsCPU(const cv::Mat &response, float threshold, int maxKeypoints, float minDistance, std::vector<Keypoint> &keypoints)
+{
+    const int rows = response.rows;
+    const int cols = response.cols;
+    static thread_local std::vector<Keypoint> candidates;
+    candidates.clear();
+
+    std::mutex candidates_mutex;
+    std::vector<Keypoint> *all = &candidates;
+    parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                    {
+        static thread_local std::vector<Keypoint> band;
+        band.clear();
+        for (int i = std::max(rowBegin, 1); i < std::min(rowEnd, rows - 1); i++)
+        {
+            const float *above = response.ptr<float>(i - 1);
+            const float *center = response.ptr<float>(i);
+            const float *below = response.ptr<float>(i + 1);
+            for (int j = 1; j < cols - 1; j++)
+            {
+                const float v = center[j];
+                if (!(v > threshold))
+                    continue;
+                // same rule as the dense NMS: plateaus keep every pixel
+                if (v < center[j - 1] || v < center[j + 1] || v < above[j - 1] || v < above[j] || v < above[j + 1] ||
+                    v < below[j - 1] || v < below[j] || v < below[j + 1])
+                    continue;
+                band.push_back({j, i, v, 0});
+            }
+        }
+        std::lock_guard<std::mutex> lock(candidates_mutex);
+        all->insert(all->end(), band.begin(), band.end()); });
+
+    return selectKeypointsCPU(candidates, rows, cols, maxKeypoints, minDistance, keypoints);
+}
+
+/**
+ * @brief Paints the 3x3 window around every keypoint, touching only those pixels
+ *
+ * @param img Image, CV_8UC3
+ * @param keypoints Keypoints
+ * @param color Color
+ */
+void drawKeypoints(cv::Mat &img, const std::vector<Keypoint> &keypoints, const cv::Vec3b &color)
+{
+    for (const Keypoint &kp : keypoints)
+    {
+        for (int y = std::max(kp.y - 1, 0); y <= std::min(kp.y + 1, img.rows - 1); y++)
+        {
+            cv::Vec3b *row = img.ptr<cv::Vec3b>(y);
+            for (int x = std::max(kp.x - 1, 0); x <= std::min(kp.x + 1, img.cols - 1); x++)
+                row[x] = color;
+        }
+    }
+}
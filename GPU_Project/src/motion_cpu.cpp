@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "../include/thread_pool.h"
+#include "../include/keypoints_cpu.h"
+#include "../include/motion_cpu.h"
+#include "../include/pipeline_context.h"
+#include "../include/edge_detection_cpu.h"
+#include "../include/stage_timer.h"
+using namespace std;
+
+// Corners per frame and spacing when -max-corners and -min-distance are not given: dense maxima match poorly
+const int MOTION_MAX_CORNERS = 1000;
+const float MOTION_MIN_DISTANCE = 8;
+
+/**
+ * @brief Number of differing bits of two descriptors
+ */
+static inline int hammingDistance(const BriefDescriptor &a, const BriefDescriptor &b)
+{
+    return __builtin_popcountll(a.bits[0] ^ b.bits[0]) + __builtin_popcountll(a.bits[1] ^ b.bits[1]) +
+           __builtin_popcountll(a.bits[2] ^ b.bits[2]) + __builtin_popcountll(a.bits[3] ^ b.bits[3]);
+}
+
+/**
+ * @brief Computes the descriptors of a new frame. The corners and descriptors of the last frame become the previous
+ * ones. Test pairs are drawn once from an isotropic Gaussian around the corner (sigma = patch size / 5), with a fixed
+ * seed so that every run uses the same tests
+ *
+ * @param img Smoothed grayscale image, CV_32F
+ * @param corners Corners of the frame. Those closer to the border than half the patch are dropped
+ */
+void MotionTracker::describe(const cv::Mat &img, const std::vector<Keypoint> &corners)
+{
+    const int r = BRIEF_PATCH_SIZE / 2;
+    if (pattern.empty())
+    {
+        std::mt19937 rng(0x5eed);
+        std::normal_distribution<float> offset(0.0f, BRIEF_PATCH_SIZE / 5.0f);
+        pattern.resize(256 * 4);
+        for (int &p : pattern)
+            p = std::max(-r, std::min(r, (int)std::lround(offset(rng))));
+    }
+    keypoints.swap(previousKeypoints);
+    descriptors.swap(previousDescriptors);
+
+    keypoints.clear();
+    for (const Keypoint &kp : corners)
+    {
+        if (kp.x >= r && kp.y >= r && kp.x < img.cols - r && kp.y < img.rows - r)
+            keypoints.push_back(kp);
+    }
+    descriptors.resize(keypoints.size());
+
+    // test pairs as offsets in floats from the corner
+    const ptrdiff_t step = (ptrdiff_t)img.step1();
+    ptrdiff_t offsets[256 * 2];
+    for (int t = 0; t < 256 * 2; t++)
+        offsets[t] = pattern[2 * t + 1] * step + pattern[2 * t];
+
+    parallelForRows((int)keypoints.size(), [&](int begin, int end)
+                    {
+        for (int k = begin; k < end; k++)
+        {
+            const float *center = img.ptr<float>(keypoints[k].y) + keypoints[k].x;
+            BriefDescriptor &d = descriptors[k];
+            for (int w = 0; w < 4; w++)
+            {
+                uint64_t word = 0;
+                for (int b = 0; b < 64; b++)
+                {
+                    const ptrdiff_t *pair = offsets + 2 * (w * 64 + b);
+                    word |= (uint64_t)(center[pair[0]] < center[pair[1]]) << b;
+                }
+                d.bits[w] = word;
+            }
+        } }, 64);
+}
+
+/**
+ * @brief Matches the corners of the current frame to those of the previous frame. Each corner takes the previous corner
+ * with the closest descriptor within searchRadius pixels, if it is within maxDistance bits and clearly better than the
+ * second best (ratio test). Previous corners are found through a grid of searchRadius wide cells
+ *
+ * @return int Number of matches, left in matches
+ */
+int MotionTracker::match()
+{
+    matches.clear();
+    if (frames++ == 0 || previousKeypoints.empty() || keypoints.empty())
+        return 0;
+
+    const int cell = std::max(1, searchRadius);
+    int maxX = 0, maxY = 0;
+    for (const Keypoint &kp : previousKeypoints)
+    {
+        maxX = std::max(maxX, kp.x);
+        maxY = std::max(maxY, kp.y);
+    }
+    cellsX = maxX / cell + 1;
+    cellsY = maxY / cell + 1;
+    head.assign((size_t)cellsX * cellsY, -1);
+    next.resize(previousKeypoints.size());
+    for (int i = 0; i < (int)previousKeypoints.size(); i++)
+    {
+        int &first = head[(size_t)(previousKeypoints[i].y / cell) * cellsX + previousKeypoints[i].x / cell];
+        next[i] = first;
+        first = i;
+    }
+
+    const int radius2 = searchRadius * searchRadius;
+    bestMatch.assign(keypoints.size(), -1);
+    parallelForRows((int)keypoints.size(), [&](int begin, int end)
+                    {
+        for (int k = begin; k < end; k++)
+        {
+            const Keypoint &kp = keypoints[k];
+            const int cx = kp.x / cell;
+            const int cy = kp.y / cell;
+            int best = INT_MAX, second = INT_MAX, best_index = -1;
+            for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, cellsY - 1); y++)
+            {
+                for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, cellsX - 1); x++)
+                {
+                    for (int i = head[(size_t)y * cellsX + x]; i >= 0; i = next[i])
+                    {
+                        const int dx = previousKeypoints[i].x - kp.x;
+                        const int dy = previousKeypoints[i].y - kp.y;
+                        if (dx * dx + dy * dy > radius2)
+                            continue;
+                        const int d = hammingDistance(descriptors[k], previousDescriptors[i]);
+                        if (d < best)
+                        {
+                            second = best;
+                            best = d;
+                            best_index = i;
+                        }
+                        else if (d < second)
+                        {
+                            second = d;
+                        }
+                    }
+                }
+            }
+            if (best_index >= 0 && best <= maxDistance && (second == INT_MAX || best < ratio * second))
+                bestMatch[k] = best_index;
+        } }, 64);
+
+    for (int k = 0; k < (int)keypoints.size(); k++)
+    {
+        const int i = bestMatch[k];
+        if (i < 0)
+            continue;
+        matches.push_back({cv::Point(previousKeypoints[i].x, previousKeypoints[i].y), cv::Point(keypoints[k].x, keypoints[k].y),
+                           hammingDistance(descriptors[k], previousDescriptors[i])});
+    }
+    return (int)matches.size();
+}
+
+/**
+ * @brief Motion between this frame and the previous one given to the same context: Harris corners, BRIEF descriptors
+ * on the blurred image and matching within ctx.motion.searchRadius. The motion vectors are drawn in blue and their mean,
+ * scaled by 20 from the centre of the image, in red, like the GPU optical flow demo. The first frame has no vectors
+ *
+ * @param img Input RGB image, drawn on
+ * @param ctx Pipeline context, reused across the frames of the video. The matches are left in ctx.motion.matches
+ * @return cv::Mat img
+ */
+cv::Mat motionEstimationCPU(cv::Mat *img, PipelineContext &ctx)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    MotionTracker &motion = ctx.motion;
+    const float max = cornerResponseMapCPU(img, ctx);
+    {
+        ScopedStageTimer timer(STAGE_NMS);
+        detectKeypointsCPU(ctx.response, 0.03 * max, ctx.maxKeypoints > 0 ? ctx.maxKeypoints : MOTION_MAX_CORNERS,
+                           ctx.keypointMinDistance > 0 ? ctx.keypointMinDistance : MOTION_MIN_DISTANCE, ctx.keypoints);
+    }
+    {
+        ScopedStageTimer timer(STAGE_DESCRIBE);
+        motion.describe(ctx.blurred, ctx.keypoints);
+    }
+    {
+        ScopedStageTimer timer(STAGE_MATCH);
+        motion.match();
+    }
+
+    {
+        ScopedStageTimer timer(STAGE_OUTPUT);
+        cv::Point2f sum(0, 0);
+        int moving = 0;
+        for (const MotionVector &m : motion.matches)
+        {
+            if (m.from == m.to)
+                continue;
+            cv::arrowedLine(*img, m.from, m.to, cv::Scalar(0, 0, 255), 1, cv::LINE_AA, 0, 0.08);
+            sum += cv::Point2f(m.to - m.from);
+            moving++;
+        }
+        if (moving > 0)
+        {
+            cv::Point center(img->cols / 2, img->rows / 2);
+            cv::Point tip = center + cv::Point((int)(sum.x / moving * 20), (int)(sum.y / moving * 20));
+            tip.x = std::max(0, std::min(tip.x, img->cols - 1));
+            tip.y = std::max(0, std::min(tip.y, img->rows - 1));
+            cv::arrowedLine(*img, center, tip, cv::Scalar(255, 0, 0), 2, cv::LINE_AA, 0, 0.5);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    if (ctx.verbose)
+        cout << "Motion CPU time: " << duration.count() << "ms, " << motion.keypoints.size() << " corners, " << motion.matches.size() << " matches" << endl;
+    return *img;
+}
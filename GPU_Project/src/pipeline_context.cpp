@@ -0,0 +1,149 @@
+#include <cmath>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/pipeline_context.h"
+using namespace std;
+
+/**
+ * @brief Quantizes a non-negative 1D kernel to integer taps that sum to exactly 256, so that a pass is normalized by a shift
+ *
+ * @param kernel 1D kernel, any scale
+ * @param kernelSize Kernel size
+ * @param taps Output taps
+ * @return true if the kernel could be quantized
+ */
+static bool quantizeQ8(const vector<float> &kernel, int kernelSize, vector<int> &taps)
+{
+    float sum = 0;
+    for (int i = 0; i < kernelSize; i++)
+    {
+        sum += kernel[i];
+    }
+    if (sum == 0)
+        return false;
+    taps.resize(kernelSize);
+    int total = 0;
+    for (int i = 0; i < kernelSize; i++)
+    {
+        taps[i] = (int)lround(kernel[i] / sum * 256);
+        total += taps[i];
+    }
+    // the rounding error goes to the center tap
+    taps[kernelSize / 2] += 256 - total;
+    for (int i = 0; i < kernelSize; i++)
+    {
+        if (taps[i] < 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Converts a 3x3 kernel to integers. The kernel must have integer weights small enough for an int16 result on 8-bit input
+ *
+ * @param kernel 3x3 kernel
+ * @param weights Output weights
+ * @return true if the kernel could be converted
+ */
+static bool integerKernel3x3(const vector<float> &kernel, vector<int> &weights)
+{
+    weights.resize(9);
+    int absSum = 0;
+    for (int i = 0; i < 9; i++)
+    {
+        weights[i] = (int)lround(kernel[i]);
+        if (fabs(kernel[i] - weights[i]) > 1e-6f)
+            return false;
+        absSum += abs(weights[i]);
+    }
+    return absSum * 255 <= 32767;
+}
+
+/**
+ * @brief Creates a context. Kernels are copied and factored here, image buffers are allocated by the first prepare
+ *
+ * @param gaussian_kernel Gaussian kernel
+ * @param filter_width Filter width of the gaussian kernel
+ * @param sobel_x_kernel Sobel x kernel (3x3)
+ * @param sobel_y_kernel Sobel y kernel (3x3)
+ */
+PipelineContext::PipelineContext(const float *gaussian_kernel, int filter_width, const float *sobel_x_kernel, const float *sobel_y_kernel)
+{
+    gaussian.set(gaussian_kernel, filter_width);
+    sobelX.set(sobel_x_kernel, 3);
+    sobelY.set(sobel_y_kernel, 3);
+    tensor.setWindow(TENSOR_WINDOW_GAUSSIAN, filter_width, &gaussian);
+    // Q8 horizontal sums of 8-bit pixels must fit in 16 bits, which holds for any tap set summing to 256
+    fixedPoint = gaussian.separable && filter_width <= 15 && quantizeQ8(gaussian.row, filter_width, gaussianRowQ8) &&
+                 quantizeQ8(gaussian.col, filter_width, gaussianColQ8) && integerKernel3x3(sobelX.kernel, sobelXInt) &&
+                 integerKernel3x3(sobelY.kernel, sobelYInt);
+}
+
+/**
+ * @brief Makes the buffers fit a frame. Does nothing if the size did not change since the last call.
+ * Maps whose border is never written by the pipelines are zeroed once here.
+ *
+ * @param frameRows Frame height
+ * @param frameCols Frame width
+ */
+void PipelineContext::prepare(int frameRows, int frameCols)
+{
+    if (frameRows == rows && frameCols == cols)
+        return;
+    rows = frameRows;
+    cols = frameCols;
+
+    gray.create(rows, cols, CV_32F);
+    blurred.create(rows, cols, CV_32F);
+    gradX.create(rows, cols, CV_32F);
+    gradY.create(rows, cols, CV_32F);
+    magnitude.create(rows, cols, CV_32F);
+    direction.create(rows, cols, CV_8U);
+    thresholded = cv::Mat::zeros(rows, cols, CV_32F);
+    edges.create(rows, cols, CV_32F);
+    labels.create(rows, cols, CV_8U);
+    labelEdges.create(rows, cols, CV_8U);
+    response = cv::Mat::zeros(rows, cols, CV_32F);
+    responseNms = cv::Mat::zeros(rows, cols, CV_32F);
+}
+
+/**
+ * @brief Makes the fixed-point buffers fit the size set by the last prepare. Kept out of prepare so that runs of the float
+ * pipelines do not pay for them. Does nothing if they already fit.
+ */
+void PipelineContext::prepareFixed()
+{
+    gray8.create(rows, cols, CV_8U);
+    blurred8.create(rows, cols, CV_8U);
+    hblur16.create(rows, cols, CV_16U);
+    gradX16.create(rows, cols, CV_16S);
+    gradY16.create(rows, cols, CV_16S);
+    magnitude32.create(rows, cols, CV_32S);
+}
+
+/**
+ * @brief Context of a coarse pyramid level: same kernels, backends and detector settings as this one, its own buffers and Otsu
+ * state (unless the threshold is pinned). Buffers are sized by the detectors, through prepare
+ *
+ * @param level Pyramid level, from 1
+ * @return PipelineContext& Context of the level
+ */
+PipelineContext &PipelineContext::levelContext(int level)
+{
+    while ((int)levelContexts.size() < level)
+    {
+        levelContexts.emplace_back(new PipelineContext(gaussian.kernel.data(), gaussian.size, sobelX.kernel.data(), sobelY.kernel.data()));
+    }
+    PipelineContext &ctx = *levelContexts[level - 1];
+    ctx.tensor = tensor;
+    ctx.backends = backends;
+    ctx.otsu.sampleStep = otsu.sampleStep;
+    ctx.otsu.tolerance = otsu.tolerance;
+    // manual Canny thresholds apply to every level
+    ctx.cannyLow = cannyLow;
+    if (otsu.isPinned())
+        ctx.otsu.pin(otsu.current());
+    else if (ctx.otsu.isPinned())
+        ctx.otsu.reset();
+    return ctx;
+}
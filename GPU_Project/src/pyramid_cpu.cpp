@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <vector>
+#include <opencv2/core.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../include/thread_pool.h"
+#include "../include/pyramid_cpu.h"
+using namespace std;
+
+/**
+ * @brief Index of row or column i in an image of n, mirrored without repeating the edge (cb|abcd|cb)
+ */
+static inline int reflect101(int i, int n)
+{
+    if (n == 1)
+        return 0;
+    while (i < 0 || i >= n)
+        i = i < 0 ? -i : 2 * n - 2 - i;
+    return i;
+}
+
+/**
+ * @brief Vertical 1 4 6 4 1 pass of five source rows into a full-width row
+ */
+static inline void pyrColumns(const float *r0, const float *r1, const float *r2, const float *r3, const float *r4, float *dst, int cols)
+{
+    int j = 0;
+#ifdef __SSE2__
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 six = _mm_set1_ps(6.0f);
+    for (; j + 4 <= cols; j += 4)
+    {
+        __m128 outer = _mm_add_ps(_mm_loadu_ps(r0 + j), _mm_loadu_ps(r4 + j));
+        __m128 inner = _mm_add_ps(_mm_loadu_ps(r1 + j), _mm_loadu_ps(r3 + j));
+        __m128 sum = _mm_add_ps(outer, _mm_add_ps(_mm_mul_ps(four, inner), _mm_mul_ps(six, _mm_loadu_ps(r2 + j))));
+        _mm_storeu_ps(dst + j, sum);
+    }
+#endif
+    for (; j < cols; j++)
+        dst[j] = r0[j] + r4[j] + 4.0f * (r1[j] + r3[j]) + 6.0f * r2[j];
+}
+
+/**
+ * @brief Horizontal 1 4 6 4 1 pass with decimation: output x is centred on padded column 2x + 2.
+ * The padded row is first split into its even and odd columns, so the taps become contiguous loads
+ *
+ * @param padded Vertical pass output with 2 mirrored columns on each side
+ * @param even Scratch, dstCols + 2 floats
+ * @param odd Scratch, dstCols + 2 floats
+ * @param dst Output row
+ * @param dstCols Output width
+ */
+static inline void pyrRow(const float *padded, float *even, float *odd, float *dst, int dstCols)
+{
+    const int pairs = dstCols + 2;
+    int k = 0;
+#ifdef __SSE2__
+    for (; k + 4 <= pairs; k += 4)
+    {
+        __m128 a = _mm_loadu_ps(padded + 2 * k);
+        __m128 b = _mm_loadu_ps(padded + 2 * k + 4);
+        _mm_storeu_ps(even + k, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(odd + k, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#endif
+    for (; k < pairs; k++)
+    {
+        even[k] = padded[2 * k];
+        odd[k] = padded[2 * k + 1];
+    }
+
+    const float scale = 1.0f / 256;
+    int x = 0;
+#ifdef __SSE2__
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 six = _mm_set1_ps(6.0f);
+    const __m128 norm = _mm_set1_ps(scale);
+    for (; x + 4 <= dstCols; x += 4)
+    {
+        __m128 outer = _mm_add_ps(_mm_loadu_ps(even + x), _mm_loadu_ps(even + x + 2));
+        __m128 inner = _mm_add_ps(_mm_loadu_ps(odd + x), _mm_loadu_ps(odd + x + 1));
+        __m128 sum = _mm_add_ps(outer, _mm_add_ps(_mm_mul_ps(four, inner), _mm_mul_ps(six, _mm_loadu_ps(even + x + 1))));
+        _mm_storeu_ps(dst + x, _mm_mul_ps(sum, norm));
+    }
+#endif
+    for (; x < dstCols; x++)
+        dst[x] = (even[x] + even[x + 2] + 4.0f * (odd[x] + odd[x + 1]) + 6.0f * even[x + 1]) * scale;
+}
+
+/**
+ * @brief Blurs an image with the 5x5 binomial kernel (1 4 6 4 1)^2 / 256 and keeps every other row and column.
+ * Borders are mirrored. Only the kept rows are filtered vertically, and each output row is produced from five source
+ * rows in a per-thread buffer, so the full-resolution blurred image is never stored.
+ *
+ * @param src Input image, CV_32F
+ * @param dst Output image, CV_32F, (rows + 1) / 2 x (cols + 1) / 2. Reallocated only if its size differs
+ */
+void pyrDownCPU(const cv::Mat &src, cv::Mat &dst)
+{
+    const int rows = src.rows;
+    const int cols = src.cols;
+    const int dst_rows = (rows + 1) / 2;
+    const int dst_cols = (cols + 1) / 2;
+    dst.create(dst_rows, dst_cols, CV_32F);
+
+    parallelForRows(dst_rows, [&](int rowBegin, int rowEnd)
+                    {
+        // 2 mirrored columns on each side, plus room for the last even/odd pair
+        static thread_local std::vector<float> padded, even, odd;
+        padded.resize(cols + 6);
+        even.resize(dst_cols + 2);
+        odd.resize(dst_cols + 2);
+        float *row = padded.data() + 2;
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            const int c = 2 * y;
+            pyrColumns(src.ptr<float>(reflect101(c - 2, rows)), src.ptr<float>(reflect101(c - 1, rows)), src.ptr<float>(c),
+                       src.ptr<float>(reflect101(c + 1, rows)), src.ptr<float>(reflect101(c + 2, rows)), row, cols);
+            padded[0] = row[reflect101(-2, cols)];
+            padded[1] = row[reflect101(-1, cols)];
+            for (int j = cols; j < cols + 4; j++)
+                row[j] = row[reflect101(j, cols)];
+            pyrRow(padded.data(), even.data(), odd.data(), dst.ptr<float>(y), dst_cols);
+        } });
+}
+
+/**
+ * @brief Builds the pyramid. Stops early when a level would be smaller than 8 pixels on a side
+ *
+ * @param base Level 0, CV_32F. Only referenced, it must outlive the use of the pyramid
+ * @param numLevels Number of levels, including the base
+ */
+void ImagePyramid::build(const cv::Mat &base, int numLevels)
+{
+    int count = 1;
+    int rows = base.rows;
+    int cols = base.cols;
+    while (count < numLevels && (rows + 1) / 2 >= 8 && (cols + 1) / 2 >= 8)
+    {
+        rows = (rows + 1) / 2;
+        cols = (cols + 1) / 2;
+        count++;
+    }
+    // the Mats of the coarse levels are kept, so their buffers are reused by create
+    if ((int)levels.size() < count)
+        levels.resize(count);
+    levels[0] = base;
+    for (int l = 1; l < count; l++)
+        pyrDownCPU(levels[l - 1], levels[l]);
+    levels.resize(count);
+}
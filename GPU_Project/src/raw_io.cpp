@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "../include/raw_io.h"
+using namespace std;
+
+/**
+ * @brief Lower case extension of a path, empty if it has none
+ */
+std::string extensionOf(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+/**
+ * @brief Opens a PGM/PPM file or stream, or a Y4M video. Regular files are mapped, anything else ("-" for stdin, named
+ * pipes, ...) is read as a stream. The container is recognised from the first bytes, whatever the extension
+ *
+ * @param path File, or "-" for stdin
+ * @return true if the stream header could be read
+ */
+bool RawFrameReader::open(const std::string &path)
+{
+    close();
+    source = path;
+    if (path == "-")
+    {
+        pipe = stdin;
+    }
+    else
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Error: Unable to open " << path << std::endl;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            // private: the detectors that draw on their input only get copies of the pages they touch
+            void *mapping = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapping == MAP_FAILED)
+            {
+                std::cerr << "Error: Unable to map " << path << std::endl;
+                return false;
+            }
+            map = (uchar *)mapping;
+            mapSize = info.st_size;
+            madvise(map, mapSize, MADV_SEQUENTIAL);
+        }
+        else
+        {
+            pipe = fdopen(fd, "rb");
+        }
+    }
+
+    const int first = get();
+    if (first == 'Y')
+    {
+        container = RAW_Y4M;
+        if (readY4mHeader())
+            return true;
+    }
+    else if (first == 'P')
+    {
+        // the magic is read again with the header of the first image
+        container = RAW_PNM;
+        if (map)
+            pos--;
+        else
+            ungetc(first, pipe);
+        return true;
+    }
+    else
+    {
+        std::cerr << "Error: " << path << " is not a binary PGM/PPM or Y4M stream" << std::endl;
+    }
+    close();
+    return false;
+}
+
+/**
+ * @brief Next byte of the input, EOF at the end
+ */
+int RawFrameReader::get()
+{
+    if (map)
+        return pos < mapSize ? map[pos++] : EOF;
+    return fgetc(pipe);
+}
+
+/**
+ * @brief Reads the header of the next PGM/PPM image and sets the frame size
+ *
+ * @param channels Output number of channels, 1 for PGM, 3 for PPM
+ * @return true if an image follows. false at the end of the input or on an invalid header
+ */
+bool RawFrameReader::readPnmHeader(int &channels)
+{
+    int c = get();
+    while (c != EOF && isspace(c))
+        c = get();
+    if (c == EOF)
+        return false;
+    const int format = get();
+    int fields[3] = {0, 0, 0};
+    bool ok = c == 'P' && (format == '5' || format == '6');
+    for (int f = 0; f < 3 && ok; f++)
+        ok = readPnmField([this]() { return get(); }, fields[f]);
+    if (!ok || fields[0] <= 0 || fields[1] <= 0 || fields[2] > 255)
+    {
+        std::cerr << "Error: " << source << " is not a binary 8-bit PGM/PPM stream" << std::endl;
+        return false;
+    }
+    width = fields[0];
+    height = fields[1];
+    channels = format == '6' ? 3 : 1;
+    return true;
+}
+
+/**
+ * @brief Reads the stream header of a Y4M video, after its first byte: frame size, frame rate and chroma layout
+ *
+ * @return true if the stream is supported
+ */
+bool RawFrameReader::readY4mHeader()
+{
+    const char *magic = "UV4MPEG2";
+    for (const char *m = magic; *m; m++)
+    {
+        if (get() != *m)
+        {
+            std::cerr << "Error: " << source << " is not a binary PGM/PPM or Y4M stream" << std::endl;
+            return false;
+        }
+    }
+    // 4:2:0 is the default of the format
+    std::string colour = "420jpeg";
+    int c = get();
+    while (c != '\n' && c != EOF)
+    {
+        if (c == ' ')
+        {
+            c = get();
+            continue;
+        }
+        std::string token;
+        while (c != ' ' && c != '\n' && c != EOF)
+        {
+            token += (char)c;
+            c = get();
+        }
+        if (token[0] == 'W')
+            width = atoi(token.c_str() + 1);
+        else if (token[0] == 'H')
+            height = atoi(token.c_str() + 1);
+        else if (token[0] == 'C')
+            colour = token.substr(1);
+        else if (token[0] == 'F')
+        {
+            int num = 0, den = 0;
+            if (sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0)
+                frameRate = (double)num / den;
+        }
+    }
+    if (c == EOF || width <= 0 || height <= 0)
+    {
+        std::cerr << "Error: Invalid Y4M header in " << source << std::endl;
+        return false;
+    }
+    // chroma planes are stacked under the luma plane, each of them width wide
+    chroma420 = colour == "420jpeg" || colour == "420paldv" || colour == "420mpeg2" || colour == "420";
+    if (chroma420 && width % 2 == 0 && height % 2 == 0)
+        chromaRows = height / 2;
+    else if (colour == "422" && width % 2 == 0)
+        chromaRows = height;
+    else if (colour == "444")
+        chromaRows = 2 * height;
+    else if (colour == "mono")
+        chromaRows = 0;
+    else
+    {
+        std::cerr << "Error: Unsupported Y4M colour space C" << colour << " (" << width << "x" << height << ") in " << source << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Next frame of the input, as stored. PGM/PPM frames are CV_8UC1 or CV_8UC3 (RGB), Y4M frames are CV_8UC1 with
+ * the chroma planes stacked under the luma plane (the I420 layout for 4:2:0). Mapped frames are headers on the mapping
+ * and stay valid until close; piped frames are read into raw, which is only reallocated when the size changes
+ *
+ * @param raw Output frame
+ * @return true if a frame was read, false at the end of the input
+ */
+bool RawFrameReader::read(cv::Mat &raw)
+{
+    if (!map && !pipe)
+        return false;
+    int rows, type;
+    size_t bytes;
+    if (container == RAW_PNM)
+    {
+        int channels;
+        if (!readPnmHeader(channels))
+            return false;
+        rows = height;
+        type = channels == 3 ? CV_8UC3 : CV_8UC1;
+        bytes = (size_t)width * height * channels;
+    }
+    else
+    {
+        // FRAME and its optional parameters, up to the end of the line
+        for (const char *m = "FRAME"; *m; m++)
+        {
+            if (get() != *m)
+                return false;
+        }
+        int c = get();
+        while (c != '\n')
+        {
+            if (c == EOF)
+                return false;
+            c = get();
+        }
+        rows = height + chromaRows;
+        type = CV_8UC1;
+        bytes = (size_t)width * rows;
+    }
+
+    if (map)
+    {
+        if (mapSize - pos < bytes)
+        {
+            std::cerr << "Error: Truncated frame in " << source << std::endl;
+            return false;
+        }
+        raw = cv::Mat(rows, width, type, map + pos);
+        pos += bytes;
+        return true;
+    }
+    raw.create(rows, width, type);
+    if (fread(raw.data, 1, bytes, pipe) != bytes)
+    {
+        std::cerr << "Error: Truncated frame in " << source << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Image of a frame as the detectors take it: the frame itself for PGM/PPM, a header on the luma plane for Y4M.
+ * Only when an RGB image is needed (to draw on) are grayscale frames expanded, and 4:2:0 frames converted, into buffer
+ *
+ * @param raw Frame returned by read
+ * @param rgb Whether a CV_8UC3 RGB image is needed
+ * @param buffer Conversion buffer, reused from frame to frame
+ * @return cv::Mat RGB or grayscale CV_8U image
+ */
+cv::Mat RawFrameReader::image(const cv::Mat &raw, bool rgb, cv::Mat &buffer) const
+{
+    if (container == RAW_PNM)
+    {
+        if (!rgb || raw.channels() == 3)
+            return raw;
+        cv::cvtColor(raw, buffer, cv::COLOR_GRAY2RGB);
+        return buffer;
+    }
+    cv::Mat luma = raw.rowRange(0, height);
+    if (!rgb)
+        return luma;
+    if (chroma420)
+        cv::cvtColor(raw, buffer, cv::COLOR_YUV2RGB_I420);
+    else
+        cv::cvtColor(luma, buffer, cv::COLOR_GRAY2RGB);
+    return buffer;
+}
+
+/**
+ * @brief Unmaps the file or closes the pipe. Frames read from the mapping become invalid
+ */
+void RawFrameReader::close()
+{
+    if (map)
+        munmap(map, mapSize);
+    if (pipe && pipe != stdin)
+        fclose(pipe);
+    map = nullptr;
+    mapSize = 0;
+    pos = 0;
+    pipe = nullptr;
+    width = height = chromaRows = 0;
+    chroma420 = false;
+    frameRate = 0;
+}
+
+/**
+ * @brief Writes the rows of an image one after the other
+ */
+static bool writeRows(FILE *file, const cv::Mat &img)
+{
+    const size_t rowBytes = img.cols * img.elemSize();
+    if (img.isContinuous())
+        return fwrite(img.data, rowBytes, img.rows, file) == (size_t)img.rows;
+    for (int y = 0; y < img.rows; y++)
+    {
+        if (fwrite(img.ptr(y), 1, rowBytes, file) != rowBytes)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Opens the output and writes the stream header
+ *
+ * @param path Output file, or "-" for stdout
+ * @param rows Frame height
+ * @param cols Frame width
+ * @param fps Frame rate, 30 if not positive
+ * @param mono true for a grayscale stream, false for 4:2:0 (even sizes only)
+ * @return true if the stream can be written
+ */
+bool Y4MWriter::open(const std::string &path, int rows, int cols, double fps, bool mono)
+{
+    close();
+    if (!mono && (rows % 2 != 0 || cols % 2 != 0))
+    {
+        std::cerr << "Error: 4:2:0 Y4M output needs an even frame size, got " << cols << "x" << rows << std::endl;
+        return false;
+    }
+    if (path == "-")
+    {
+        // the stream keeps the real stdout, and everything printed from now on goes to stderr
+        fflush(stdout);
+        int fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        file = fd >= 0 ? fdopen(fd, "wb") : nullptr;
+    }
+    else
+    {
+        file = fopen(path.c_str(), "wb");
+    }
+    if (!file)
+    {
+        std::cerr << "Error: Unable to open " << path << std::endl;
+        return false;
+    }
+    width = cols;
+    height = rows;
+    monochrome = mono;
+    const int rate = fps > 0 ? (int)lround(fps * 1000) : 30000;
+    fprintf(file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C%s\n", width, height, rate, mono ? "mono" : "420jpeg");
+    return true;
+}
+
+/**
+ * @brief Appends a frame
+ *
+ * @param frame CV_8UC1 grayscale or CV_8UC3 BGR frame of the size given to open
+ * @return true on success
+ */
+bool Y4MWriter::write(const cv::Mat &frame)
+{
+    if (!file || frame.rows != height || frame.cols != width || frame.depth() != CV_8U)
+        return false;
+    bool ok = fputs("FRAME\n", file) >= 0;
+    if (frame.channels() == 1)
+    {
+        ok = ok && writeRows(file, frame);
+        if (!monochrome)
+        {
+            // neutral chroma
+            yuv.create(height / 2, width, CV_8UC1);
+            yuv.setTo(128);
+            ok = ok && writeRows(file, yuv);
+        }
+        return ok;
+    }
+    cv::cvtColor(frame, yuv, monochrome ? cv::COLOR_BGR2GRAY : cv::COLOR_BGR2YUV_I420);
+    return ok && writeRows(file, yuv);
+}
+
+void Y4MWriter::close()
+{
+    if (file)
+        fclose(file);
+    file = nullptr;
+}
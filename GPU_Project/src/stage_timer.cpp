@@ -0,0 +1,190 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../include/stage_timer.h"
+using namespace std;
+
+std::atomic<bool> stageTimingOn{false};
+
+static const char *stageNames[STAGE_COUNT] = {"decode", "gray", "blur", "sobel", "gradient", "nms", "threshold", "hysteresis", "otsu", "response", "stream", "pyramid", "tiles", "describe", "match", "detector", "output", "frame"};
+
+struct StageSample
+{
+    int64_t start;
+    int64_t duration;
+    int stage;
+};
+
+/**
+ * @brief Samples of one thread. Only the owner thread writes: it fills the slot, then publishes it by bumping
+ * written with release semantics, so recording never takes a lock. When full, the oldest samples are overwritten.
+ */
+struct SampleRing
+{
+    static const int CAPACITY = 1 << 16;
+    StageSample samples[CAPACITY];
+    std::atomic<uint64_t> written{0};
+    int threadIndex = 0;
+};
+
+// Rings outlive their threads, so the summary can still read the samples of finished workers
+static std::vector<std::unique_ptr<SampleRing>> &ringRegistry()
+{
+    static std::vector<std::unique_ptr<SampleRing>> rings;
+    return rings;
+}
+static std::mutex registryMutex;
+
+static SampleRing *threadRing()
+{
+    static thread_local SampleRing *ring = nullptr;
+    if (!ring)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        ringRegistry().emplace_back(new SampleRing());
+        ring = ringRegistry().back().get();
+        ring->threadIndex = (int)ringRegistry().size() - 1;
+    }
+    return ring;
+}
+
+const char *stageName(Stage stage)
+{
+    return stage >= 0 && stage < STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+/**
+ * @brief Turns the stage timers on or off
+ */
+void setStageTiming(bool enabled)
+{
+    stageTimingOn.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Appends a sample to the ring of the calling thread
+ *
+ * @param stage Stage
+ * @param startNs Start time (stageClockNs)
+ * @param durationNs Duration
+ */
+void recordStageSample(Stage stage, int64_t startNs, int64_t durationNs)
+{
+    SampleRing *ring = threadRing();
+    uint64_t index = ring->written.load(std::memory_order_relaxed);
+    StageSample &sample = ring->samples[index & (SampleRing::CAPACITY - 1)];
+    sample.start = startNs;
+    sample.duration = durationNs;
+    sample.stage = stage;
+    ring->written.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Calls f(sample, threadIndex) on every sample still held by the rings
+ */
+template <typename F>
+static void forEachSample(F f)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto &ring : ringRegistry())
+    {
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = written > (uint64_t)SampleRing::CAPACITY ? written - SampleRing::CAPACITY : 0;
+        for (uint64_t i = first; i < written; i++)
+        {
+            f(ring->samples[i & (SampleRing::CAPACITY - 1)], ring->threadIndex);
+        }
+    }
+}
+
+/**
+ * @brief Sum of the samples of every stage, in ns
+ *
+ * @param totalNs Output, one total per stage
+ */
+void stageTotals(int64_t totalNs[STAGE_COUNT])
+{
+    std::fill(totalNs, totalNs + STAGE_COUNT, 0);
+    forEachSample([&](const StageSample &sample, int)
+                  { totalNs[sample.stage] += sample.duration; });
+}
+
+/**
+ * @brief Drops every sample, e.g. between the runs of a benchmark. No thread may be recording meanwhile
+ */
+void clearStageSamples()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto &ring : ringRegistry())
+    {
+        ring->written.store(0, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief Nearest-rank percentile of sorted values
+ */
+static double percentile(const std::vector<int64_t> &sorted, double q)
+{
+    size_t rank = (size_t)std::ceil(q * sorted.size());
+    return sorted[std::min(sorted.size(), std::max((size_t)1, rank)) - 1] / 1e6;
+}
+
+/**
+ * @brief Prints count, mean, p50, p95, p99 and max of every stage that was measured, in milliseconds
+ */
+void printStageSummary()
+{
+    std::vector<int64_t> durations[STAGE_COUNT];
+    forEachSample([&](const StageSample &sample, int)
+                  { durations[sample.stage].push_back(sample.duration); });
+
+    printf("Stage timings [ms]\n");
+    printf("%-12s %8s %10s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50", "p95", "p99", "max");
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        std::vector<int64_t> &d = durations[s];
+        if (d.empty())
+            continue;
+        std::sort(d.begin(), d.end());
+        double sum = 0;
+        for (int64_t v : d)
+            sum += v;
+        printf("%-12s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", stageNames[s], d.size(), sum / d.size() / 1e6,
+               percentile(d, 0.50), percentile(d, 0.95), percentile(d, 0.99), d.back() / 1e6);
+    }
+}
+
+/**
+ * @brief Writes the samples as complete ("X") events of the Chrome trace format, one track per thread.
+ * Open the file in chrome://tracing or https://ui.perfetto.dev
+ *
+ * @param filename Output JSON file
+ * @return true on success
+ */
+bool writeChromeTrace(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "w");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Unable to write trace %s\n", filename.c_str());
+        return false;
+    }
+    int64_t origin = INT64_MAX;
+    forEachSample([&](const StageSample &sample, int)
+                  { origin = std::min(origin, sample.start); });
+
+    fprintf(file, "{\"traceEvents\":[");
+    bool first = true;
+    forEachSample([&](const StageSample &sample, int thread)
+                  {
+        fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                first ? "" : ",", stageNames[sample.stage], (sample.start - origin) / 1e3, sample.duration / 1e3, thread);
+        first = false; });
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "../include/convolution_cpu.h"
+#include "../include/thread_pool.h"
+#include "../include/structure_tensor_cpu.h"
+using namespace std;
+
+/**
+ * @brief Sets the aggregation window. A Gaussian window uses the factors of the pipeline's Gaussian if it has the
+ * same size (the GPU blurs the products with that kernel), otherwise a normalized Gaussian with the usual
+ * sigma = 0.3 * ((size - 1) / 2 - 1) + 0.8.
+ *
+ * @param type Window type
+ * @param size Window side, rounded up to an odd number
+ * @param pipelineGaussian Gaussian kernel of the pipeline, or nullptr
+ */
+void StructureTensorSettings::setWindow(TensorWindow type, int size, const ConvolutionKernel *pipelineGaussian)
+{
+    window = type;
+    windowSize = type == TENSOR_WINDOW_NONE ? 1 : std::max(1, size | 1);
+    gaussianRow.clear();
+    gaussianCol.clear();
+    if (type != TENSOR_WINDOW_GAUSSIAN)
+        return;
+    if (pipelineGaussian && pipelineGaussian->separable && pipelineGaussian->size == windowSize)
+    {
+        gaussianRow = pipelineGaussian->row;
+        gaussianCol = pipelineGaussian->col;
+        return;
+    }
+    const float sigma = 0.3f * ((windowSize - 1) * 0.5f - 1) + 0.8f;
+    const int r = windowSize / 2;
+    float sum = 0;
+    gaussianRow.resize(windowSize);
+    for (int i = -r; i <= r; i++)
+    {
+        gaussianRow[i + r] = expf(-(float)(i * i) / (2.f * sigma * sigma));
+        sum += gaussianRow[i + r];
+    }
+    for (float &tap : gaussianRow)
+        tap /= sum;
+    gaussianCol = gaussianRow;
+}
+
+/**
+ * @brief Corner response of one row from its windowed tensor entries
+ *
+ * @param a Sum of Ix^2
+ * @param b Sum of Ix*Iy
+ * @param c Sum of Iy^2
+ * @param out Output row
+ * @param cols Row length
+ * @param settings Response type and Harris k
+ */
+static inline void responseRow(const float *a, const float *b, const float *c, float *out, int cols, const StructureTensorSettings &settings)
+{
+    switch (settings.response)
+    {
+    case RESPONSE_DET_TRACE:
+        for (int j = 0; j < cols; j++)
+        {
+            float det = a[j] * c[j] - b[j] * b[j];
+            float trace = a[j] + c[j];
+            out[j] = trace != 0 ? det / trace : 0;
+        }
+        break;
+    case RESPONSE_HARRIS_K:
+        for (int j = 0; j < cols; j++)
+        {
+            float det = a[j] * c[j] - b[j] * b[j];
+            float trace = a[j] + c[j];
+            out[j] = det - settings.k * trace * trace;
+        }
+        break;
+    case RESPONSE_SHI_TOMASI:
+        // (a + c) / 2 - sqrt(((a - c) / 2)^2 + b^2): unlike sqrt(trace^2 / 4 - det) the radicand cannot go negative by rounding
+        for (int j = 0; j < cols; j++)
+        {
+            float half_diff = 0.5f * (a[j] - c[j]);
+            out[j] = 0.5f * (a[j] + c[j]) - std::sqrt(half_diff * half_diff + b[j] * b[j]);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Gradient products of one row, 0 outside the image
+ */
+static inline void productsRow(const cv::Mat &gradX, const cv::Mat &gradY, int y, float *xx, float *xy, float *yy)
+{
+    const int cols = gradX.cols;
+    if (y < 0 || y >= gradX.rows)
+    {
+        std::fill(xx, xx + cols, 0.0f);
+        std::fill(xy, xy + cols, 0.0f);
+        std::fill(yy, yy + cols, 0.0f);
+        return;
+    }
+    const float *gx = gradX.ptr<float>(y);
+    const float *gy = gradY.ptr<float>(y);
+    for (int j = 0; j < cols; j++)
+    {
+        xx[j] = gx[j] * gx[j];
+        xy[j] = gx[j] * gy[j];
+        yy[j] = gy[j] * gy[j];
+    }
+}
+
+/**
+ * @brief Horizontal box sum of one row with a running sum: each pixel costs one add and one subtract whatever the radius
+ */
+static inline void boxRow(const float *src, float *dst, int cols, int r)
+{
+    double sum = 0;
+    for (int j = 0; j < std::min(r, cols); j++)
+        sum += src[j];
+    for (int j = 0; j < cols; j++)
+    {
+        if (j + r < cols)
+            sum += src[j + r];
+        dst[j] = (float)sum;
+        if (j - r >= 0)
+            sum -= src[j - r];
+    }
+}
+
+/**
+ * @brief Row buffers of one band, kept per thread
+ */
+struct TensorBuffers
+{
+    // products of the current row
+    std::vector<float> products;
+    // horizontally windowed products, a ring of rows with 3 planes per row
+    std::vector<float> ring;
+    // box: running column sums of the ring
+    std::vector<double> columns;
+    // windowed tensor entries of the output row
+    std::vector<float> tensor;
+    // ring rows under the vertical Gaussian window
+    std::vector<const float *> window;
+};
+
+/**
+ * @brief Structure tensor and response for the rows [rowBegin, rowEnd). The three products are computed, windowed
+ * horizontally and pushed into a ring of rows, from which the vertical window is taken: a single pass over the
+ * gradients with no full-frame product planes. The band starts radius rows early, so bands are independent.
+ *
+ * @return float Largest response of the band
+ */
+static float tensorBand(const cv::Mat &gradX, const cv::Mat &gradY, cv::Mat &response, const StructureTensorSettings &settings, int rowBegin, int rowEnd)
+{
+    const int cols = gradX.cols;
+    const int size = settings.windowSize;
+    const int r = size / 2;
+    const bool box = settings.window == TENSOR_WINDOW_BOX;
+    // the box ring keeps one more row: the one leaving the running column sums
+    const int slots = box ? size + 1 : size;
+
+    static thread_local TensorBuffers buffers;
+    buffers.products.resize(3 * cols);
+    buffers.ring.resize((size_t)slots * 3 * cols);
+    buffers.tensor.resize(3 * cols);
+    float *products = buffers.products.data();
+    float *tensor = buffers.tensor.data();
+    auto plane = [&](int y, int p)
+    { return buffers.ring.data() + ((size_t)(((y % slots) + slots) % slots) * 3 + p) * cols; };
+    if (box)
+        buffers.columns.assign(3 * cols, 0.0);
+    buffers.window.resize(size);
+    const float **window = buffers.window.data();
+
+    float band_max = -1e30f;
+    const int y0 = rowBegin - r;
+    for (int y = y0; y < rowEnd + r; y++)
+    {
+        productsRow(gradX, gradY, y, products, products + cols, products + 2 * cols);
+        for (int p = 0; p < 3; p++)
+        {
+            if (box)
+                boxRow(products + p * cols, plane(y, p), cols, r);
+            else
+                convolveRowCPU(products + p * cols, plane(y, p), cols, settings.gaussianRow.data(), size, CONV_BORDER_CONSTANT);
+        }
+        if (box)
+        {
+            double *columns = buffers.columns.data();
+            for (int p = 0; p < 3; p++)
+            {
+                const float *in = plane(y, p);
+                const float *out = y - size >= y0 ? plane(y - size, p) : nullptr;
+                double *sum = columns + p * cols;
+                for (int j = 0; j < cols; j++)
+                    sum[j] += in[j] - (out ? out[j] : 0.0f);
+            }
+        }
+
+        const int o = y - r;
+        if (o < rowBegin)
+            continue;
+        if (box)
+        {
+            for (int j = 0; j < 3 * cols; j++)
+                tensor[j] = (float)buffers.columns[j];
+        }
+        else
+        {
+            for (int p = 0; p < 3; p++)
+            {
+                for (int i = 0; i < size; i++)
+                    window[i] = plane(o - r + i, p);
+                convolveColumnsCPU(window, tensor + p * cols, cols, settings.gaussianCol.data(), size);
+            }
+        }
+        float *out = response.ptr<float>(o);
+        responseRow(tensor, tensor + cols, tensor + 2 * cols, out, cols, settings);
+        for (int j = 0; j < cols; j++)
+            band_max = std::max(band_max, out[j]);
+    }
+    return band_max;
+}
+
+/**
+ * @brief Computes the corner response of every pixel from the Sobel gradients: the structure tensor is built from
+ * the products Ix^2, Ix*Iy and Iy^2 summed over a window, then turned into det/trace, the Harris response or the
+ * Shi-Tomasi smallest eigenvalue. Box windows cost the same at any size, Gaussian windows go through the separable
+ * row/column engine. Without a window only the inner pixels are written, like the original detector.
+ *
+ * @param gradX Sobel x gradient, CV_32F
+ * @param gradY Sobel y gradient, CV_32F
+ * @param response Output response, CV_32F, same size
+ * @param settings Window and response
+ * @return float Largest response
+ */
+float structureTensorResponseCPU(const cv::Mat &gradX, const cv::Mat &gradY, cv::Mat &response, const StructureTensorSettings &settings)
+{
+    const int rows = gradX.rows;
+    const int cols = gradX.cols;
+    float max = -1e30f;
+    std::mutex max_mutex;
+    if (settings.window == TENSOR_WINDOW_NONE || settings.windowSize <= 1)
+    {
+        parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                        {
+            static thread_local std::vector<float> products;
+            products.resize(3 * cols);
+            float band_max = -1e30f;
+            for (int i = std::max(rowBegin, 1); i < std::min(rowEnd, rows - 1); i++)
+            {
+                productsRow(gradX, gradY, i, products.data(), products.data() + cols, products.data() + 2 * cols);
+                float *out = response.ptr<float>(i);
+                responseRow(products.data() + 1, products.data() + cols + 1, products.data() + 2 * cols + 1, out + 1, cols - 2, settings);
+            }
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                const float *h = response.ptr<float>(i);
+                for (int j = 0; j < cols; j++)
+                    band_max = std::max(band_max, h[j]);
+            }
+            std::lock_guard<std::mutex> lock(max_mutex);
+            max = std::max(max, band_max); });
+        return max;
+    }
+    parallelForRows(rows, [&](int rowBegin, int rowEnd)
+                    {
+        float band_max = tensorBand(gradX, gradY, response, settings, rowBegin, rowEnd);
+        std::lock_guard<std::mutex> lock(max_mutex);
+        max = std::max(max, band_max); }, 32);
+    return max;
+}
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <memory>
+#include "../include/thread_pool.h"
+using namespace std;
+
+// true on the pool workers, and on the submitting thread while it runs tasks, so that nested parallel calls run
+// inline instead of deadlocking
+static thread_local bool insidePool = false;
+
+/**
+ * @brief Creates the pool
+ *
+ * @param numThreads Total number of threads, including the caller
+ */
+ThreadPool::ThreadPool(int numThreads)
+{
+    for (int i = 1; i < numThreads; i++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Worker body: waits for a new job, pulls task indices until they run out, then signals the caller.
+ */
+void ThreadPool::workerLoop()
+{
+    insidePool = true;
+    unsigned long seen = 0;
+    while (true)
+    {
+        const std::function<void(int)> *task;
+        int numTasks;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]
+                      { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            task = job;
+            numTasks = jobTasks;
+        }
+        for (int i = nextTask.fetch_add(1); i < numTasks; i = nextTask.fetch_add(1))
+        {
+            (*task)(i);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--activeWorkers == 0)
+                done.notify_one();
+        }
+    }
+}
+
+/**
+ * @brief Runs task(0) ... task(numTasks - 1) on the pool and returns when all of them are done.
+ * Tasks are handed out dynamically, one index at a time.
+ *
+ * @param numTasks Number of tasks
+ * @param task Task body, receives the task index
+ */
+void ThreadPool::parallelFor(int numTasks, const std::function<void(int)> &task)
+{
+    if (workers.empty() || numTasks <= 1 || insidePool)
+    {
+        for (int i = 0; i < numTasks; i++)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        jobTasks = numTasks;
+        nextTask = 0;
+        activeWorkers = (int)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    // the caller holds submitMutex while it runs tasks: a nested call from one of them must run inline too
+    insidePool = true;
+    for (int i = nextTask.fetch_add(1); i < numTasks; i = nextTask.fetch_add(1))
+    {
+        task(i);
+    }
+    insidePool = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]
+              { return activeWorkers == 0; });
+    job = nullptr;
+}
+
+static std::unique_ptr<ThreadPool> globalPool;
+
+/**
+ * @brief Sets the number of threads used by the CPU pipelines. Not thread safe, call it before processing.
+ *
+ * @param numThreads Number of threads. 0 or less means one per hardware thread
+ */
+void setNumThreadsCPU(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (globalPool && globalPool->size() == numThreads)
+        return;
+    globalPool.reset(new ThreadPool(numThreads));
+}
+
+/**
+ * @brief Number of threads used by the CPU pipelines (1 unless setNumThreadsCPU was called)
+ */
+int getNumThreadsCPU()
+{
+    return globalPool ? globalPool->size() : 1;
+}
+
+/**
+ * @brief Splits [0, rows) into contiguous row bands and processes them on the CPU thread pool.
+ * Each band must only write its own rows; reading halo rows produced by a previous call is fine.
+ *
+ * @param rows Number of rows
+ * @param band Band body, receives [rowBegin, rowEnd)
+ * @param minBandRows Minimum band height, to keep halo and scheduling overhead small
+ */
+void parallelForRows(int rows, const std::function<void(int, int)> &band, int minBandRows)
+{
+    int threads = getNumThreadsCPU();
+    if (threads <= 1 || rows <= minBandRows)
+    {
+        band(0, rows);
+        return;
+    }
+    // a few bands per thread for load balancing
+    int numBands = std::min(threads * 4, (rows + minBandRows - 1) / minBandRows);
+    auto task = [&](int b)
+    {
+        int rowBegin = (int)((long long)rows * b / numBands);
+        int rowEnd = (int)((long long)rows * (b + 1) / numBands);
+        band(rowBegin, rowEnd);
+    };
+    globalPool->parallelFor(numBands, std::cref(task));
+}
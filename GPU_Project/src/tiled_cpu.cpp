@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "../include/tiled_cpu.h"
+#include "../include/hysteresis_cpu.h"
+#include "../include/raw_io.h"
+#include "../include/thread_pool.h"
+using namespace std;
+
+/**
+ * @brief Splits an image into tiles whose padded size fits a memory budget
+ *
+ * @param imageRows Image height
+ * @param imageCols Image width
+ * @param tileHalo Halo width, the combined radius of the detector stages
+ * @param budgetBytes Memory budget of one tile in flight, see TILE_BYTES_PER_PIXEL
+ * @param align The interior side is a multiple of this, e.g. the sampling step of a histogram
+ * @return true if a tile of at least 16 pixels plus halos fits the budget
+ */
+bool TileGrid::plan(int imageRows, int imageCols, int tileHalo, size_t budgetBytes, int align)
+{
+    rows = imageRows;
+    cols = imageCols;
+    halo = tileHalo;
+    align = std::max(1, align);
+    const int side = (int)std::sqrt((double)budgetBytes / TILE_BYTES_PER_PIXEL);
+    // no point in tiles larger than the image
+    tileSize = std::min(side - 2 * halo, (std::max(rows, cols) + align - 1) / align * align);
+    tileSize = tileSize / align * align;
+    if (tileSize < std::max(16, align))
+        return false;
+    tilesX = (cols + tileSize - 1) / tileSize;
+    tilesY = (rows + tileSize - 1) / tileSize;
+    return true;
+}
+
+/**
+ * @brief Pixels of the image a tile is responsible for, tiles are numbered row by row
+ */
+cv::Rect TileGrid::interior(int tile) const
+{
+    const int x = (tile % tilesX) * tileSize;
+    const int y = (tile / tilesX) * tileSize;
+    return cv::Rect(x, y, std::min(tileSize, cols - x), std::min(tileSize, rows - y));
+}
+
+/**
+ * @brief Interior of a tile plus its halo, clipped to the image
+ */
+cv::Rect TileGrid::padded(int tile) const
+{
+    const cv::Rect in = interior(tile);
+    const int x0 = std::max(0, in.x - halo);
+    const int y0 = std::max(0, in.y - halo);
+    const int x1 = std::min(cols, in.x + in.width + halo);
+    const int y1 = std::min(rows, in.y + in.height + halo);
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * @brief Starts the edge tracking of a tiled image, with no component known yet
+ */
+void TiledHysteresis::begin(const TileGrid &tileGrid)
+{
+    grid = tileGrid;
+    rowNodes.assign((size_t)grid.tilesY * 2 * grid.cols, -1);
+    colNodes.assign((size_t)grid.tilesX * 2 * grid.rows, -1);
+    parent.clear();
+    strong.clear();
+}
+
+/**
+ * @brief Calls visit(p, node) for every border pixel of a tile: p its index in the tile interior, node its entry in
+ * rowNodes or colNodes. Corner pixels are visited once for their row and once for their column
+ */
+template <typename Visit>
+void TiledHysteresis::visitBorder(int tile, const Visit &visit)
+{
+    const cv::Rect in = grid.interior(tile);
+    const int tx = tile % grid.tilesX;
+    const int ty = tile / grid.tilesX;
+    int *top = &rowNodes[(size_t)(ty * 2) * grid.cols + in.x];
+    int *bottom = &rowNodes[(size_t)(ty * 2 + 1) * grid.cols + in.x];
+    int *left = &colNodes[(size_t)(tx * 2) * grid.rows + in.y];
+    int *right = &colNodes[(size_t)(tx * 2 + 1) * grid.rows + in.y];
+    for (int x = 0; x < in.width; x++)
+    {
+        visit(x, top[x]);
+        visit((in.height - 1) * in.width + x, bottom[x]);
+    }
+    for (int y = 0; y < in.height; y++)
+    {
+        visit(y * in.width, left[y]);
+        visit(y * in.width + in.width - 1, right[y]);
+    }
+}
+
+int TiledHysteresis::find(int node)
+{
+    while (parent[node] != node)
+    {
+        // path halving
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+void TiledHysteresis::unite(int a, int b)
+{
+    a = find(a);
+    b = find(b);
+    if (a == b)
+        return;
+    if (a > b)
+        std::swap(a, b);
+    parent[b] = a;
+    strong[a] |= strong[b];
+}
+
+/**
+ * @brief Labels the candidate components of a tile and records the ones reaching its border
+ *
+ * @param tile Tile index
+ * @param tts Double threshold map of the tile interior, CV_32F or CV_8U
+ */
+void TiledHysteresis::addTile(int tile, const cv::Mat &tts)
+{
+    tts.copyTo(map);
+    hysteresisLabelsCPU(map, labels, labelStrong);
+    nodeOf.assign(labels.size(), -1);
+    visitBorder(tile, [&](int p, int &node)
+                {
+        const int root = labels[p];
+        if (root < 0)
+            return;
+        if (nodeOf[root] < 0)
+        {
+            nodeOf[root] = (int)parent.size();
+            parent.push_back(nodeOf[root]);
+            strong.push_back(labelStrong[root]);
+        }
+        node = nodeOf[root]; });
+}
+
+/**
+ * @brief Joins the components of neighbouring tiles: every border pixel is 8-connected to up to three pixels on the
+ * other side of the boundary, diagonal neighbours across a tile corner included
+ */
+void TiledHysteresis::resolve()
+{
+    for (int ty = 0; ty + 1 < grid.tilesY; ty++)
+    {
+        const int *above = &rowNodes[(size_t)(ty * 2 + 1) * grid.cols];
+        const int *below = &rowNodes[(size_t)(ty * 2 + 2) * grid.cols];
+        for (int x = 0; x < grid.cols; x++)
+        {
+            if (above[x] < 0)
+                continue;
+            for (int xx = std::max(x - 1, 0); xx <= std::min(x + 1, grid.cols - 1); xx++)
+            {
+                if (below[xx] >= 0)
+                    unite(above[x], below[xx]);
+            }
+        }
+    }
+    for (int tx = 0; tx + 1 < grid.tilesX; tx++)
+    {
+        const int *left = &colNodes[(size_t)(tx * 2 + 1) * grid.rows];
+        const int *right = &colNodes[(size_t)(tx * 2 + 2) * grid.rows];
+        for (int y = 0; y < grid.rows; y++)
+        {
+            if (left[y] < 0)
+                continue;
+            for (int yy = std::max(y - 1, 0); yy <= std::min(y + 1, grid.rows - 1); yy++)
+            {
+                if (right[yy] >= 0)
+                    unite(left[y], right[yy]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Edges of a tile: the candidates whose component contains a strong pixel, in this tile or in any tile the
+ * component reaches
+ *
+ * @param tile Tile index
+ * @param tts Double threshold map of the tile interior, the same as given to addTile
+ * @param edges Output, CV_8U, 255 on edges
+ */
+void TiledHysteresis::finishTile(int tile, const cv::Mat &tts, cv::Mat &edges)
+{
+    tts.copyTo(map);
+    hysteresisLabelsCPU(map, labels, labelStrong);
+    visitBorder(tile, [&](int p, int &node)
+                {
+        if (node >= 0 && strong[find(node)])
+            labelStrong[labels[p]] = 1; });
+    const int width = map.cols;
+    edges.create(map.rows, width, CV_8U);
+    parallelForRows(map.rows, [&](int rowBegin, int rowEnd)
+                    {
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            uchar *out = edges.ptr<uchar>(y);
+            for (int x = 0; x < width; x++)
+            {
+                const int root = labels[y * width + x];
+                out[x] = root >= 0 && labelStrong[root] ? HYSTERESIS_STRONG : 0;
+            }
+        } });
+}
+
+/**
+ * @brief Opens an image. PPM and PGM files with 8-bit samples only have their header read here
+ *
+ * @param path Image filename
+ * @return true if the image can be read
+ */
+bool TiledImageReader::open(const std::string &path)
+{
+    close();
+    const std::string ext = extensionOf(path);
+    if (ext == "ppm" || ext == "pgm")
+    {
+        file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            std::cerr << "Error: Unable to open " << path << std::endl;
+            return false;
+        }
+        int maxval = 0;
+        auto fileByte = [this]() { return fgetc(file); };
+        const bool binary = fgetc(file) == 'P';
+        const int format = fgetc(file);
+        if (!binary || (format != '5' && format != '6') || !readPnmField(fileByte, width) || !readPnmField(fileByte, height) ||
+            !readPnmField(fileByte, maxval) || maxval > 255 || width <= 0 || height <= 0)
+        {
+            std::cerr << "Error: " << path << " is not a binary 8-bit PPM/PGM file" << std::endl;
+            close();
+            return false;
+        }
+        channels = format == '6' ? 3 : 1;
+        dataOffset = ftello(file);
+        return true;
+    }
+
+    cv::Mat img = cv::imread(path, cv::IMREAD_COLOR);
+    if (img.empty())
+    {
+        std::cerr << "Error: Unable to load image." << std::endl;
+        return false;
+    }
+    cv::cvtColor(img, decoded, cv::COLOR_BGR2RGB);
+    width = decoded.cols;
+    height = decoded.rows;
+    return true;
+}
+
+/**
+ * @brief Reads a rectangle of the image
+ *
+ * @param rect Rectangle, inside the image
+ * @param rgb Output RGB image of the rectangle size, CV_8UC3. Reallocated only when the size changes
+ * @return true on success
+ */
+bool TiledImageReader::read(const cv::Rect &rect, cv::Mat &rgb)
+{
+    rgb.create(rect.height, rect.width, CV_8UC3);
+    if (!file)
+    {
+        if (decoded.empty())
+            return false;
+        decoded(rect).copyTo(rgb);
+        return true;
+    }
+    if (channels == 1)
+        rowBuffer.resize(rect.width);
+    for (int y = 0; y < rect.height; y++)
+    {
+        const long long offset = dataOffset + ((long long)(rect.y + y) * width + rect.x) * channels;
+        uchar *dst = channels == 3 ? rgb.ptr<uchar>(y) : rowBuffer.data();
+        if (fseeko(file, offset, SEEK_SET) != 0 || fread(dst, channels, rect.width, file) != (size_t)rect.width)
+        {
+            std::cerr << "Error: Truncated image file" << std::endl;
+            return false;
+        }
+        if (channels == 1)
+        {
+            cv::Vec3b *out = rgb.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < rect.width; x++)
+                out[x] = cv::Vec3b(dst[x], dst[x], dst[x]);
+        }
+    }
+    return true;
+}
+
+void TiledImageReader::close()
+{
+    if (file)
+        fclose(file);
+    file = nullptr;
+    decoded.release();
+}
+
+/**
+ * @brief Opens the output. PPM (3 channels) and PGM (1 channel) targets get their header written here
+ *
+ * @param path Output filename
+ * @param rows Image height
+ * @param cols Image width
+ * @param numChannels 1 for a grayscale image, 3 for RGB
+ * @return true if the image can be written
+ */
+bool TiledImageWriter::open(const std::string &path, int rows, int cols, int numChannels)
+{
+    close();
+    target = path;
+    width = cols;
+    height = rows;
+    channels = numChannels;
+    failed = false;
+    const std::string ext = extensionOf(path);
+    if ((ext == "pgm" && channels == 1) || (ext == "ppm" && channels == 3))
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Error: Unable to open " << path << std::endl;
+            return false;
+        }
+        fprintf(file, "P%c\n%d %d\n255\n", channels == 3 ? '6' : '5', width, height);
+        dataOffset = ftello(file);
+        return true;
+    }
+    if (!cv::haveImageWriter(path))
+    {
+        std::cerr << "Error: No encoder for " << path << std::endl;
+        return false;
+    }
+    assembled.create(rows, cols, channels == 3 ? CV_8UC3 : CV_8UC1);
+    return true;
+}
+
+/**
+ * @brief Writes a rectangle of the image
+ *
+ * @param tile Pixels of the rectangle, CV_8U with the channels given to open (RGB order)
+ * @param at Top left corner of the rectangle in the image
+ * @return true on success
+ */
+bool TiledImageWriter::write(const cv::Mat &tile, cv::Point at)
+{
+    if (!file)
+    {
+        if (assembled.empty())
+            return false;
+        tile.copyTo(assembled(cv::Rect(at.x, at.y, tile.cols, tile.rows)));
+        return true;
+    }
+    for (int y = 0; y < tile.rows; y++)
+    {
+        const long long offset = dataOffset + ((long long)(at.y + y) * width + at.x) * channels;
+        if (fseeko(file, offset, SEEK_SET) != 0 || fwrite(tile.ptr<uchar>(y), channels, tile.cols, file) != (size_t)tile.cols)
+        {
+            std::cerr << "Error: Unable to write " << target << std::endl;
+            failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Finishes the output: flushes a PPM/PGM file, or encodes the assembled image
+ *
+ * @return true if the whole image was written
+ */
+bool TiledImageWriter::close()
+{
+    bool ok = !failed;
+    if (file)
+    {
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+    }
+    else if (!assembled.empty())
+    {
+        if (channels == 3)
+            cv::cvtColor(assembled, assembled, cv::COLOR_RGB2BGR);
+        ok = cv::imwrite(target, assembled) && ok;
+        assembled.release();
+    }
+    return ok;
+}
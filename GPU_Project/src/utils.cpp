@@ -6,38 +6,21 @@
 #include <opencv2/imgproc.hpp>
 // include PI
 #include <cmath>
+#include "../include/filters.h"
 
 using namespace std;
 using namespace cv;
+/**
+ * @brief Gaussian kernel for a width only known at run time, see gaussianKernel for the compile-time one
+ *
+ * @param filterWidth Odd filter width
+ * @param filterSigma Standard deviation
+ * @return float* malloc'd filterWidth x filterWidth weights, to free
+ */
 float *computeGaussianKernel(int filterWidth, float filterSigma)
 {
-    float *host_filter;
-
-    // host_filter = new float[filterWidth * filterWidth];
-    host_filter = (float *)malloc(filterWidth * filterWidth * sizeof(float));
-
-    float filterSum = 0.f;
-
-    for (int r = -filterWidth / 2; r <= filterWidth / 2; ++r)
-    {
-        for (int c = -filterWidth / 2; c <= filterWidth / 2; ++c)
-        {
-            float filterValue = expf(-(float)(c * c + r * r) / (2.f * filterSigma * filterSigma));
-            filterValue = filterValue / (2.f * M_PI * filterSigma * filterSigma);
-            (host_filter)[(r + filterWidth / 2) * filterWidth + c + filterWidth / 2] = filterValue;
-            filterSum += filterValue;
-        }
-    }
-
-    float normalizationFactor = 1.f / filterSum;
-
-    for (int r = -filterWidth / 2; r <= filterWidth / 2; ++r)
-    {
-        for (int c = -filterWidth / 2; c <= filterWidth / 2; ++c)
-        {
-            (host_filter)[(r + filterWidth / 2) * filterWidth + c + filterWidth / 2] *= normalizationFactor;
-        }
-    }
+    float *host_filter = (float *)malloc(filterWidth * filterWidth * sizeof(float));
+    fillGaussianKernel(host_filter, filterWidth, filterSigma);
     return host_filter;
 }
 void saveImage(int height, int width, float *img, string name)
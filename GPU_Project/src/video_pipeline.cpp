@@ -0,0 +1,105 @@
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include "../include/spsc_queue.h"
+#include "../include/stage_timer.h"
+#include "../include/video_pipeline.h"
+using namespace std;
+
+/**
+ * @brief Frame buffers handed from stage to stage
+ */
+struct VideoFrame
+{
+    cv::Mat input;
+    cv::Mat output;
+};
+
+/**
+ * @brief Plays a video through three stages, each on its own thread: decoding, processing and presenting.
+ * Stages exchange indices of recycled frame buffers through bounded queues, so once every buffer has been used
+ * nothing is allocated and the throughput is bound by the slowest stage instead of the sum of the three.
+ * Presenting runs on the calling thread, since the GUI must stay on the main thread.
+ *
+ * @param decode Decoding stage
+ * @param process Processing stage
+ * @param present Presenting stage
+ * @param depth Frames that can wait between two stages
+ * @return int Number of presented frames
+ */
+int runVideoPipeline(const FrameSource &decode, const FrameProcessor &process, const FramePresenter &present, int depth)
+{
+    // each stage holds one frame, each of the two queues up to depth more
+    const int numFrames = 2 * depth + 3;
+    std::vector<VideoFrame> frames(numFrames);
+    SpscQueue<int> freeFrames(numFrames);
+    SpscQueue<int> decoded(depth);
+    SpscQueue<int> processed(depth);
+    for (int i = 0; i < numFrames; i++)
+    {
+        freeFrames.push(i);
+    }
+
+    std::thread decoder([&]
+                        {
+        int slot;
+        while (freeFrames.pop(slot))
+        {
+            bool ok;
+            {
+                ScopedStageTimer timer(STAGE_DECODE);
+                ok = decode(frames[slot].input);
+            }
+            if (!ok || frames[slot].input.empty() || !decoded.push(slot))
+                break;
+        }
+        decoded.close(); });
+
+    std::thread processor([&]
+                          {
+        int slot;
+        while (decoded.pop(slot))
+        {
+            process(frames[slot].input, frames[slot].output);
+            if (!processed.push(slot))
+                break;
+        }
+        processed.close(); });
+
+    int presented = 0;
+    int slot;
+    while (processed.pop(slot))
+    {
+        presented++;
+        if (!present(frames[slot].output))
+        {
+            // stops the other stages, wherever they are blocked
+            freeFrames.close();
+            decoded.close();
+            processed.close();
+            break;
+        }
+        freeFrames.push(slot);
+    }
+
+    decoder.join();
+    processor.join();
+    return presented;
+}
+
+/**
+ * @brief Plays a video decoded by OpenCV through the three stages, see above
+ *
+ * @param cap Opened video
+ * @param process Processing stage
+ * @param present Presenting stage
+ * @param depth Frames that can wait between two stages
+ * @return int Number of presented frames
+ */
+int runVideoPipeline(cv::VideoCapture &cap, const FrameProcessor &process, const FramePresenter &present, int depth)
+{
+    return runVideoPipeline([&](cv::Mat &frame)
+                            { return cap.read(frame); },
+                            process, present, depth);
+}
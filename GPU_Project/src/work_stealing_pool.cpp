@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "../include/work_stealing_pool.h"
+using namespace std;
+
+/**
+ * @brief Creates the deques. Threads only live for the duration of run
+ *
+ * @param numThreads Number of workers, the calling thread being one of them
+ */
+WorkStealingPool::WorkStealingPool(int numThreads)
+{
+    for (int i = 0; i < std::max(1, numThreads); i++)
+        queues.emplace_back(new WorkerQueue());
+}
+
+bool WorkStealingPool::popLocal(int worker, int &task)
+{
+    WorkerQueue &queue = *queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+/**
+ * @brief Takes the last task of another worker, visiting the victims round-robin from the thief
+ */
+bool WorkStealingPool::steal(int thief, int &task)
+{
+    const int n = size();
+    for (int i = 1; i < n; i++)
+    {
+        WorkerQueue &victim = *queues[(thief + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty())
+            continue;
+        task = victim.tasks.back();
+        victim.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Runs task(worker, t) for every t in [0, numTasks) and returns when all are done.
+ * Tasks are dealt in contiguous blocks, one per worker; no task is added while running, so a worker whose deque
+ * and steal attempts all come back empty can stop.
+ *
+ * @param numTasks Number of tasks
+ * @param task Task body. worker is in [0, size()) and identifies the thread, for per-worker state
+ */
+void WorkStealingPool::run(int numTasks, const std::function<void(int worker, int task)> &task)
+{
+    const int n = size();
+    for (int w = 0; w < n; w++)
+    {
+        const int begin = (int)((long long)numTasks * w / n);
+        const int end = (int)((long long)numTasks * (w + 1) / n);
+        std::lock_guard<std::mutex> lock(queues[w]->mutex);
+        queues[w]->tasks.clear();
+        for (int t = begin; t < end; t++)
+            queues[w]->tasks.push_back(t);
+    }
+
+    std::atomic<int> stolen(0);
+    auto worker_loop = [&](int worker)
+    {
+        int t;
+        while (true)
+        {
+            if (popLocal(worker, t))
+            {
+                task(worker, t);
+            }
+            else if (steal(worker, t))
+            {
+                stolen++;
+                task(worker, t);
+            }
+            else
+            {
+                return;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int w = 1; w < n; w++)
+        threads.emplace_back(worker_loop, w);
+    worker_loop(0);
+    for (std::thread &thread : threads)
+        thread.join();
+    stolenTasks = stolen.load();
+}